@@ -43,9 +43,11 @@
     unsigned minFileSize;
     unsigned ramUsed;
     unsigned fileCount;
+    ts::ASSettingsCollection* deviceSettings;
 }
 
 - (id)initWithDevice:(ts::ASDevice*)dev appletIndex:(int)appletIndex;
+- (id)initWithDevice:(ts::ASDevice*)dev appletIndex:(int)appletIndex settings:(ts::ASSettingsCollection*)settings;
 - (void)dealloc;
 
 - (ASDeviceNode*)deviceNode;
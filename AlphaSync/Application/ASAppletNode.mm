@@ -54,12 +54,25 @@ static NSImage* iconApplet = nil;              /**< Icon to use for applets. */
 }
 
 
-/** Designated initialiser. This will automatically try to enumerate the files contained by the applet.
+/** Initialiser. The applet settings will be read directly from the device.
  *
  *  @param  devNode     The device that this node will represent.
  *  @return             A pointer to self.
  */
 - (id)initWithDevice:(ts::ASDevice*)dev appletIndex:(int)appletIdx
+{
+    return [self initWithDevice:dev appletIndex:appletIdx settings:0];
+}
+
+
+/** Designated initialiser. This will automatically try to enumerate the files contained by the applet.
+ *
+ *  @param  devNode     The device that this node will represent.
+ *  @param  settings    Settings previously read for all applets on the device (see ASDevice::readAllSettings()),
+ *                      or zero to read the settings directly. The data must remain valid for the life of the node.
+ *  @return             A pointer to self.
+ */
+- (id)initWithDevice:(ts::ASDevice*)dev appletIndex:(int)appletIdx settings:(ts::ASSettingsCollection*)settings
 {
     if ((self = [super init]))
     {
@@ -72,6 +85,7 @@ static NSImage* iconApplet = nil;              /**< Icon to use for applets. */
 
         appletIndex = appletIdx;
         device = dev;
+        deviceSettings = settings;
         applet = device->appletAtIndex(appletIndex);
         if (!applet)
         {
@@ -175,15 +189,26 @@ static NSImage* iconApplet = nil;              /**< Icon to use for applets. */
 
     if (applet->appletID() == kASAppletID_AlphaWord)
     {
-        uint8_t settingsData[8192];
-        unsigned actualBytes;
-        if (device->readSettings(settingsData, &actualBytes, sizeof settingsData, applet, 0x0b))
+        int settingsIndex = (deviceSettings) ? deviceSettings->indexForApplet(applet->appletID(), 0x0b) : -1;
+        if (settingsIndex >= 0)
         {
-            ASSettings settings(settingsData, actualBytes, sizeof settingsData);
+            ASSettings settings = deviceSettings->settingsAtIndex((unsigned)settingsIndex);
             ASSettingsItem item;
             if (settings.findSettingsItem(&item, kASSettingsType_Range32, kASSettingsIdent_AlphaWord_MaxFileSize))  maxFileSize = item.dataU32();
             if (settings.findSettingsItem(&item, kASSettingsType_Range32, kASSettingsIdent_AlphaWord_MinFileSize))  minFileSize = item.dataU32();
         }
+        else
+        {
+            uint8_t settingsData[8192];
+            unsigned actualBytes;
+            if (device->readSettings(settingsData, &actualBytes, sizeof settingsData, applet, 0x0b))
+            {
+                ASSettings settings(settingsData, actualBytes, sizeof settingsData);
+                ASSettingsItem item;
+                if (settings.findSettingsItem(&item, kASSettingsType_Range32, kASSettingsIdent_AlphaWord_MaxFileSize))  maxFileSize = item.dataU32();
+                if (settings.findSettingsItem(&item, kASSettingsType_Range32, kASSettingsIdent_AlphaWord_MinFileSize))  minFileSize = item.dataU32();
+            }
+        }
     }
 
     [[self parent] refresh];
@@ -304,15 +329,60 @@ static NSImage* iconApplet = nil;              /**< Icon to use for applets. */
 
 - (BOOL)loadPermittedFromPaths:(NSArray*)paths
 {
-    if ([paths count] != 1) return FALSE;
-    else return [self loadPermittedFromPath:[paths objectAtIndex:0]];
+    if ([paths count] == 0) return FALSE;
+
+    NSEnumerator* enumerator = [paths objectEnumerator];
+    NSString* path;
+    while ((path = [enumerator nextObject]))
+    {
+        if (![self loadPermittedFromPath:path]) return FALSE;
+    }
+    return TRUE;
 }
 
 
 - (unsigned)loadFromPaths:(NSArray*)paths
 {
-    if ([paths count] != 1) return 0;
-    else return [self loadFromPath:[paths objectAtIndex:0]] ? 1 : 0;
+    if ([paths count] == 0) return 0;
+    if ([paths count] == 1) return [self loadFromPath:[paths objectAtIndex:0]] ? 1 : 0;
+
+    // Multiple files are planned against the available space and transferred as a single batch
+    id accessDelegate = [self delegate];
+    NSMutableArray* acceptedPaths = [NSMutableArray arrayWithCapacity:[paths count]];
+    NSEnumerator* enumerator = [paths objectEnumerator];
+    NSString* path;
+    while ((path = [enumerator nextObject]))
+    {
+        BOOL shouldProceed = YES;
+        if ([accessDelegate conformsToProtocol:@protocol(ASDeviceAccessProtocol)])
+        {
+            shouldProceed = [accessDelegate deviceWillLoad:path sender:self];
+        }
+        if (shouldProceed) [acceptedPaths addObject:path];
+    }
+
+    unsigned loaded = 0;
+    NSArray* fileNodes = [ASFileNode createFileNodesOnDevice:device applet:applet paths:acceptedPaths];
+    for (unsigned i = 0; i < [acceptedPaths count]; i++)
+    {
+        id fileNode = (fileNodes) ? [fileNodes objectAtIndex:i] : [NSNull null];
+        BOOL result = (fileNode != [NSNull null]);
+        if (result)
+        {
+            [self addChild:fileNode];
+            loaded ++;
+        }
+
+        if ([accessDelegate conformsToProtocol:@protocol(ASDeviceAccessProtocol)])
+        {
+            [accessDelegate deviceDidLoad:[acceptedPaths objectAtIndex:i] error:(result)?nil:@"Failed to create file." sender:self];
+        }
+    }
+
+    [self sortChildren];
+    [self refresh];
+
+    return loaded;
 }
 
 
@@ -127,6 +127,7 @@ static void deviceDisconnect(class ASDeviceFactory* factory, void* context, unsi
     {
         if ([deviceNode device] == device)
         {
+            [deviceNode stopEnumeration];
             [rootNode removeChild:deviceNode];
             [notificationCenter postNotificationName:kASDeviceControllerDeviceDisconnected object:deviceNode];
             break;
@@ -172,6 +173,13 @@ static void deviceDisconnect(class ASDeviceFactory* factory, void* context, unsi
  */
 - (void)dealloc
 {
+    NSEnumerator* enumerator = [rootNode childEnumerator];
+    ASDeviceNode* deviceNode;
+    while ((deviceNode = [enumerator nextObject]))
+    {
+        [deviceNode stopEnumeration];   // the timer retains the node, and must not outlive the device
+    }
+
     [rootNode release];     // will invoke the destructors for each contained device node, reseting the devices
     if (deviceFactory) delete deviceFactory;
     [super dealloc];
@@ -182,6 +190,17 @@ static void deviceDisconnect(class ASDeviceFactory* factory, void* context, unsi
  */
 - (BOOL)enable
 {
+    // Persist applet headers between connections, so that devices become usable more quickly
+    NSArray* cachePaths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    if ([cachePaths count] > 0)
+    {
+        NSString* cacheDirectory = [[cachePaths objectAtIndex:0] stringByAppendingPathComponent:[[NSBundle mainBundle] bundleIdentifier]];
+        if ([[NSFileManager defaultManager] createDirectoryAtPath:cacheDirectory withIntermediateDirectories:YES attributes:nil error:nil])
+        {
+            ASDevice::setAppletCacheDirectory([cacheDirectory fileSystemRepresentation]);
+        }
+    }
+
     return deviceFactory->enable(self, deviceDetect, deviceConnect, deviceDisconnect) ? TRUE : FALSE;
 }
 
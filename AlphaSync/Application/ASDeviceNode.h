@@ -30,6 +30,7 @@
  */
 #import "Cocoa/Cocoa.h"
 #import "ASDevice.h"
+#import "ASSettings.h"
 #import "ASNode.h"
 
 @interface ASDeviceNode : ASNode
@@ -41,6 +42,9 @@
     NSString* systemInfo;
     unsigned availableRam;
     unsigned availableRom;
+    ts::ASSettingsCollection* settings;
+    NSTimer* enumerationTimer;          /**< Reads the applet list in the background (see reload). */
+    BOOL enumerationFailed;             /**< Set if background enumeration failed: reload synchronously. */
 }
 
 - (id)initWithDevice:(ts::ASDevice*)dev;
@@ -56,4 +60,8 @@
 - (unsigned)availableRam;
 - (unsigned)availableRom;
 
+- (ts::ASSettingsCollection*)settings;
+
+- (void)stopEnumeration;
+
 @end
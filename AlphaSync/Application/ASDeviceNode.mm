@@ -70,6 +70,7 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
         }
 
         device = dev;
+        settings = new ASSettingsCollection;
 
         // REVIEW: need code here to find an explicit name for the device from hardware IDs and/or files on the device
         [self reload];
@@ -82,6 +83,8 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
  */
 - (void)dealloc
 {
+    [self stopEnumeration];
+
     if (systemVersion) [systemVersion release];
     if (systemBuild) [systemBuild release];
     if (systemDate) [systemDate release];
@@ -91,6 +94,9 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
     systemBuild = nil;
     systemDate = nil;
     systemInfo = nil;
+
+    delete settings;
+    settings = 0;
     [super dealloc];
 }
 
@@ -153,6 +159,15 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
 
 
 
+/** Return the settings for all applets, as read at the last reload.
+ */
+- (ts::ASSettingsCollection*)settings
+{
+    return settings;
+}
+
+
+
 /** Refresh device data.
  */
 - (void)refresh
@@ -203,19 +218,67 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
 }
 
 
+/** Timer callback that reads the next page of applet headers. Once the applet list is complete the
+ *  node is reloaded to create the applet nodes. If enumeration fails, the reload falls back to reading
+ *  the applet list in one go.
+ */
+- (void)continueEnumeration:(NSTimer*)timer
+{
+    (void)timer;
+    bool complete = false;
+    bool ok = device->continueAppletEnumeration(1, &complete);
+    if (complete || !ok)
+    {
+        [self stopEnumeration];
+        enumerationFailed = !ok;
+        [self reload];
+    }
+}
+
+
+/** Stop any background enumeration. This must be called before the device is destroyed.
+ */
+- (void)stopEnumeration
+{
+    if (enumerationTimer)
+    {
+        [enumerationTimer invalidate];
+        enumerationTimer = nil;
+    }
+}
+
+
 /** Re-enumerate. Any existing children will be destroyed and new ones constructed.
  *  This is implicitly called when the device is constructed, but can also be used to force a
  *  re-enumeration following changes to the device data.
+ *
+ *  If the applet list has not yet been read (see ASDevice::initialise()), the node is shown straight
+ *  away without children and the list is read a page at a time from a timer, so that the device and
+ *  the user interface remain responsive. The node reloads again once the list is complete.
  */
 - (void)reload
 {
     [self removeAllChildren];
 
+    if (!enumerationFailed && device->appletForID(kASAppletID_System) && !device->isAppletEnumerationComplete())
+    {
+        if (!enumerationTimer)
+        {
+            enumerationTimer = [NSTimer scheduledTimerWithTimeInterval:0.05 target:self selector:@selector(continueEnumeration:) userInfo:nil repeats:YES];
+        }
+        [self refresh];
+        return;
+    }
+    enumerationFailed = NO;
+
     int displayOption = [[NSUserDefaults standardUserDefaults] integerForKey:kASPreferenceKeyFilter];
 
     const ASApplet* systemApplet = device->appletForID(kASAppletID_System);
     if (systemApplet)
     {
+        // Read the settings for every applet in one go, rather than once per applet node
+        if (!device->readAllSettings(settings)) settings->clear();
+
         int appletIndex = 0;
         const ASApplet* applet;
         while ((applet = device->appletAtIndex(appletIndex)))
@@ -241,7 +304,7 @@ static NSImage* iconDeviceNeo = nil;              /**< Icon to use for Neo mk1 d
 
             if (!ignore)
             {
-                ASAppletNode* appletNode = [[[ASAppletNode alloc] initWithDevice:device appletIndex:appletIndex] autorelease];
+                ASAppletNode* appletNode = [[[ASAppletNode alloc] initWithDevice:device appletIndex:appletIndex settings:settings] autorelease];
                 if (appletNode) [self addChild:appletNode];
             }
             appletIndex ++;
@@ -53,6 +53,7 @@
 
 + (ASFileNode*)createFileNodeOnDevice:(ts::ASDevice*)device applet:(const ts::ASApplet*)applet filename:(NSString*)filename data:(const void*)data size:(unsigned)size;
 + (ASFileNode*)createFileNodeOnDevice:(ts::ASDevice*)device applet:(const ts::ASApplet*)applet path:(NSString*)path;
++ (NSArray*)createFileNodesOnDevice:(ts::ASDevice*)device applet:(const ts::ASApplet*)applet paths:(NSArray*)paths;
 
 - (id)initWithDevice:(ts::ASDevice*)devicePtr applet:(const ts::ASApplet*)app fileIndex:(int)fin fileAttributes:(const ts::ASFileAttributes*)attr;
 - (void)dealloc;
@@ -109,16 +109,14 @@ static NSImage* iconFileBin = nil;              /**< Icon to use for binary file
 }
 
 
-/** Class method used to create a new file on the device.
+/** Load and convert a file from the host for use with an applet.
  *
- *  @param  devicePointer       The device that owns this node.
  *  @param  applet              The applet.
  *  @param  path                The path of a file to be loaded.
- *  @return                     A pointer to the created node.
+ *  @return                     A new file object, or zero if the file could not be loaded. The caller must delete the object.
  */
-+ (ASFileNode*)createFileNodeOnDevice:(ts::ASDevice*)device applet:(const ASApplet*)applet path:(NSString*)path
+static ASFile* importFileFromPath(const ASApplet* applet, NSString* path)
 {
-    ASFileNode* fileNode = nil;
     ASFile* file = 0;
 
     NSStringEncoding encoding = NSMacOSRomanStringEncoding;
@@ -137,24 +135,173 @@ static NSImage* iconFileBin = nil;              /**< Icon to use for binary file
                 default:                                file = new ASGenericFile;           break;
             }
 
-            if (file->importText((const uint16_t*)[unicodeData bytes], [unicodeData length]))
+            if (!file->importText((const uint16_t*)[unicodeData bytes], [unicodeData length]))
             {
-                NSString* deviceFilename = [[path lastPathComponent] stringByDeletingPathExtension];
-                fileNode = [ASFileNode createFileNodeOnDevice:device
-                                       applet:applet
-                                       filename:deviceFilename
-                                       data:file->fileData()
-                                       size:file->fileSize()];
+                delete file;
+                file = 0;
             }
-
-            delete file;
         }
     }
 
+    return file;
+}
+
+
+/** Class method used to create a new file on the device.
+ *
+ *  @param  devicePointer       The device that owns this node.
+ *  @param  applet              The applet.
+ *  @param  path                The path of a file to be loaded.
+ *  @return                     A pointer to the created node.
+ */
++ (ASFileNode*)createFileNodeOnDevice:(ts::ASDevice*)device applet:(const ASApplet*)applet path:(NSString*)path
+{
+    ASFileNode* fileNode = nil;
+    ASFile* file = importFileFromPath(applet, path);
+    if (file)
+    {
+        NSString* deviceFilename = [[path lastPathComponent] stringByDeletingPathExtension];
+        fileNode = [ASFileNode createFileNodeOnDevice:device
+                               applet:applet
+                               filename:deviceFilename
+                               data:file->fileData()
+                               size:file->fileSize()];
+        delete file;
+    }
+
     return fileNode;
 }
 
 
+/** Return a key for matching device filenames. This compares names as strcasecmp() does in
+ *  createFileNodeOnDevice:applet:filename:data:size: - byte for byte, folding only the ASCII letters -
+ *  so any CP1252 byte, defined or not, gives a valid key.
+ *
+ *  @param  name                The filename.
+ *  @return                     The key. The object is auto-released.
+ */
+static NSData* filenameKey(const char* name)
+{
+    char folded[kASFileAttributesFileNameMaxSize + 1];
+    unsigned length = 0;
+    while (length < kASFileAttributesFileNameMaxSize && 0 != name[length])
+    {
+        char c = name[length];
+        folded[length++] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+    return [NSData dataWithBytes:folded length:length];
+}
+
+
+/** Class method used to create a set of new files on the device. The space needed for the set is
+ *  checked before anything is sent, and the files are then transferred in a single dialogue. If the
+ *  complete set will not fit then as many of the leading files as possible are created.
+ *
+ *  @param  devicePointer       The device that owns this node.
+ *  @param  applet              The applet.
+ *  @param  paths               Array of paths of files to be loaded.
+ *  @return                     An array with one entry per path. Each entry is either the created node,
+ *                              or NSNull if the file could not be created. The array is auto-released.
+ */
++ (NSArray*)createFileNodesOnDevice:(ts::ASDevice*)device applet:(const ts::ASApplet*)applet paths:(NSArray*)paths
+{
+    unsigned count = [paths count];
+    NSMutableArray* nodes = [NSMutableArray arrayWithCapacity:count];
+    if (0 == count) return nodes;
+
+    ASFile** files = (ASFile**)calloc(count, sizeof (ASFile*));
+    ASDeviceFileRequest* requests = (ASDeviceFileRequest*)calloc(count, sizeof (ASDeviceFileRequest));
+    char (*filenames)[kASFileAttributesFileNameMaxSize + 1] = (char (*)[kASFileAttributesFileNameMaxSize + 1])calloc(count, kASFileAttributesFileNameMaxSize + 1);
+    unsigned* requestForPath = (unsigned*)calloc(count, sizeof (unsigned));
+    if (!files || !requests || !filenames || !requestForPath)
+    {
+        free(files);
+        free(requests);
+        free(filenames);
+        free(requestForPath);
+        return nil;
+    }
+
+
+    // Collect the names already in use on the device, so that each new name can be made unique
+    NSMutableSet* usedNames = [NSMutableSet set];
+    int fileIndexNumber = 0;
+    ASFileAttributes attr;
+    while (device->getFileAttributes(&attr, applet, fileIndexNumber++))
+    {
+        [usedNames addObject:filenameKey(attr.fileName())];
+    }
+
+
+    // Load each file and assign a unique device filename
+    unsigned requestCount = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        NSString* path = [paths objectAtIndex:i];
+        requestForPath[i] = count;
+        files[i] = importFileFromPath(applet, path);
+        if (!files[i]) continue;
+
+        const char* pathName = [[[path lastPathComponent] stringByDeletingPathExtension] cStringUsingEncoding:NSWindowsCP1252StringEncoding];
+        if (!pathName) pathName = "Untitled";
+
+        char* deviceFilename = filenames[requestCount];
+        strncpy(deviceFilename, pathName, kASFileAttributesFileNameMaxSize);
+        deviceFilename[kASFileAttributesFileNameMaxSize] = 0;
+
+        int uniqueID = 0;
+        while ([usedNames containsObject:filenameKey(deviceFilename)])
+        {
+            if (++ uniqueID > 999) break;
+
+            char buffer[8];
+            snprintf(buffer, sizeof buffer, "-%d", uniqueID);
+
+            strncpy(deviceFilename, pathName, kASFileAttributesFileNameMaxSize - strlen(buffer));
+            deviceFilename[kASFileAttributesFileNameMaxSize - strlen(buffer)] = 0;
+            strcat(deviceFilename, buffer);
+        }
+        if (uniqueID > 999) continue;       // Neo will run out of space long before this...
+
+        [usedNames addObject:filenameKey(deviceFilename)];
+
+        requests[requestCount].filename = deviceFilename;
+        requests[requestCount].password = "write";
+        requests[requestCount].buffer = files[i]->fileData();
+        requests[requestCount].size = files[i]->fileSize();
+        requests[requestCount].fileIndex = -1;
+        requestForPath[i] = requestCount;
+        requestCount ++;
+    }
+
+
+    // Transfer everything that fits
+    unsigned created = 0;
+    device->createFiles(requests, requestCount, applet, true, true, &created);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        id node = [NSNull null];
+        if (requestForPath[i] < requestCount && requests[requestForPath[i]].fileIndex >= 0)
+        {
+            int fileIndex = requests[requestForPath[i]].fileIndex;
+            ASFileAttributes nodeAttr;
+            device->getFileAttributes(&nodeAttr, applet, fileIndex);
+            node = [[[ASFileNode alloc] initWithDevice:device applet:applet fileIndex:fileIndex fileAttributes:&nodeAttr] autorelease];
+        }
+        [nodes addObject:node];
+        delete files[i];
+    }
+
+    free(files);
+    free(requests);
+    free(filenames);
+    free(requestForPath);
+
+    return nodes;
+}
+
+
 /** Raise an error if the default constructor is used.
  */
 - (id)init
@@ -506,6 +653,41 @@ static NSImage* iconFileBin = nil;              /**< Icon to use for binary file
     *totalBytes = fileAttributes->allocSize();
 }
 
+/** Map a string encoding to the equivalent driver text encoding, if there is one.
+ *
+ *  @param  encoding            The string encoding.
+ *  @param  textEncoding        Returns the driver text encoding (kASTextEncodingXXX).
+ *  @param  bom                 Returns logical true if the text should start with a BOM.
+ *  @return                     Logical true if the driver can export text in the encoding directly.
+ */
+static bool getTextEncoding(NSStringEncoding encoding, unsigned* textEncoding, bool* bom)
+{
+    *bom = false;
+    switch (encoding)
+    {
+        case NSUTF8StringEncoding:
+            *textEncoding = kASTextEncodingUTF8;
+            return true;
+
+        case NSUnicodeStringEncoding:
+            *textEncoding = kASTextEncodingUTF16;
+            *bom = true;                        // as written by -[NSString dataUsingEncoding:]
+            return true;
+
+        case NSWindowsCP1252StringEncoding:
+            *textEncoding = kASTextEncodingCP1252;
+            return true;
+
+        case NSMacOSRomanStringEncoding:
+            *textEncoding = kASTextEncodingMacRoman;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
 // REVIEW: this can fail after having created a file. Need to add cleanup if this happens...
 - (NSString*)saveUnderPath:(NSString*)path
 {
@@ -535,26 +717,57 @@ static NSImage* iconFileBin = nil;              /**< Icon to use for binary file
 
         if (shouldProceed)
         {
-            NSString* stringData = [self fileData];
+            NSStringEncoding encoding = [ASPreferenceController getDefaultTextEncoding];
+            unsigned textEncoding;
+            bool bom;
             NSString* error = nil;
-            if (!stringData)
-            {
-                error = @"Unable to read the file data from the device.";
-            }
-            else
+            if (getTextEncoding(encoding, &textEncoding, &bom))
             {
-                NSStringEncoding encoding = [ASPreferenceController getDefaultTextEncoding];
-                data = [stringData dataUsingEncoding:encoding allowLossyConversion:YES];
-                if (!data)
+                // Let the driver translate straight to the target encoding, avoiding the NSString round trip
+                if (!fileIsSynchronised)
+                {
+                    fileIsSynchronised = fileData->load(device, applet, fileIndex);
+                }
+
+                const void* text;
+                unsigned textSize;
+                if (!fileIsSynchronised)
+                {
+                    error = @"Unable to read the file data from the device.";
+                }
+                else if (!fileData->exportEncodedText(&text, &textSize, textEncoding, bom))
                 {
                     error = @"Unable to make sense of the data from the device.";
                 }
                 else
                 {
+                    data = [NSData dataWithBytesNoCopy:(void*)text length:textSize freeWhenDone:NO];
                     [fileHandle writeData:data];
                     result = targetFilename;
                 }
             }
+            else
+            {
+                // Encodings that the driver does not handle (plain ASCII) go through NSString
+                NSString* stringData = [self fileData];
+                if (!stringData)
+                {
+                    error = @"Unable to read the file data from the device.";
+                }
+                else
+                {
+                    data = [stringData dataUsingEncoding:encoding allowLossyConversion:YES];
+                    if (!data)
+                    {
+                        error = @"Unable to make sense of the data from the device.";
+                    }
+                    else
+                    {
+                        [fileHandle writeData:data];
+                        result = targetFilename;
+                    }
+                }
+            }
 
             if ([accessDelegate conformsToProtocol:@protocol(ASDeviceAccessProtocol)])
             {
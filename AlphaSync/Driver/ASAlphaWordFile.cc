@@ -119,248 +119,593 @@ namespace ts
 
     bool ASAlphaWordFile::importText(const uint16_t* text, unsigned textSize)
     {
-        if (textSize > 1024*1024*1024) return false;                        // Implausibly large text (may cause overflow later)
-
-        unsigned inputCharacterCount = (textSize / 2);                      // Number of input characters
-        unsigned maxNeoSize = m_minFileSize + (inputCharacterCount * 4);    // worst case estimated neo data size (everything escaped)
-        uint8_t* neoText = (uint8_t*)malloc(maxNeoSize);
-        if (!neoText) return false;
-        memset(neoText, 0xa7, maxNeoSize);                                  // fill buffer with 'unused space' pad byte
-
-
-        // Loop to translate characters.
-        uint8_t* neo = neoText;
-        uint8_t* endn = neo + maxNeoSize;
-        const uint16_t* uni = text;
-        const uint16_t* endu = uni + inputCharacterCount;
-        unsigned softBreakCount = 0;
-        unsigned hardBreakCount = 0;
-        static const unsigned softBreakInterval = 40;
-        static const unsigned hardBreakInterval = 24;
-        uint8_t* lastBreakOpportunity = 0;
-        while (uni != endu)
+        return importEncodedText(text, textSize, kASTextEncodingUTF16);
+    }
+
+
+    bool ASAlphaWordFile::exportText(const uint16_t** text, unsigned* textSize, bool bom) const
+    {
+        const void* data = 0;
+        bool result = exportEncodedText(&data, textSize, kASTextEncodingUTF16, bom);
+        *text = (const uint16_t*)data;
+        return result;
+    }
+
+
+    /** Import state (see importSink()).
+     */
+    struct ASAlphaWordImport
+    {
+        uint8_t* data;          /**< The translated data. */
+        unsigned size;          /**< Bytes of translated data. */
+        unsigned capacity;      /**< The size of the data buffer. */
+        unsigned maxSize;       /**< The maximum file size. */
+        bool tooLarge;          /**< Set if the maximum file size was exceeded. */
+    };
+
+
+    bool ASAlphaWordFile::importEncodedText(const void* text, unsigned textSize, unsigned encoding)
+    {
+        if (encoding >= kASTextEncodingCount) return false;
+        if (textSize > 1024*1024*1024) return false;                        // Implausibly large text
+
+        ASAlphaWordImport import = { 0, 0, 0, m_maxFileSize, false };
+        bool result;
         {
-            assert((endn - neo) >= 4);
+            ASAlphaWordEncoder encoder(encoding, importSink, &import);
+            result = encoder.encode(text, textSize) && encoder.finish(m_minFileSize);
+        }
 
-            bool escape;
-            int code;
+        if (import.tooLarge)
+        {
+            fprintf(stderr, "ASAlphaWordFile: import translation exceeds max file size of %u bytes\n", m_maxFileSize);
+        }
 
-            uint16_t unicode = *uni ++;
-            if (0xfeff == unicode) continue;          // Ignore byte order marks
-            int c = unicodeToNeo(unicode);
+        uint8_t* data = result ? (uint8_t*)setFileSize(import.size) : 0;
+        if (data) memcpy(data, import.data, import.size);       // Copy translated text to the object
 
-            // Miscellaneous re-mapping.
-            if (c == 0x81) c = 0xac;        // Re-map the "not" alternate character (to not clash with line-break hint)
+        if (import.data) free(import.data);
+        return (0 != data);
+    }
 
-            // REVIEW: should we explicitly handle DOS CR+LF endings?
-            if (c >= 0xa1 && c <= 0xbf)     { escape = true;    code = c; }
-            else if (0x09 == c)             { escape = true;    code = c; }
-            else if (0x0a == c)             { escape = true;    code = c; }
-            else if (0x0d == c)             { escape = true;    code = c; }
-            else if (kNeoCodeTab == c)      { escape = false;   code = 0x09; }
-            else if (kNeoCodeNewline == c)  { escape = false;   code = 0x0d; }  // newline (mapped to return - end of paragraph)
-            else if (kNeoCodeReturn == c)   { escape = false;   code = 0x0d; }
-            else if (c >= 0 && c <= 0xff)   { escape = false;   code = c; }
-            else                            { escape = false;   code = kNeoUntranslatableCharacter; }
 
-            bool isBreak = (!escape) && (0x0d == code);
-            bool isBreakable = (!escape) && (0x2d == code || 0x20 == code || 0x09 == code);
+    bool ASAlphaWordFile::exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom) const
+    {
+        *text = 0;
+        *textSize = 0;
 
-            hardBreakCount ++;
-            softBreakCount ++;
+        if (encoding >= kASTextEncodingCount) return false;
+        if (0 == fileSize()) return true;
 
-            if (isBreak)
-            {
-                // The current character is an implicit break.
-                lastBreakOpportunity = 0;
-                softBreakCount = 0;
-                hardBreakCount = 0;
-            }
-            else if (isBreakable)
-            {
-                lastBreakOpportunity = neo;
-                hardBreakCount = 0;
-            }
-            else if (hardBreakCount >= hardBreakInterval)
-            {
-                *neo ++ = 0x8f;                 // insert a hard-break character
-                hardBreakCount = 0;
-                softBreakCount = 0;             // REVIEW: should we do this?
-                lastBreakOpportunity = 0;       // REVIEW: should we do this?
-            }
+        unsigned maxSize = maxEncodedSize(fileSize(), encoding, bom);
+        if (0 != m_exportBuffer) free(m_exportBuffer);
+        m_exportBuffer = (uint8_t*) malloc(maxSize);
+        if (0 == m_exportBuffer) return false;
+
+        TextWriter output;
+        initTextWriter(&output, m_exportBuffer, maxSize, encoding);
+
+        ASAlphaWordDecoder decoder(encoding, exportSink, &output, bom);
+        bool result = decoder.decode(byteData(), fileSize()) && decoder.finish();
+        assert(output.ptr <= output.end);
+        if (!result) return false;
+
+        *text = m_exportBuffer;
+        *textSize = (unsigned)(output.ptr - m_exportBuffer);
+        return true;
+    }
+
+
+
+
+#pragma mark        --------  Protected Methods  --------
+
+
+    /** In theory, we can check if the input file that we have been given is sensible. However,
+     *  any sequence of bytes of any length (within reason) is likely usable as an AlphaWord file.
+     *
+     *  @return     Logical true if the data appears valid and has been accepted.
+     */
+    bool ASAlphaWordFile::confirmLoad()
+    {
+        return true;
+    }
 
-            if (escape) *neo ++ = 0xb0;
-            *neo ++ = code;
-            if (escape) *neo ++ = 0xb0;
 
-            if (softBreakCount >= softBreakInterval && lastBreakOpportunity)
-            {
-                // Substitute breakable characters with their breaking equivalents
-                if (0x2d == *lastBreakOpportunity) *lastBreakOpportunity = 0xad;
-                else if (0x20 == *lastBreakOpportunity) *lastBreakOpportunity = 0x81;
-                else if (0x09 == *lastBreakOpportunity) *lastBreakOpportunity = 0x8d;
-                else
-                {
-                    fprintf(stderr, "%s: failed to encode break character\n", __FUNCTION__);
-                    assert(0);  // mismatch between this code and the assignment of isBreakable
-                }
-                lastBreakOpportunity = 0;
-                softBreakCount = 0;
-                hardBreakCount = 0;
-            }
-        }
 
-        unsigned totalSize = (unsigned)(neo - neoText);
-        if (totalSize < m_minFileSize) totalSize = m_minFileSize;
-        if (totalSize > m_maxFileSize)
+    /** Sink used by importEncodedText() to collect the translated data.
+     */
+    bool ASAlphaWordFile::importSink(void* context, const void* data, unsigned size)
+    {
+        ASAlphaWordImport* import = (ASAlphaWordImport*)context;
+        if (size > import->maxSize - import->size)
         {
-            fprintf(stderr, "ASAlphaWordFile: import translation exceeds max file size of %u bytes\n", m_maxFileSize);
-            free(neoText);
+            import->tooLarge = true;
             return false;
         }
 
-        uint8_t* data = (uint8_t*)setFileSize(totalSize);
-        if (!data)
+        if (import->size + size > import->capacity)
         {
-            free(neoText);
-            return false;
+            unsigned capacity = import->capacity ? import->capacity : 0x4000;
+            while (capacity < import->size + size)
+            {
+                capacity = (capacity > import->maxSize / 2) ? import->maxSize : capacity * 2;
+            }
+            uint8_t* newData = (uint8_t*)realloc(import->data, capacity);
+            if (!newData) return false;
+            import->data = newData;
+            import->capacity = capacity;
         }
 
-        memcpy(data, neoText, totalSize);       // Copy translated text to the object
+        memcpy(import->data + import->size, data, size);
+        import->size += size;
+        return true;
+    }
+
+
 
-        free(neoText);
+
+    /** Sink used by exportEncodedText() to collect the translated text. The context is a writer
+     *  for the export buffer, which is large enough for any translation of the file.
+     */
+    bool ASAlphaWordFile::exportSink(void* context, const void* data, unsigned size)
+    {
+        TextWriter* output = (TextWriter*)context;
+        if (size > (unsigned)(output->end - output->ptr)) return false;
+        memcpy(output->ptr, data, size);
+        output->ptr += size;
         return true;
     }
 
 
-    bool ASAlphaWordFile::exportText(const uint16_t** text, unsigned* textSize, bool bom) const
+
+
+#pragma mark        --------  ASAlphaWordEncoder  --------
+
+
+    ASAlphaWordEncoder::ASAlphaWordEncoder(unsigned encoding, ASDeviceDataSink sink, void* context, unsigned blockSize)
+        :
+        m_encoding(encoding),
+        m_sink(sink),
+        m_context(context),
+        m_blockSize(blockSize ? blockSize : kASAlphaWordEncoderBlockSize),
+        m_buffer(0),
+        m_capacity(0),
+        m_fill(0),
+        m_sent(0),
+        m_failed(false),
+        m_finished(false),
+        m_partialSize(0),
+        m_softBreakCount(0),
+        m_hardBreakCount(0),
+        m_lastBreakOpportunity(-1)
     {
-        *text = 0;
-        *textSize = 0;
+        // A pending break opportunity is at most softBreakInterval characters (of up to four bytes each)
+        // behind the end of the buffer, so this much space beyond the block size is always sufficient.
+        m_capacity = m_blockSize + kASAlphaWordEncoderReserve;
+        m_buffer = (uint8_t*)malloc(m_capacity);
+        if (!m_buffer) m_failed = true;
+    }
 
-        if (0 == fileSize()) return true;
 
-        unsigned maxCharacterCount = fileSize() + 1;    // plus one allows for optional BOM
-        if (0 != m_exportBuffer) free(m_exportBuffer);
-        m_exportBuffer = (uint16_t*) malloc(maxCharacterCount * sizeof (uint16_t));
-        if (0 == m_exportBuffer) return false;
+    ASAlphaWordEncoder::~ASAlphaWordEncoder()
+    {
+        if (m_buffer) free(m_buffer);
+        m_buffer = 0;
+    }
 
-        const uint8_t *ptr = byteData();
-        const uint8_t *end = byteData() + fileSize();
 
-        unsigned characterCount = 0;
+    bool ASAlphaWordEncoder::encode(const void* text, unsigned textSize)
+    {
+        assert(!m_finished);
+        if (m_failed || m_finished) return false;
 
-        if (bom) m_exportBuffer[characterCount++] = 0xfeff;
+        const uint8_t* ptr = (const uint8_t*)text;
+        const uint8_t* end = ptr + (ptr ? textSize : 0);
 
-        while (ptr != end)
+        // Complete a character left over from the previous chunk
+        if (m_partialSize > 0)
         {
-            int code = *ptr ++;
-            if (0xa4 == code) continue;                 // unused code
-            if (0xa7 == code) continue;                 // unused code
-            if (0x09 == code) code = kNeoCodeTab;       // pass code through the character set translation
-            if (0x0a == code) code = kNeoCodeNewline;   // pass code through the character set translation
-            if (0x0d == code) code = kNeoCodeReturn;    // pass code through the character set translation
-            if (0x81 == code) code = 0x20;              // line-breaking space
-            if (0x8d == code) code = kNeoCodeTab;       // line-breaking tab
-            if (0x8f == code) continue;                 // period break in a run of contiguous characters
-            if (0xa1 == code) code = 0x20;              // line-breaking space (older software versions)
-            if (0xa3 == code) code = kNeoCodeTab;       // line-breaking tab (older software versions)
-            if (0xad == code) code = 0x2d;              // line-breaking hyphen
-            if (0xb0 == code)                           // escape sequence
+            unsigned length = characterLength(m_partial[0]);
+            while (m_partialSize < length && ptr != end) m_partial[m_partialSize++] = *ptr++;
+            if (m_partialSize < length) return true;        // still incomplete
+            translate(m_partial, m_partialSize);
+            m_partialSize = 0;
+        }
+
+        // Hold back a character that is split by the end of this chunk
+        unsigned tail = 0;
+        if (kASTextEncodingUTF16 == m_encoding)
+        {
+            tail = (unsigned)(end - ptr) & 1;
+        }
+        else if (kASTextEncodingUTF8 == m_encoding)
+        {
+            for (unsigned back = 1; back <= 3 && back <= (unsigned)(end - ptr); back++)
             {
-                if ((end - ptr) < 2)
+                uint8_t c = *(end - back);
+                if (0x80 != (c & 0xc0))
                 {
-                    fprintf(stderr, "ASAlphaWordText: %s: Unexpectedly truncated escape sequence\n", __FUNCTION__);
-                }
-                else
-                {
-                    code = *ptr ++;             // get the interpreted code directly
-                    if (*ptr == 0xb0) ptr ++;   // skip over a following escape code (if present)
+                    if (characterLength(c) > back) tail = back;
+                    break;
                 }
             }
+        }
+
+        translate(ptr, (unsigned)(end - ptr) - tail);
+        if (tail > 0) memcpy(m_partial, end - tail, tail);
+        m_partialSize = tail;
+
+        return !m_failed;
+    }
+
+
+    bool ASAlphaWordEncoder::finish(unsigned minSize)
+    {
+        assert(!m_finished);
+        if (m_failed || m_finished) return false;
+
+        if (m_partialSize > 0) translate(m_partial, m_partialSize);     // truncated character
+        m_partialSize = 0;
+        m_finished = true;
+
+        m_lastBreakOpportunity = -1;        // nothing further can change the buffered data
+        while (!m_failed && encodedSize() < minSize)
+        {
+            unsigned pad = minSize - encodedSize();
+            if (pad > m_capacity - m_fill) pad = m_capacity - m_fill;
+            memset(m_buffer + m_fill, 0xa7, pad);                       // 'unused space' pad byte
+            m_fill += pad;
+            if (m_fill >= m_blockSize) flush(false);
+        }
+
+        return flush(true);
+    }
+
+
+    /** Translate complete characters, passing full blocks to the sink.
+     */
+    void ASAlphaWordEncoder::translate(const uint8_t* text, unsigned textSize)
+    {
+        ASFile::TextReader reader;
+        ASAlphaWordFile::initTextReader(&reader, text, textSize, m_encoding);
+
+        int c;
+        while (!m_failed && ASAlphaWordFile::kNeoCodeEnd != (c = ASAlphaWordFile::readNeoCode(&reader)))
+        {
+            encodeCharacter(c);
+            if (m_fill >= m_blockSize) flush(false);
+        }
+    }
+
+
+    /** Translate a single Neo character to AlphaWord format, inserting line break hints as required.
+     *
+     *  @param  c       The extended Neo character code (see ASFile::unicodeToNeo()).
+     */
+    void ASAlphaWordEncoder::encodeCharacter(int c)
+    {
+        static const unsigned softBreakInterval = 40;
+        static const unsigned hardBreakInterval = 24;
+
+        assert((m_capacity - m_fill) >= 4);
+
+        bool escape;
+        int code;
+
+        // Miscellaneous re-mapping.
+        if (c == 0x81) c = 0xac;        // Re-map the "not" alternate character (to not clash with line-break hint)
+
+        // REVIEW: should we explicitly handle DOS CR+LF endings?
+        if (c >= 0xa1 && c <= 0xbf)     { escape = true;    code = c; }
+        else if (0x09 == c)             { escape = true;    code = c; }
+        else if (0x0a == c)             { escape = true;    code = c; }
+        else if (0x0d == c)             { escape = true;    code = c; }
+        else if (ASAlphaWordFile::kNeoCodeTab == c) { escape = false;   code = 0x09; }
+        else if (ASAlphaWordFile::kNeoCodeNewline == c) { escape = false;   code = 0x0d; }  // newline (mapped to return - end of paragraph)
+        else if (ASAlphaWordFile::kNeoCodeReturn == c)  { escape = false;   code = 0x0d; }
+        else if (c >= 0 && c <= 0xff)   { escape = false;   code = c; }
+        else                            { escape = false;   code = ASAlphaWordFile::kNeoUntranslatableCharacter; }
+
+        bool isBreak = (!escape) && (0x0d == code);
+        bool isBreakable = (!escape) && (0x2d == code || 0x20 == code || 0x09 == code);
+
+        m_hardBreakCount ++;
+        m_softBreakCount ++;
+
+        if (isBreak)
+        {
+            // The current character is an implicit break.
+            m_lastBreakOpportunity = -1;
+            m_softBreakCount = 0;
+            m_hardBreakCount = 0;
+        }
+        else if (isBreakable)
+        {
+            m_lastBreakOpportunity = (int) m_fill;
+            m_hardBreakCount = 0;
+        }
+        else if (m_hardBreakCount >= hardBreakInterval)
+        {
+            m_buffer[m_fill++] = 0x8f;          // insert a hard-break character
+            m_hardBreakCount = 0;
+            m_softBreakCount = 0;               // REVIEW: should we do this?
+            m_lastBreakOpportunity = -1;        // REVIEW: should we do this?
+        }
+
+        if (escape) m_buffer[m_fill++] = 0xb0;
+        m_buffer[m_fill++] = code;
+        if (escape) m_buffer[m_fill++] = 0xb0;
+
+        if (m_softBreakCount >= softBreakInterval && m_lastBreakOpportunity >= 0)
+        {
+            // Substitute breakable characters with their breaking equivalents
+            uint8_t* lastBreakOpportunity = m_buffer + m_lastBreakOpportunity;
+            if (0x2d == *lastBreakOpportunity) *lastBreakOpportunity = 0xad;
+            else if (0x20 == *lastBreakOpportunity) *lastBreakOpportunity = 0x81;
+            else if (0x09 == *lastBreakOpportunity) *lastBreakOpportunity = 0x8d;
             else
             {
-                if (0xa1 <= code && code <= 0xbf)
+                fprintf(stderr, "%s: failed to encode break character\n", __FUNCTION__);
+                assert(0);  // mismatch between this code and the assignment of isBreakable
+            }
+            m_lastBreakOpportunity = -1;
+            m_softBreakCount = 0;
+            m_hardBreakCount = 0;
+        }
+    }
+
+
+    /** Pass buffered data to the sink.
+     *
+     *  @param  all     Logical true to pass all data. Otherwise whole blocks are passed, stopping at
+     *                  any pending break opportunity.
+     *  @return         Logical true if successful.
+     */
+    bool ASAlphaWordEncoder::flush(bool all)
+    {
+        while (!m_failed && m_fill > 0)
+        {
+            unsigned size = (m_fill > m_blockSize) ? m_blockSize : m_fill;
+            if (!all)
+            {
+                if (m_fill < m_blockSize) break;    // wait for a full block
+                if (m_lastBreakOpportunity >= 0 && size > (unsigned) m_lastBreakOpportunity)
                 {
-                    fprintf(stderr, "ASAlphaWordText: %s: Possible untrapped escape: %02x\n", __FUNCTION__, code);
-                    continue;
+                    size = (unsigned) m_lastBreakOpportunity;   // hold back data that may yet be rewritten
                 }
+                if (0 == size) break;
             }
 
-            m_exportBuffer[characterCount++] = neoToUnicode(code);
+            if (!m_sink(m_context, m_buffer, size))
+            {
+                m_failed = true;
+                break;
+            }
+
+            m_sent += size;
+            m_fill -= size;
+            memmove(m_buffer, m_buffer + size, m_fill);
+            if (m_lastBreakOpportunity >= 0) m_lastBreakOpportunity -= (int)size;
         }
 
-        assert(characterCount <= maxCharacterCount);
+        return !m_failed;
+    }
+
 
-        *text = m_exportBuffer;
-        *textSize = characterCount * 2;
-        return true;
+    /** Return the number of bytes in a character, given its first byte.
+     */
+    unsigned ASAlphaWordEncoder::characterLength(uint8_t lead) const
+    {
+        switch (m_encoding)
+        {
+            case kASTextEncodingUTF16:
+                return 2;
+
+            case kASTextEncodingUTF8:
+                if (lead >= 0xc2 && lead <= 0xdf) return 2;
+                if (lead >= 0xe0 && lead <= 0xef) return 3;
+                if (lead >= 0xf0 && lead <= 0xf4) return 4;
+                return 1;
+
+            default:
+                return 1;
+        }
     }
 
 
-#if 0
-    /** Method used to test the encoding of a file. This generates a known byte code that can then be viewed on the Neo.
+
+
+#pragma mark        --------  ASAlphaWordDecoder  --------
+
+
+    /* Progress through an escape sequence { 0xb0, <code>, 0xb0 }.
+     */
+    #define kEscapeNone         (0)     /**< Not in an escape sequence. */
+    #define kEscapeStarted      (1)     /**< Have read the leading 0xb0. */
+    #define kEscapeHaveCode     (2)     /**< Have read the escaped code (m_escapeCode). */
+
+
+    /* Actions for bytes of file data outside an escape sequence (see decodeActions).
+     */
+    #define kDecodeEmit         (0)     /**< Translate the byte as a Neo character. */
+    #define kDecodeDrop         (1)     /**< Unused code or display hint: ignore. */
+    #define kDecodeTab          (2)     /**< Tab, or line-breaking tab. */
+    #define kDecodeNewline      (3)     /**< Newline. */
+    #define kDecodeReturn       (4)     /**< Return (end of paragraph). */
+    #define kDecodeSpace        (5)     /**< Line-breaking space. */
+    #define kDecodeHyphen       (6)     /**< Line-breaking hyphen. */
+    #define kDecodeEscape       (7)     /**< Start of an escape sequence. */
+    #define kDecodeUntrapped    (8)     /**< A code that should only appear escaped: ignore. */
+
+
+    /** The action for each byte of file data outside an escape sequence:
+     *
+     *          09, 8d, a3      tab (0x8d and 0xa3 are line-breaking tabs, 0xa3 from older software versions)
+     *          0a, 0d          newline, return
+     *          81, a1          line-breaking space (0xa1 from older software versions)
+     *          ad              line-breaking hyphen
+     *          8f, a4, a7      ignored (period break in a run of contiguous characters, unused codes)
+     *          b0              escape sequence
+     *          a2-bf           otherwise ignored (possible untrapped escape)
      */
-    bool ASAlphaWordFile::generateTestFile()
+    static const uint8_t decodeActions[256] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 0, 0, 4, 0, 0,     // 00
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 10
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 20
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 30
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 40
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 50
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 60
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 70
+        0, 5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1,     // 80
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 90
+        0, 5, 8, 2, 1, 8, 8, 1, 8, 8, 8, 8, 8, 6, 8, 8,     // a0
+        7, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,     // b0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // c0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // d0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // e0
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0      // f0
+    };
+
+
+    ASAlphaWordDecoder::ASAlphaWordDecoder(unsigned encoding, ASDeviceDataSink sink, void* context, bool bom)
+        :
+        m_sink(sink),
+        m_context(context),
+        m_sent(0),
+        m_bom(bom),
+        m_failed(false),
+        m_finished(false),
+        m_escapeState(kEscapeNone),
+        m_escapeCode(0)
+    {
+        ASAlphaWordFile::initTextWriter(&m_writer, m_buffer, sizeof m_buffer, encoding);
+    }
+
+
+    ASAlphaWordDecoder::~ASAlphaWordDecoder()
+    {
+        // Nothing.
+    }
+
+
+    bool ASAlphaWordDecoder::decode(const void* data, unsigned size)
     {
-        setFileSize(0);
+        assert(!m_finished);
+        if (m_failed || m_finished) return false;
 
-        for (unsigned i = 0; i < 256; i++)
+        if (m_bom)
         {
-            char buffer[128];
-            sprintf(buffer, "Code %02x: =", i);
-            unsigned len = strlen(buffer);
-            buffer[len++] = i;
-            buffer[len++] = '=';
-            buffer[len++] = ' ';
-            buffer[len++] = '=';
-            buffer[len++] = i;
-            buffer[len++] = i;
-            buffer[len++] = '=';
-            buffer[len++] = ' ';
-            buffer[len++] = '=';
-            buffer[len++] = i;
-            buffer[len++] = i;
-            buffer[len++] = i;
-            buffer[len++] = i;
-            buffer[len++] = '=';
-            buffer[len++] = '\r';
-
-            if (!appendData(buffer, len)) return false;
+            ASAlphaWordFile::writeBOM(&m_writer);
+            m_bom = false;
         }
 
-        for (unsigned i = 0; i < 256; i++)
+        const uint8_t* ptr = (const uint8_t*)data;
+        const uint8_t* end = ptr + (ptr ? size : 0);
+        while (ptr != end && !m_failed)
         {
-            char buffer[128];
-            sprintf(buffer, "Escape %02x: =", i);
-            unsigned len = strlen(buffer);
-            buffer[len++] = 0xb0;
-            buffer[len++] = i;
-            buffer[len++] = 0xb0;
-            buffer[len++] = '=';
-            buffer[len++] = '\r';
-
-            if (!appendData(buffer, len)) return false;
+            if (kEscapeNone == m_escapeState)
+            {
+                // Translate any run of plain text in bulk
+                ptr += ASAlphaWordFile::writePrintableNeo(&m_writer, ptr, (unsigned)(end - ptr));
+                if (ptr == end) break;
+            }
+
+            int code = *ptr ++;
+            if (kEscapeStarted == m_escapeState)
+            {
+                m_escapeCode = (uint8_t) code;      // get the interpreted code directly
+                m_escapeState = kEscapeHaveCode;
+            }
+            else if (kEscapeHaveCode == m_escapeState)
+            {
+                m_escapeState = kEscapeNone;
+                writeCode(m_escapeCode);
+                if (0xb0 != code) decodeByte(code); // a following escape code (if present) is skipped
+            }
+            else
+            {
+                decodeByte(code);
+            }
         }
 
-        return true;
+        return !m_failed;
     }
-#endif
 
 
-#pragma mark        --------  Protected Methods  --------
+    bool ASAlphaWordDecoder::finish()
+    {
+        assert(!m_finished);
+        if (m_failed || m_finished) return false;
+        if (!decode(0, 0)) return false;        // write the BOM, if the file was empty
+        m_finished = true;
 
+        // The file must not end within an escape sequence: treat the 0xb0 as a plain character
+        while (kEscapeNone != m_escapeState && !m_failed)
+        {
+            fprintf(stderr, "ASAlphaWordText: %s: Unexpectedly truncated escape sequence\n", __FUNCTION__);
+            bool haveCode = (kEscapeHaveCode == m_escapeState);
+            m_escapeState = kEscapeNone;
+            writeCode(0xb0);
+            if (haveCode) decodeByte(m_escapeCode);
+        }
 
-    /** In theory, we can check if the input file that we have been given is sensible. However,
-     *  any sequence of bytes of any length (within reason) is likely usable as an AlphaWord file.
-     *
-     *  @return     Logical true if the data appears valid and has been accepted.
+        return flush();
+    }
+
+
+    bool ASAlphaWordDecoder::dataSink(void* context, const void* data, unsigned size)
+    {
+        return ((ASAlphaWordDecoder*)context)->decode(data, size);
+    }
+
+
+    /** Decode a single byte of file data outside an escape sequence.
      */
-    bool ASAlphaWordFile::confirmLoad()
+    void ASAlphaWordDecoder::decodeByte(int code)
     {
-        return true;
+        switch (decodeActions[code & 0xff])
+        {
+            case kDecodeEmit:       writeCode(code);                                break;
+            case kDecodeDrop:                                                       break;
+            case kDecodeTab:        writeCode(ASAlphaWordFile::kNeoCodeTab);        break;  // pass code through the character set translation
+            case kDecodeNewline:    writeCode(ASAlphaWordFile::kNeoCodeNewline);    break;
+            case kDecodeReturn:     writeCode(ASAlphaWordFile::kNeoCodeReturn);     break;
+            case kDecodeSpace:      writeCode(0x20);                                break;
+            case kDecodeHyphen:     writeCode(0x2d);                                break;
+            case kDecodeEscape:     m_escapeState = kEscapeStarted;                 break;
+
+            default:
+                fprintf(stderr, "ASAlphaWordText: %s: Possible untrapped escape: %02x\n", __FUNCTION__, code);
+                break;
+        }
+    }
+
+
+    /** Translate a Neo character code to text, passing the buffer to the sink when full.
+     */
+    void ASAlphaWordDecoder::writeCode(int code)
+    {
+        if ((m_writer.end - m_writer.ptr) < 3) flush();     // up to three bytes per character
+        if (!m_failed) ASAlphaWordFile::writeNeoCode(&m_writer, code);
     }
 
 
+    /** Pass all buffered text to the sink.
+     */
+    bool ASAlphaWordDecoder::flush()
+    {
+        unsigned size = (unsigned)(m_writer.ptr - m_buffer);
+        if (size > 0 && !m_failed)
+        {
+            if (m_sink(m_context, m_buffer, size)) m_sent += size;
+            else m_failed = true;
+            m_writer.ptr = m_buffer;
+        }
+        return !m_failed;
+    }
+
 
 }   // namespace
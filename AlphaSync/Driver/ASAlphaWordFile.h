@@ -35,6 +35,10 @@
 #include <stdint.h>
 #include "ASFile.h"
 
+#define kASAlphaWordEncoderBlockSize    (0x400)     /**< Default size of the blocks emitted by ASAlphaWordEncoder. */
+#define kASAlphaWordEncoderReserve      (0x100)     /**< Encoder buffer space beyond the block size. */
+#define kASAlphaWordDecoderBufferSize   (0x400)     /**< Size of the text blocks emitted by ASAlphaWordDecoder. */
+
 namespace ts
 {
     /** The dictionary class.
@@ -51,6 +55,8 @@ namespace ts
 
         virtual bool importText(const uint16_t* text, unsigned textSize);
         virtual bool exportText(const uint16_t** text, unsigned* textSize, bool bom=false) const;
+        virtual bool importEncodedText(const void* text, unsigned textSize, unsigned encoding);
+        virtual bool exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom=false) const;
 
         virtual unsigned minimumLoadSize() const
         {
@@ -63,14 +69,160 @@ namespace ts
 
     private:
 
+        friend class ASAlphaWordEncoder;
+        friend class ASAlphaWordDecoder;
+
         unsigned m_minFileSize;
         unsigned m_maxFileSize;
-        mutable uint16_t* m_exportBuffer;
+        mutable uint8_t* m_exportBuffer;
+
+        static bool importSink(void* context, const void* data, unsigned size);
+        static bool exportSink(void* context, const void* data, unsigned size);
 
         ASAlphaWordFile(const ASAlphaWordFile&);              /**< Prevent the use of the copy operator. */
         ASAlphaWordFile& operator=(const ASAlphaWordFile&);   /**< Prevent the use of the assignment operator. */
     };
 
+
+
+    /** Incremental translation of text to AlphaWord file data. Text is supplied in chunks of any size (a
+     *  chunk may end part way through a character) and the file data is passed to a sink in blocks, so
+     *  memory use is bounded by the block size rather than the length of the text. Line break state is
+     *  carried from one chunk to the next. As the last break opportunity may be rewritten as a line break
+     *  hint, data from that point on is held back until it is settled.
+     */
+    class ASAlphaWordEncoder
+    {
+    public:
+
+        /** Constructor.
+         *
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         *  @param  sink        Called with each block of file data.
+         *  @param  context     Passed to the sink.
+         *  @param  blockSize   The block size. The final block may be shorter, as may a block that
+         *                      precedes a pending break opportunity.
+         */
+        ASAlphaWordEncoder(unsigned encoding, ASDeviceDataSink sink, void* context, unsigned blockSize=kASAlphaWordEncoderBlockSize);
+        ~ASAlphaWordEncoder();
+
+
+        /** Translate a chunk of text.
+         *
+         *  @param  text        The text.
+         *  @param  textSize    The size of the text, in bytes.
+         *  @return             Logical true if successful, false if out of memory or the sink has failed.
+         */
+        bool encode(const void* text, unsigned textSize);
+
+
+        /** Complete the translation, passing all remaining data to the sink. No more text may be encoded.
+         *
+         *  @param  minSize     The minimum file size. Shorter files are padded with unused space.
+         *  @return             Logical true if successful.
+         */
+        bool finish(unsigned minSize=0);
+
+
+        /** Return the number of bytes of file data generated so far, including any held back.
+         */
+        unsigned encodedSize() const { return m_sent + m_fill; }
+
+    private:
+
+        unsigned m_encoding;                /**< The text encoding. */
+        ASDeviceDataSink m_sink;            /**< The sink. */
+        void* m_context;                    /**< The sink context. */
+        unsigned m_blockSize;               /**< The block size. */
+        uint8_t* m_buffer;                  /**< Buffered data. */
+        unsigned m_capacity;                /**< The buffer size. */
+        unsigned m_fill;                    /**< Bytes currently buffered. */
+        unsigned m_sent;                    /**< Bytes passed to the sink. */
+        bool m_failed;                      /**< Set if the sink has failed or memory was not available. */
+        bool m_finished;                    /**< Set once finish() has been called. */
+        uint8_t m_partial[4];               /**< Leading bytes of a character split across chunks. */
+        unsigned m_partialSize;             /**< Number of bytes in m_partial. */
+        unsigned m_softBreakCount;          /**< Characters since the last line break or hint. */
+        unsigned m_hardBreakCount;          /**< Characters since the last break opportunity. */
+        int m_lastBreakOpportunity;         /**< Buffer offset of the last break opportunity, or -1. */
+
+        void translate(const uint8_t* text, unsigned textSize);
+        void encodeCharacter(int c);
+        bool flush(bool all);
+        unsigned characterLength(uint8_t lead) const;
+
+        ASAlphaWordEncoder(const ASAlphaWordEncoder&);              /**< Prevent the use of the copy operator. */
+        ASAlphaWordEncoder& operator=(const ASAlphaWordEncoder&);   /**< Prevent the use of the assignment operator. */
+    };
+
+
+
+    /** Incremental translation of AlphaWord file data to text. File data is supplied in blocks of any size,
+     *  such as those delivered by a streamed device read (see dataSink()), and the text is passed to a sink
+     *  in blocks of up to kASAlphaWordDecoderBufferSize bytes. Escape sequences may be split across blocks.
+     */
+    class ASAlphaWordDecoder
+    {
+    public:
+
+        /** Constructor.
+         *
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         *  @param  sink        Called with each block of text.
+         *  @param  context     Passed to the sink.
+         *  @param  bom         Logical true to prepend a BOM to the text (ignored for eight bit encodings).
+         */
+        ASAlphaWordDecoder(unsigned encoding, ASDeviceDataSink sink, void* context, bool bom=false);
+        ~ASAlphaWordDecoder();
+
+
+        /** Translate a block of file data.
+         *
+         *  @param  data        The file data.
+         *  @param  size        The number of bytes of data.
+         *  @return             Logical true if successful, false if the sink has failed.
+         */
+        bool decode(const void* data, unsigned size);
+
+
+        /** Complete the translation, passing all remaining text to the sink. No more data may be decoded.
+         *
+         *  @return             Logical true if successful.
+         */
+        bool finish();
+
+
+        /** Return the number of bytes of text generated so far.
+         */
+        unsigned decodedSize() const { return m_sent + (unsigned)(m_writer.ptr - m_buffer); }
+
+
+        /** A data sink that decodes the data, for use with streamed device reads. The context must be
+         *  the decoder.
+         */
+        static bool dataSink(void* context, const void* data, unsigned size);
+
+    private:
+
+        ASDeviceDataSink m_sink;            /**< The sink. */
+        void* m_context;                    /**< The sink context. */
+        uint8_t m_buffer[kASAlphaWordDecoderBufferSize];    /**< Text not yet passed to the sink (kept aligned for UTF16). */
+        ASFile::TextWriter m_writer;        /**< Writes text to m_buffer. */
+        unsigned m_sent;                    /**< Bytes passed to the sink. */
+        bool m_bom;                         /**< Set if a BOM is still to be written. */
+        bool m_failed;                      /**< Set if the sink has failed. */
+        bool m_finished;                    /**< Set once finish() has been called. */
+        unsigned m_escapeState;             /**< Progress through an escape sequence (kEscapeXXX). */
+        uint8_t m_escapeCode;               /**< The escaped code, once read. */
+
+        void decodeByte(int code);
+        void writeCode(int code);
+        bool flush();
+
+        ASAlphaWordDecoder(const ASAlphaWordDecoder&);              /**< Prevent the use of the copy operator. */
+        ASAlphaWordDecoder& operator=(const ASAlphaWordDecoder&);   /**< Prevent the use of the assignment operator. */
+    };
+
 }   // namespace
 
 #endif      // COM_TSONIQ_ASAlphaWordFile_H
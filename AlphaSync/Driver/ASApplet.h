@@ -134,6 +134,8 @@ namespace ts
         bool loadOS(const uint8_t* data, unsigned size);
 
         bool isAppletLoaded() const             { return (0 != m_appletData); }
+        const uint8_t* appletData() const       { return m_appletData; }
+        unsigned appletDataSize() const         { return (m_appletData) ? m_appletSize : 0; }
         bool hasSettings() const                { return (0 != appletSettingsOffset()); }
         bool areSettingsLoaded() const          { return isAppletLoaded(); }
 
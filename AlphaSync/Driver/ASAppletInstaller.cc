@@ -0,0 +1,201 @@
+/** @file   ASAppletInstaller.cc
+ *  @brief  Installation of a SmartApplet on a set of devices.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "ASAppletInstaller.h"
+
+namespace ts
+{
+    /** State shared by the install worker threads.
+     */
+    struct ASAppletInstallJob
+    {
+        pthread_mutex_t lock;                   /**< Protects next. */
+        unsigned next;                          /**< The index of the next device to install. */
+        unsigned count;                         /**< The number of devices. */
+        ASDevice* const* devices;               /**< The devices. */
+        const ASApplet* applet;                 /**< The shared applet image. */
+        ASAppletInstallResult* results;         /**< Per-device results. */
+    };
+
+
+    /** Return the current time, in seconds.
+     */
+    static double currentTime()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + (tv.tv_usec / 1000000.0);
+    }
+
+
+    /** Worker thread: install the applet on devices until none remain.
+     */
+    static void* installThread(void* context)
+    {
+        ASAppletInstallJob* job = (ASAppletInstallJob*)context;
+        ASDeviceScheduler::setThreadPriority(kASDevicePriorityBulk);
+        while (true)
+        {
+            pthread_mutex_lock(&job->lock);
+            unsigned index = job->next;
+            if (index < job->count) job->next ++;
+            pthread_mutex_unlock(&job->lock);
+            if (index >= job->count) break;
+
+            ASAppletInstallResult* result = &job->results[index];
+            double start = currentTime();
+            result->result = result->device->writeApplet(job->applet);
+            result->seconds = currentTime() - start;
+            result->bytes = (result->result) ? job->applet->appletDataSize() : 0;
+
+            fprintf(stderr, "%s: device %08x: %s, %u bytes in %.2fs (%.0f bytes/s)\n", __FUNCTION__,
+                result->device->identity(), (result->result) ? "ok" : "failed", result->bytes, result->seconds, result->throughput());
+        }
+        return 0;
+    }
+
+
+    /** Load an applet image from memory.
+     *
+     *  @param  data        The applet image.
+     *  @param  size        The size of the image, in bytes.
+     *  @return             Logical true if the image is a valid applet.
+     */
+    bool ASAppletInstaller::loadApplet(const uint8_t* data, unsigned size)
+    {
+        return m_applet.loadApplet(data, size);
+    }
+
+
+    /** Load an applet image from a file.
+     *
+     *  @param  path        The file path.
+     *  @return             Logical true if the file contains a valid applet.
+     */
+    bool ASAppletInstaller::loadAppletFromFile(const char* path)
+    {
+        FILE* fh = fopen(path, "rb");
+        if (!fh) return false;
+
+        uint8_t* data = 0;
+        long size = 0;
+        bool result = false;
+        if (0 != fseek(fh, 0, SEEK_END)) goto done;
+        size = ftell(fh);
+        if (size <= 0 || 0 != fseek(fh, 0, SEEK_SET)) goto done;
+
+        data = (uint8_t*)malloc((size_t)size);
+        if (!data) goto done;
+        if ((size_t)size != fread(data, 1, (size_t)size, fh)) goto done;
+
+        result = loadApplet(data, (unsigned)size);
+
+    done:
+        free(data);
+        fclose(fh);
+        return result;
+    }
+
+
+    /** Install the applet on a set of devices.
+     *
+     *  @param  devices         The devices. These must be distinct.
+     *  @param  count           The number of devices.
+     *  @param  maxConcurrent   The maximum number of devices to write at the same time. Zero is treated as one.
+     *  @param  results         Array of @e count entries that returns the result for each device.
+     *  @return                 Logical true if the applet was installed on every device.
+     */
+    bool ASAppletInstaller::install(ASDevice* const* devices, unsigned count, unsigned maxConcurrent, ASAppletInstallResult* results)
+    {
+        m_totalBytes = 0;
+        m_totalSeconds = 0.0;
+
+        if (!m_applet.isAppletLoaded()) return false;
+        if (!ASDevice::appletWriteEnabled())
+        {
+            fprintf(stderr, "%s: applet installation is not enabled (see ASDevice::setAppletWriteEnabled())\n", __FUNCTION__);
+            return false;
+        }
+        if (0 == count) return true;
+        if (0 == maxConcurrent) maxConcurrent = 1;
+        if (maxConcurrent > count) maxConcurrent = count;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            results[i].device = devices[i];
+            results[i].result = false;
+            results[i].bytes = 0;
+            results[i].seconds = 0.0;
+        }
+
+        ASAppletInstallJob job;
+        pthread_mutex_init(&job.lock, 0);
+        job.next = 0;
+        job.count = count;
+        job.devices = devices;
+        job.applet = &m_applet;
+        job.results = results;
+
+        double start = currentTime();
+
+        pthread_t* threads = (pthread_t*)calloc(maxConcurrent, sizeof (pthread_t));
+        unsigned started = 0;
+        if (threads)
+        {
+            while (started < maxConcurrent && 0 == pthread_create(&threads[started], 0, installThread, &job)) started ++;
+        }
+        if (0 == started) installThread(&job);          // no threads available: install synchronously
+        for (unsigned i = 0; i < started; i++) pthread_join(threads[i], 0);
+        free(threads);
+
+        pthread_mutex_destroy(&job.lock);
+
+        m_totalSeconds = currentTime() - start;
+
+        bool result = true;
+        for (unsigned i = 0; i < count; i++)
+        {
+            m_totalBytes += results[i].bytes;
+            result = result && results[i].result;
+        }
+
+        fprintf(stderr, "%s: %u devices, %u bytes in %.2fs (%.0f bytes/s aggregate)\n", __FUNCTION__,
+            count, m_totalBytes, m_totalSeconds, aggregateThroughput());
+
+        return result;
+    }
+
+}   // namespace
@@ -0,0 +1,103 @@
+/** @file   ASAppletInstaller.h
+ *  @brief  Installation of a SmartApplet on a set of devices.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef COM_TSONIQ_ASAppletInstaller_H
+#define COM_TSONIQ_ASAppletInstaller_H   (1)
+
+#include <stdint.h>
+#include "ASDevice.h"
+#include "ASApplet.h"
+
+namespace ts
+{
+    /** The result of installing an applet on a single device.
+     */
+    struct ASAppletInstallResult
+    {
+        ASDevice* device;                       /**< The device. */
+        bool result;                            /**< Logical true if the applet was installed. */
+        unsigned bytes;                         /**< The number of bytes transferred. */
+        double seconds;                         /**< The time taken to install on this device. */
+
+        double throughput() const { return (seconds > 0.0) ? (bytes / seconds) : 0.0; }
+    };
+
+
+    /** Class used to install a single applet image on many devices in parallel.
+     *
+     *  The image is loaded once and the read-only data is shared by every transfer. Each device is
+     *  handled by a worker thread, with the number of threads limited so that the USB bus is not
+     *  swamped when a large number of devices are connected. The devices must not be used by any
+     *  other thread while an install is in progress.
+     *
+     *  Installation fails unless it has been enabled with ASDevice::setAppletWriteEnabled().
+     */
+    class ASAppletInstaller
+    {
+    public:
+
+        ASAppletInstaller()
+            :
+            m_applet(),
+            m_totalBytes(0),
+            m_totalSeconds(0.0)
+        {
+            // Nothing
+        }
+
+        ~ASAppletInstaller()
+        {
+            // Nothing
+        }
+
+        bool loadApplet(const uint8_t* data, unsigned size);
+        bool loadAppletFromFile(const char* path);
+        const ASApplet* applet() const { return &m_applet; }
+
+        bool install(ASDevice* const* devices, unsigned count, unsigned maxConcurrent, ASAppletInstallResult* results);
+
+        unsigned totalBytes() const { return m_totalBytes; }
+        double totalSeconds() const { return m_totalSeconds; }
+        double aggregateThroughput() const { return (m_totalSeconds > 0.0) ? (m_totalBytes / m_totalSeconds) : 0.0; }
+
+    private:
+
+        ASApplet m_applet;                      /**< The applet image. */
+        unsigned m_totalBytes;                  /**< Total bytes written by the last install(). */
+        double m_totalSeconds;                  /**< Elapsed time for the last install(). */
+
+        ASAppletInstaller(const ASAppletInstaller&);                /**< Prevent the use of the copy constructor. */
+        ASAppletInstaller& operator=(const ASAppletInstaller&);     /**< Prevent the use of the assignment operator. */
+    };
+
+}   // namespace
+
+#endif      // COM_TSONIQ_ASAppletInstaller_H
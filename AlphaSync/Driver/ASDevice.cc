@@ -30,18 +30,96 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "ASDevice.h"
 #include "ASMessage.h"
 #include "ASApplet.h"
+#include "ASEndian.h"
 
 #define kASMProtocolVersion 0x0230          /**< Minimum ASM protocol version that the device must support. */
 
 namespace ts
 {
+    /** Directory used to store applet header caches, or an empty string if caching is disabled.
+     */
+    static char s_appletCacheDirectory[1024] = { 0 };
+
+
+    /** Logical true if writeApplet() is allowed to flash the device (see setAppletWriteEnabled()).
+     */
+    static bool s_appletWriteEnabled = false;
+
+
+    /** Known transfer capabilities for a single OS version, shared by all devices running it.
+     */
+    struct ASTransferProfile
+    {
+        char systemName[64];                    /**< The OS name. */
+        unsigned major;                         /**< The OS major version. */
+        unsigned minor;                         /**< The OS minor version. */
+        unsigned safeSize;                      /**< The largest block size known to work. */
+        unsigned rejectedSize;                  /**< The smallest block size known to fail, or zero. */
+        bool pipelineFailed;                    /**< Logical true if pipelined block reads have failed. */
+    };
+
+    #define kASTransferProfileMaxCount    (16)    /**< The number of OS versions tracked. */
+
+    static ASTransferProfile s_transferProfiles[kASTransferProfileMaxCount];
+    static unsigned s_transferProfileCount = 0;
+    static pthread_mutex_t s_transferProfileLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+    /** Return the current time, in seconds.
+     */
+    static double currentTime()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + (tv.tv_usec / 1000000.0);
+    }
+
+
+    /** Set the directory used to persist applet header data between connections. If not set, the
+     *  applet headers are always enumerated from the device.
+     *
+     *  @param  path        The directory path (which must already exist), or zero to disable the cache.
+     */
+    void ASDevice::setAppletCacheDirectory(const char* path)
+    {
+        if (!path) path = "";
+        strncpy(s_appletCacheDirectory, path, sizeof s_appletCacheDirectory);
+        s_appletCacheDirectory[sizeof s_appletCacheDirectory - 1] = 0;
+    }
+
+
+    /** Allow or prevent applet installation. The flash sequence used by writeApplet() has not been
+     *  confirmed against the device firmware, so it is disabled by default and must be explicitly enabled
+     *  by the client.
+     *
+     *  @param  enable      Logical true to allow writeApplet() to write to the device.
+     */
+    void ASDevice::setAppletWriteEnabled(bool enable)
+    {
+        s_appletWriteEnabled = enable;
+    }
+
+
+    /** Return logical true if applet installation has been enabled with setAppletWriteEnabled().
+     */
+    bool ASDevice::appletWriteEnabled()
+    {
+        return s_appletWriteEnabled;
+    }
+
+
     /** Clear enumerated applet data.
      */
     void ASDevice::clearEnumeratedApplets()
@@ -52,50 +130,278 @@ namespace ts
         }
 
         m_applets.removeAllItems();
+
+        free(m_appletHeaderData);
+        m_appletHeaderData = 0;
+        m_appletHeaderCount = 0;
+        m_appletsComplete = false;
     }
 
 
-    /** Load enumerated (cached) data. This may be called explicitly to force loading of the
-     *  cache. However, routines that rely on the cached data will trigger an implicit enumeration
-     *  if needed.
+    /** Prepare the applet list. If state retained from a previous connection has been attached (see
+     *  attachState()), its applet headers are used. Otherwise, if a cache directory has been set, the raw
+     *  applet headers are persisted between connections, keyed by the device identity and OS version.
+     *  Either set is validated against the device by reading the first page of headers plus the final
+     *  header, and if valid the applet list is complete immediately.
+     *
+     *  Otherwise, no headers are read here. The applet list is instead enumerated on demand by appletAtIndex()
+     *  and appletForID(), which read only as many header pages as needed to satisfy the request. Clients that
+     *  want the full list loaded ahead of use can call continueAppletEnumeration() when idle.
      *
-     *  @return             Logical true if the device was loaded successfully.
+     *  @param  cancel      Optional cancellation token.
+     *  @param  deadline    Optional absolute deadline (see deadlineAfter()).
      */
-    void ASDevice::initialise()
+    void ASDevice::initialise(const ASDeviceCancelToken* cancel, double deadline)
     {
+        ASDeviceLease lease(this, kASDeviceOperationInitialise);
+
         assert(0 == m_applets.count());
 
+        beginLimits(cancel, deadline);
+
+        m_appletsComplete = false;
+        m_appletCachePath[0] = 0;
+
         bool result = dialogueStart();
-        if (!result) return;
+        if (!result)
+        {
+            endLimits();
+            return;
+        }
 
-        /* Loop to load the applet header data. Note: do not try to read more than 7 headers at a time.
-         * Reading more than this causes an internal overflow in an attached Neo (likely an internal 1k buffer size).
-         */
-        unsigned appletCount = 0;
-        while (true)
+        m_systemKnown = rawSystemVersion(&m_systemMajor, &m_systemMinor, m_systemName, m_systemDate);
+        if (m_systemKnown) loadTransferProfile();
+
+        bool cacheable = (0 != s_appletCacheDirectory[0]) && m_systemKnown;
+        if (cacheable)
+        {
+            snprintf(m_appletCachePath, sizeof m_appletCachePath, "%s/AppletHeaders-%08x-%u.%u.cache", s_appletCacheDirectory, m_identity, m_systemMajor, m_systemMinor);
+        }
+
+        bool cached = m_systemKnown && adoptRetainedState() && validateAppletCache();
+        if (!cached)
         {
-            uint8_t buffer[kASAppletHeaderSize * 7];
-            unsigned headerCount;
-            result = rawReadAppletHeaders(buffer, (int)appletCount, 7, &headerCount);
-            if (!result) break;
+            clearEnumeratedApplets();
+            cached = cacheable && loadAppletCache(m_appletCachePath, m_systemName, m_systemDate) && validateAppletCache();
+        }
+        if (cached)
+        {
+            appendApplets(0);
+            m_appletsComplete = true;
+        }
+        else
+        {
+            clearEnumeratedApplets();
+        }
+        delete m_retainedState;
+        m_retainedState = 0;
+
+        dialogueEnd(result);
+        endLimits();
+    }
 
 
-            /* Append to the cached list of applets. The index in to m_enumeratedData is the index
-             * used on the device.
-             */
-            for (unsigned i = 0; i < headerCount; i++)
-            {
-                ASApplet* applet = new ASApplet;
-                applet->loadHeader(&buffer[i * kASAppletHeaderSize]);
-                m_applets.appendItem(applet);
-            }
+    /** Read further applet header pages from the device. This may be called repeatedly (for example,
+     *  from an idle timer) to complete the applet list in the background, in small steps that do not
+     *  hold the device for long.
+     *
+     *  @param  pageLimit   The maximum number of header pages (of up to 7 headers each) to read.
+     *  @param  complete    Returns logical true if the applet list is now complete.
+     *  @return             Logical true if the operation succeeded, false if an IO error occurred.
+     */
+    bool ASDevice::continueAppletEnumeration(unsigned pageLimit, bool* complete)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationEnumerateApplets);
+
+        bool result = true;
+        for (unsigned i = 0; result && i < pageLimit && !m_appletsComplete; i++)
+        {
+            result = enumerateAppletPage();
+        }
+
+        *complete = m_appletsComplete;
+        return result;
+    }
+
+
+    /** Read the next page of applet headers from the device and add the corresponding applets to the list.
+     *  Once the final page has been read, the header set is written to the cache (if enabled).
+     *
+     *  @return             Logical true if the operation succeeded, false if an IO error occurred.
+     */
+    bool ASDevice::enumerateAppletPage()
+    {
+        if (m_appletsComplete) return true;
+
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        unsigned first = m_appletHeaderCount;
+        bool complete = false;
+        result = readAppletHeaderPage(&complete);
+        if (result)
+        {
+            appendApplets(first);
+            m_appletsComplete = complete;
+            if (complete && m_appletCachePath[0]) saveAppletCache(m_appletCachePath, m_systemName, m_systemDate);
+        }
+
+        return dialogueEnd(result);
+    }
 
-            appletCount += headerCount;
 
-            if (headerCount < 7) break;     // short read, so no more attributes to fetch
+    /** Create applet objects for the raw headers from a given index onwards. The index in to m_applets is
+     *  the index used on the device.
+     *
+     *  @param  first       The index of the first header to add.
+     */
+    void ASDevice::appendApplets(unsigned first)
+    {
+        for (unsigned i = first; i < m_appletHeaderCount; i++)
+        {
+            ASApplet* applet = new ASApplet;
+            applet->loadHeader(&m_appletHeaderData[i * kASAppletHeaderSize]);
+            m_applets.appendItem(applet);
         }
+    }
 
-        dialogueEnd(result);
+
+    /** Read the next page of (up to 7) applet headers from the device and append them to the
+     *  raw header data. This must be called from within a dialogue.
+     *
+     *  Note: do not try to read more than 7 headers at a time. Reading more than this causes an
+     *  internal overflow in an attached Neo (likely an internal 1k buffer size).
+     *
+     *  @param  complete    Returns logical true if there are no more headers to read.
+     *  @return             Logical true if the operation succeeded, false if an IO error occurred.
+     */
+    bool ASDevice::readAppletHeaderPage(bool* complete)
+    {
+        *complete = false;
+
+        uint8_t buffer[kASAppletHeaderSize * 7];
+        unsigned headerCount;
+        bool result = rawReadAppletHeaders(buffer, (int)m_appletHeaderCount, 7, &headerCount);
+        if (!result) return false;
+
+        if (headerCount > 0)
+        {
+            uint8_t* data = (uint8_t*)realloc(m_appletHeaderData, (m_appletHeaderCount + headerCount) * kASAppletHeaderSize);
+            if (!data) return false;
+            memcpy(&data[m_appletHeaderCount * kASAppletHeaderSize], buffer, headerCount * kASAppletHeaderSize);
+            m_appletHeaderData = data;
+            m_appletHeaderCount += headerCount;
+        }
+
+        *complete = (headerCount < 7);      // short read, so no more headers to fetch
+        return true;
+    }
+
+
+    /** Load raw applet header data from a cache file.
+     *
+     *  The cache file contains a four byte tag, the header count (big-endian), the OS name and date
+     *  strings (64 bytes each) and then the raw header data.
+     *
+     *  @param  path        The cache file path.
+     *  @param  systemName  The OS name reported by the device.
+     *  @param  systemDate  The OS build date reported by the device.
+     *  @return             Logical true if the cache was loaded and matches the OS strings.
+     */
+    bool ASDevice::loadAppletCache(const char* path, const char* systemName, const char* systemDate)
+    {
+        assert(0 == m_appletHeaderData);
+
+        FILE* fh = fopen(path, "rb");
+        if (!fh) return false;
+
+        uint8_t header[8 + 64 + 64];
+        uint8_t* data = 0;
+        unsigned count = 0;
+        if (sizeof header != fread(header, 1, sizeof header, fh)) goto error;
+        if (0 != memcmp(header, kASAppletCacheTag, 4)) goto error;
+        if (0 != strncmp((const char*)&header[8], systemName, 64)) goto error;
+        if (0 != strncmp((const char*)&header[8 + 64], systemDate, 64)) goto error;
+
+        count = as_EndianReadU32(&header[4]);
+        if (0 == count || count > kASAppletCacheMaxCount) goto error;
+
+        data = (uint8_t*)malloc(count * kASAppletHeaderSize);
+        if (!data) goto error;
+        if (count * kASAppletHeaderSize != fread(data, 1, count * kASAppletHeaderSize, fh)) goto error;
+
+        fclose(fh);
+        m_appletHeaderData = data;
+        m_appletHeaderCount = count;
+        return true;
+
+    error:
+        free(data);
+        fclose(fh);
+        return false;
+    }
+
+
+    /** Save the raw applet header data to a cache file. Failure is not treated as an error, since
+     *  the headers will simply be re-enumerated on the next connection.
+     *
+     *  @param  path        The cache file path.
+     *  @param  systemName  The OS name reported by the device.
+     *  @param  systemDate  The OS build date reported by the device.
+     */
+    void ASDevice::saveAppletCache(const char* path, const char* systemName, const char* systemDate) const
+    {
+        if (0 == m_appletHeaderCount) return;
+
+        uint8_t header[8 + 64 + 64];
+        memset(header, 0, sizeof header);
+        memcpy(header, kASAppletCacheTag, 4);
+        as_EndianWriteU32(&header[4], m_appletHeaderCount);
+        strncpy((char*)&header[8], systemName, 64);
+        strncpy((char*)&header[8 + 64], systemDate, 64);
+
+        FILE* fh = fopen(path, "wb");
+        if (!fh) return;
+
+        bool ok = (sizeof header == fwrite(header, 1, sizeof header, fh));
+        ok = ok && (m_appletHeaderCount * kASAppletHeaderSize == fwrite(m_appletHeaderData, 1, m_appletHeaderCount * kASAppletHeaderSize, fh));
+        ok = (0 == fclose(fh)) && ok;
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: failed to write applet cache %s\n", __FUNCTION__, path);
+            unlink(path);
+        }
+    }
+
+
+    /** Check that cached applet header data matches the device. This reads the first page of headers
+     *  and the final header, and checks that there is nothing beyond it. This is far cheaper than a full
+     *  enumeration and will catch applets that have been added, removed or updated in almost all cases.
+     *  This must be called from within a dialogue.
+     *
+     *  @return             Logical true if the cache appears valid.
+     */
+    bool ASDevice::validateAppletCache()
+    {
+        uint8_t buffer[kASAppletHeaderSize * 7];
+        unsigned headerCount;
+
+        unsigned pageCount = (m_appletHeaderCount < 7) ? m_appletHeaderCount : 7;
+        if (!rawReadAppletHeaders(buffer, 0, 7, &headerCount)) return false;
+        if (headerCount != pageCount) return false;
+        if (0 != memcmp(buffer, m_appletHeaderData, pageCount * kASAppletHeaderSize)) return false;
+
+        if (m_appletHeaderCount >= 7)
+        {
+            // A full first page may hide later applets. Ask for two headers from the last index: exactly one should be returned
+            unsigned last = m_appletHeaderCount - 1;
+            if (!rawReadAppletHeaders(buffer, (int)last, 2, &headerCount)) return false;
+            if (headerCount != 1) return false;
+            if (0 != memcmp(buffer, &m_appletHeaderData[last * kASAppletHeaderSize], kASAppletHeaderSize)) return false;
+        }
+
+        return true;
     }
 
 
@@ -113,13 +419,13 @@ namespace ts
      *                      @e fileExists() to test if a file physically exists on the device, since files
      *                      may have zero length.
      */
-    bool ASDevice::readFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw)
+    bool ASDevice::doReadFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw)
     {
         *actual = 0;
         memset(buffer, 0, size);
 
-        bool result = dialogueStart();
-        if (result) result = rawReadFile(buffer, size, actual, applet->appletID(), fileIndex, raw);
+        if (!dialogueStart()) return false;
+        bool result = rawReadFile(buffer, size, actual, applet->appletID(), fileIndex, raw);
         return dialogueEnd(result);
     }
 
@@ -150,42 +456,102 @@ namespace ts
      *      --> REQUEST_CONFIRM_WRITE_FILE
      *      <-- RESPONSE_CONFIRM_WRITE_FILE
      */
-    bool ASDevice::createFile(const char* filename, const char* password, const void* buffer, unsigned size, const ASApplet* applet, int* fileIndex, bool raw)
+    bool ASDevice::doCreateFile(const char* filename, const char* password, const void* buffer, unsigned size, const ASApplet* applet, int* fileIndex, bool raw)
+    {
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        AppletUsage* usage = 0;
+        result = syncMemoryAccounting(applet->appletID(), &usage);
+        if (!result) return dialogueEnd(false);
+
+        if (size + 1024 > m_freeRam)
+        {
+            m_operationRejected = true;
+            return dialogueEnd(false);                  // REVIEW: arbitrarily choosing to keep at least 1k unused on the device
+        }
+
+        result = createFileInDialogue(filename, password, buffer, size, applet->appletID(), usage, fileIndex, raw);
+        return dialogueEnd(result);
+    }
+
+
+    /** Create a set of new files in a single dialogue. The space needed for the complete set is checked
+     *  against the free RAM on the device (keeping the same 1k reserve as createFile()) before any data
+     *  is sent. If the set does not fit, the request is either rejected outright or, if @e trim is set,
+     *  reduced to the leading files that do fit. If the device is released to another thread part way
+     *  through (see dialogueYield()), the remaining files are checked again against the space then free,
+     *  and the set is stopped (or, if @e trim is set, reduced) if they no longer fit.
+     *
+     *  @param  files       The files to create. On return, the fileIndex field of each entry is set to the
+     *                      index of the new file, or -1 if the file was not created.
+     *  @param  count       The number of entries in @e files.
+     *  @param  applet      The applet that will own the files.
+     *  @param  raw         Logical true to write raw data (see createFile()).
+     *  @param  trim        Logical true to create as many leading files as fit, false to create nothing
+     *                      unless every file fits.
+     *  @param  created     Returns the number of files created.
+     *  @return             Logical true if every planned file was created. False is returned if the set was
+     *                      rejected or trimmed for space, or if there was an IO error.
+     */
+    bool ASDevice::createFiles(ASDeviceFileRequest* files, unsigned count, const ASApplet* applet, bool raw, bool trim, unsigned* created)
     {
-        unsigned appletRam;
-        unsigned appletFileCount;
-        unsigned freeRam;
-        unsigned freeRom;
-        if (!getAppletResourceUsage(&appletFileCount, &appletRam, applet)) return false;
-        if (!systemMemory(&freeRam, &freeRom)) return false;
-        if (size + 1024 > freeRam) return false;        // REVIEW: arbitrarily choosing to keep at least 1k unused on the device
+        ASDeviceLease lease(this, kASDeviceOperationCreateFile);
 
-        *fileIndex = (int)(appletFileCount + 1);
+        *created = 0;
+        for (unsigned i = 0; i < count; i++) files[i].fileIndex = -1;
+        if (0 == count) return true;
 
         bool result = dialogueStart();
         if (!result) return false;
 
-        ASFileAttributes attr;
-        attr.setFileName(filename);
-        attr.setPassword(password);
-        attr.setAllocSize(size);
-        attr.setMinSize(size);
-        attr.setFileSpace(0);           // unbound
-        result = rawSetFileAttributes(attr.rawData(), applet->appletID(), *fileIndex);
-        if (result)
+        AppletUsage* usage = 0;
+        result = syncMemoryAccounting(applet->appletID(), &usage);
+        if (!result) return dialogueEnd(false);
+
+        // Plan the transfer: find how many leading files fit in the available space
+        unsigned planned = 0;
+        unsigned required = 1024;                       // REVIEW: arbitrarily choosing to keep at least 1k unused on the device
+        while (planned < count && required + files[planned].size <= m_freeRam && required + files[planned].size >= required)
         {
-            ASMessage message;
-            message.init(ASMESSAGE_REQUEST_COMMIT);             // Sending this message appears to bind the attributes to a new
-            message.setArgument((unsigned)*fileIndex, 4, 1);    // file - not sending it will still result in a new file, but
-            message.setArgument(applet->appletID(), 5, 2);      // the attributes will not be correct.
-            result = sendRequestAndGetResponse(&message);
-            if (result && ASMESSAGE_RESPONSE_COMMIT == message.command())
+            required += files[planned].size;
+            planned ++;
+        }
+
+        bool complete = (planned == count);
+        if (!complete && !trim) return dialogueEnd(false);
+
+        for (unsigned i = 0; i < planned && result; i++)
+        {
+            if (i > 0 && yieldRequested())
             {
-                result = rawWriteFile(buffer, size, applet->appletID(), *fileIndex, raw);
+                // Another thread may change the device while it is released, so re-sync the accounting
+                if (!dialogueYield()) return false;
+                result = syncMemoryAccounting(applet->appletID(), &usage);
+                if (!result) break;
+
+                // ...and check that the rest of the plan still fits
+                unsigned fits = i;
+                required = 1024;
+                while (fits < planned && required + files[fits].size <= m_freeRam && required + files[fits].size >= required)
+                {
+                    required += files[fits].size;
+                    fits ++;
+                }
+                if (fits < planned)
+                {
+                    complete = false;
+                    if (!trim || fits == i) break;
+                    planned = fits;
+                }
             }
+            result = createFileInDialogue(files[i].filename, files[i].password, files[i].buffer, files[i].size,
+                                          applet->appletID(), usage, &files[i].fileIndex, raw);
+            if (result) *created = i + 1;
+            else files[i].fileIndex = -1;
         }
 
-        return dialogueEnd(result);
+        return dialogueEnd(result && complete);
     }
 
 
@@ -196,13 +562,32 @@ namespace ts
      *  @param  applet      The applet.
      *  @param  fileIndex   The file index number.
      *  @param  raw         The logical true for raw file read, false for cooked.
+     *  @param  adaptive    Logical true to allow adaptive block sizes (see writeExtendedData()).
      *  @return             Logical false if there was an IO error. Note that appletIndex or fileIndex values
      *                      that are out of range will result in an IO error.
      */
-    bool ASDevice::writeFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw)
+    bool ASDevice::doWriteFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw, bool adaptive)
     {
         bool result = dialogueStart();
-        if (result) result = rawWriteFile(buffer, size, applet->appletID(), fileIndex, raw);
+        if (!result) return false;
+
+        /* The accounting can only be updated if the current size of the file is known locally.
+         * Otherwise it is discarded, and the next call that needs it re-syncs with the device.
+         */
+        unsigned oldSize = trackedFileSize(applet->appletID(), fileIndex);
+
+        result = rawWriteFile(buffer, size, applet->appletID(), fileIndex, raw, adaptive);
+
+        if (result && kASDeviceFileSizeUnknown != oldSize)
+        {
+            accountForResize(applet->appletID(), oldSize, size);
+            setTrackedFileSize(applet->appletID(), fileIndex, size);
+        }
+        else
+        {
+            invalidateMemoryAccounting();
+        }
+
         return dialogueEnd(result);
     }
 
@@ -213,33 +598,125 @@ namespace ts
      *  @param  fileIndex       The file index.
      *  @return                 Logical true if succeeded.
      */
-    bool ASDevice::clearFile(const ASApplet* applet, int fileIndex)
+    bool ASDevice::doClearFile(const ASApplet* applet, int fileIndex)
     {
         bool result = dialogueStart();
         if (!result) return false;
 
-        ASFileAttributes attr;
-        result = getFileAttributes(&attr, applet, fileIndex);
-        if (result)
+        result = clearFileInDialogue(applet->appletID(), fileIndex);
+        return dialogueEnd(result);
+    }
+
+
+    /** Clear a set of files in a single dialogue. This performs the same operation as clearFile()
+     *  for each file, but without the overhead of opening a new dialogue per file.
+     *
+     *  @param  applet          The applet that owns the files.
+     *  @param  indices         The file indices to clear.
+     *  @param  count           The number of entries in @e indices.
+     *  @param  cleared         Returns the number of files cleared. Files are cleared in order, so
+     *                          on failure this is also the position of the file that failed.
+     *  @return                 Logical true if every file was cleared.
+     */
+    bool ASDevice::doClearFiles(const ASApplet* applet, const int* indices, unsigned count, unsigned* cleared)
+    {
+        *cleared = 0;
+        if (0 == count) return true;
+
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        for (unsigned i = 0; i < count && result; i++)
         {
-            attr.setAllocSize(0);
-            attr.setMinSize(0);
-            result = rawSetFileAttributes(attr.rawData(), applet->appletID(), fileIndex);
-            if (result)
+            if (i > 0 && !dialogueYield()) return false;
+            result = clearFileInDialogue(applet->appletID(), indices[i]);
+            if (result) *cleared = i + 1;
+        }
+
+        return dialogueEnd(result);
+    }
+
+
+    /** Per-device state for clearFilesOnDevices().
+     */
+    struct ASDeviceClearJob
+    {
+        ASDevice* device;
+        ASAppletID appletID;
+        const int* indices;
+        unsigned count;
+        bool result;
+    };
+
+
+    /** Thread entry point for clearFilesOnDevices().
+     */
+    static void* clearFilesThread(void* context)
+    {
+        ASDeviceClearJob* job = (ASDeviceClearJob*)context;
+        ASDeviceScheduler::setThreadPriority(kASDevicePriorityBulk);
+        const ASApplet* applet = job->device->appletForID(job->appletID);
+        unsigned cleared;
+        job->result = (0 != applet) && job->device->clearFiles(applet, job->indices, job->count, &cleared);
+        return 0;
+    }
+
+
+    /** Clear the same set of files on several devices concurrently. Each device is handled by its own
+     *  thread, so the total time is that of the slowest device rather than the sum. The devices must be
+     *  distinct, and must not be used by any other thread until this call returns.
+     *
+     *  @param  devices         The devices.
+     *  @param  deviceCount     The number of devices.
+     *  @param  appletID        The ID of the applet that owns the files.
+     *  @param  indices         The file indices to clear.
+     *  @param  count           The number of entries in @e indices.
+     *  @param  results         Optional array of @e deviceCount entries that returns the result per device.
+     *  @return                 Logical true if every file was cleared on every device.
+     */
+    bool ASDevice::clearFilesOnDevices(ASDevice* const* devices, unsigned deviceCount, ASAppletID appletID, const int* indices, unsigned count, bool* results)
+    {
+        if (0 == deviceCount) return true;
+
+        ASDeviceClearJob* jobs = (ASDeviceClearJob*)calloc(deviceCount, sizeof (ASDeviceClearJob));
+        pthread_t* threads = (pthread_t*)calloc(deviceCount, sizeof (pthread_t));
+        bool* started = (bool*)calloc(deviceCount, sizeof (bool));
+        if (!jobs || !threads || !started)
+        {
+            free(jobs);
+            free(threads);
+            free(started);
+            return false;
+        }
+
+        for (unsigned i = 0; i < deviceCount; i++)
+        {
+            jobs[i].device = devices[i];
+            jobs[i].appletID = appletID;
+            jobs[i].indices = indices;
+            jobs[i].count = count;
+            jobs[i].result = false;
+            started[i] = (0 == pthread_create(&threads[i], 0, clearFilesThread, &jobs[i]));
+            if (!started[i])
             {
-                ASMessage message;
-                message.init(ASMESSAGE_REQUEST_COMMIT);         // Sending this message appears to bind the attributes to a new
-                message.setArgument((unsigned)fileIndex, 4, 1); // file - not sending it will still result in a new file, but
-                message.setArgument(applet->appletID(), 5, 2);  // the attributes will not be correct.
-                result = sendRequestAndGetResponse(&message);
-                if (result && ASMESSAGE_RESPONSE_COMMIT == message.command())
-                {
-                    result = rawWriteFile(0, 0, applet->appletID(), fileIndex, true);
-                }
+                fprintf(stderr, "%s: failed to create thread for device %u\n", __FUNCTION__, i);
+                clearFilesThread(&jobs[i]);         // run it synchronously instead
             }
         }
 
-        return dialogueEnd(result);
+        bool result = true;
+        for (unsigned i = 0; i < deviceCount; i++)
+        {
+            if (started[i]) pthread_join(threads[i], 0);
+            if (results) results[i] = jobs[i].result;
+            result = result && jobs[i].result;
+        }
+
+        free(jobs);
+        free(threads);
+        free(started);
+
+        return result;
     }
 
 
@@ -250,6 +727,8 @@ namespace ts
      */
     bool ASDevice::clearAllFiles(const ASApplet* applet)
     {
+        ASDeviceLease lease(this, kASDeviceOperationClearFile);
+
         bool result = dialogueStart();
         if (!result) return result;
 
@@ -269,7 +748,7 @@ namespace ts
         if (ASMESSAGE_RESPONSE_BLOCK_WRITE != message.command())  result = false;
         if (result)
         {
-            result = write(settings, sizeof settings);
+            result = transferWrite(settings, sizeof settings);
             if (result)
             {
                 result = getResponse(&message);
@@ -285,6 +764,7 @@ namespace ts
             }
         }
 
+        invalidateMemoryAccounting();       // the space released is not known locally
         return dialogueEnd(result);
     }
 
@@ -305,40 +785,36 @@ namespace ts
      *  @param  flags   The flags to select the data.
      *  @return         Logical true if the request succeeded.
      */
-    bool ASDevice::readSettings(void* buffer, unsigned* actual, unsigned size, const ASApplet* applet, unsigned flags)
+    bool ASDevice::doReadSettings(void* buffer, unsigned* actual, unsigned size, const ASApplet* applet, unsigned flags)
     {
         *actual = 0;
 
         bool result = dialogueStart();
         if (!result) return result;
 
-        ASMessage message;
-        message.init(ASMESSAGE_REQUEST_GET_SETTINGS);
-        message.setArgument(flags, 1, 4);               // flags
-        message.setArgument(applet->appletID(), 5, 2);  // applet id
-        result = sendRequestAndGetResponse(&message);
-        if (ASMESSAGE_RESPONSE_GET_SETTINGS != message.command())  result = false;
+        unsigned responseSize;
+        unsigned expectedChecksum;
+        result = rawRequestSettings(applet->appletID(), flags, &responseSize, &expectedChecksum);
         if (result)
         {
-            unsigned responseSize = message.argument(1, 4);
-            unsigned expectedChecksum = message.argument(5, 2);
             unsigned actualBytes = 0;
 
             if (size < responseSize)
             {
                 result = false;     // caller's buffer is too small
+                m_operationRejected = true;
                 unsigned remaining = responseSize;
                 uint8_t tmp[1024];
                 while (remaining > 0)
                 {
                     unsigned blockSize = (sizeof tmp <  remaining) ? sizeof tmp : remaining;
-                    if (!read(tmp, blockSize, &actualBytes)) break;
+                    if (!transferRead(tmp, blockSize, &actualBytes)) break;
                     remaining -= actualBytes;
                 }
             }
             else
             {
-                result = read(buffer, responseSize, &actualBytes);
+                result = transferRead(buffer, responseSize, &actualBytes);
                 result = result && (calculateDataChecksum(buffer, actualBytes) == expectedChecksum);
                 *actual = actualBytes;
             }
@@ -347,533 +823,2444 @@ namespace ts
     }
 
 
+    /** Read the settings for every applet, plus the system settings, in a single dialogue. The data
+     *  is collected in to one arena and can be accessed by applet ID via the collection.
+     *
+     *  @param  collection  The collection to fill. Any existing entries are removed.
+     *  @param  flags       The flags used to read each applet's settings (see readSettings()). The system
+     *                      settings are always read with flags 0x10 and applet ID 0.
+     *  @return             Logical true if the request succeeded.
+     */
+    bool ASDevice::doReadAllSettings(ASSettingsCollection* collection, unsigned flags)
+    {
+        collection->clear();
+
+        // Complete the applet list first, since enumeration runs its own dialogues
+        bool complete = false;
+        bool result = continueAppletEnumeration(~0u, &complete);
+        if (!result) return false;
 
+        result = dialogueStart();
+        if (!result) return false;
 
+        result = rawReadSettings(collection, kASAppletID_System, 0x10);
+        for (unsigned i = 0; result && i < m_applets.count(); i++)
+        {
+            const ASApplet* applet = m_applets.itemAtIndex(i);
+            if (applet->appletID() == kASAppletID_System || !applet->hasSettings()) continue;
+            result = rawReadSettings(collection, applet->appletID(), flags);
+        }
 
+        return dialogueEnd(result);
+    }
 
-#pragma mark    --------  Raw access methods  --------
 
 
 
 
 
-    /** Read a block of applet headers.
+
+
+#pragma mark    --------  Scheduling  --------
+
+
+
+    /** Called between files by operations that handle many files in a single dialogue. If interactive
+     *  requests from another thread are waiting for the device, the dialogue is closed, the device is
+     *  released to let them run, and a new dialogue is then started.
      *
-     *  @param  buffer      Byte buffer of length @e count * kASAppletHeaderSize.
-     *  @param  index       The index of the first header.
-     *  @param  count       The number of headers to try to read (max 7).
-     *  @param  actual      Returns the actual number of headers read.
-     *  @return             Logical true if the operation succeeded, false if an IO error occurred.
+     *  No yield is made if this thread holds the device outside the operation (for example, a client lease
+     *  around several operations), since releasing it would let other threads interleave with the sequence.
+     *  The per-operation state is saved and restored around the release.
+     *
+     *  @param  applet      The applet for the resumed dialogue.
+     *  @return             Logical true if the dialogue is open on return, false if it could not be restarted
+     *                      (in which case the caller must not call dialogueEnd()).
      */
-    bool ASDevice::rawReadAppletHeaders(uint8_t* buffer, int index, unsigned count, unsigned* actual)
+    bool ASDevice::dialogueYield(ASAppletID applet)
     {
-        assert(count <= 7);     // Reading more than 7 headers will cause a crash on some Neos (1k buffer overflow?)
+        if (!yieldRequested()) return true;
 
-        *actual = 0;
-        memset(buffer, 0, kASAppletHeaderSize * count);
+        dialogueEnd(true);
 
-        if (count > 7) return false;    // Don't trash the Neo!
+        bool rejected = m_operationRejected;
+        bool unsafe = m_unsafeRequestSent;
+        const ASDeviceCancelToken* cancel = m_cancelToken;
+        double deadline = m_deadline;
+        bool cancelled = m_operationCancelled;
 
-        ASMessage message(ASMESSAGE_REQUEST_LIST_APPLETS);
-        message.setArgument((unsigned)index, 1, 4);
-        message.setArgument(count, 5, 2);
-        bool result = (sendRequestAndGetResponse(&message), ASMESSAGE_RESPONSE_LIST_APPLETS);
-        if (!result) return false;                              // Error handling command
+        unsigned depth = m_scheduler.suspend();
+        m_scheduler.resume(depth);
 
-        unsigned size = message.argument(1, 4);
-        unsigned expectedChecksum = message.argument(5, 2);
+        m_operationRejected = rejected;
+        m_unsafeRequestSent = unsafe;
+        m_cancelToken = cancel;
+        m_deadline = deadline;
+        m_operationCancelled = cancelled;
 
-        if (size > (count * kASAppletHeaderSize))
-        {
-            fprintf(stderr, "%s: reply will return too much data!\n", __FUNCTION__);
-            return false;                                       // Unexpected data overrun
-        }
+        return dialogueStart(applet);
+    }
 
-        if (0 == size) return true;                             // no (more) applets present
 
-        unsigned actualBytes;
-        result = read(buffer, size, &actualBytes);
-        if (!result || actualBytes != size) return false;       // Unexpected read failure
 
-        if ((actualBytes % kASAppletHeaderSize) != 0)
-        {
-            fprintf(stderr, "%s: warning: read returned a partial header (expected header size %u, bytes read %u)\n",
-                __FUNCTION__, kASAppletHeaderSize, actualBytes);
-            assert(0);
-            // the partial header will be ignored rather than treated as an error (unless the checksum is also invalid)
-        }
+#pragma mark    --------  Cancellation  --------
 
-        unsigned actualChecksum = calculateDataChecksum(buffer, actualBytes);
-        if (actualChecksum != expectedChecksum)
-        {
-            fprintf(stderr, "%s: data checksum error\n", __FUNCTION__);
-            return false;
-        }
 
-        *actual = actualBytes / kASAppletHeaderSize;            // Return the actual number of headers read
-        return true;
+
+    /** Return an absolute deadline a given time from now, for use with the operations that accept one.
+     *
+     *  @param  ms          The time limit, in ms.
+     *  @return             The deadline.
+     */
+    double ASDevice::deadlineAfter(unsigned ms)
+    {
+        return currentTime() + (ms / 1000.0);
     }
 
 
-    /** Return the applet object for a specified index.
+    /** Apply a cancellation token and deadline to the operation that is about to start.
+     *
+     *  @param  cancel      The cancellation token, or zero.
+     *  @param  deadline    The absolute deadline, or kASDeviceNoDeadline.
      */
-    const ASApplet* ASDevice::appletAtIndex(int appletIndex)
+    void ASDevice::beginLimits(const ASDeviceCancelToken* cancel, double deadline)
     {
-        return m_applets.itemAtIndex((unsigned)appletIndex);
+        m_cancelToken = cancel;
+        m_deadline = deadline;
+        m_operationCancelled = false;
     }
 
 
-    /** Return the applet object for a specified applet ID.
+    /** Remove the limits applied by beginLimits(). The cancellation state is kept for wasCancelled() and
+     *  then cleared, together with the rejection state, so that it does not stop later operations.
      */
-    const ASApplet* ASDevice::appletForID(ASAppletID appletID)
+    void ASDevice::endLimits()
     {
-        int index = 0;
-        const ASApplet* applet;
-        while ((applet = m_applets.itemAtIndex((unsigned)index)))
-        {
-            if (applet->appletID() == appletID) return applet;
-            ++ index;
-        }
-        return 0;
+        m_cancelToken = 0;
+        m_deadline = kASDeviceNoDeadline;
+        m_lastOperationCancelled = m_operationCancelled;
+        m_operationCancelled = false;
+        m_operationRejected = false;
     }
 
 
-    /** Return the file attributes for a given applet and file index.
+    /** Check if the current operation has been cancelled or has run out of time. This is called at points
+     *  where the protocol is between messages, so that abandoning the dialogue leaves the device in a state
+     *  that reset() can recover. A cancelled operation is treated as rejected so that it is not retried.
+     *
+     *  @return             Logical true if the operation may continue.
      */
-    bool ASDevice::getFileAttributes(ASFileAttributes* attr, const ASApplet* applet, int fileIndex)
+    bool ASDevice::checkLimits()
     {
-        bool result = dialogueStart();
-        if (!result) return false;
-
-        uint8_t abuffer[kASFileAttributesSize];
-        unsigned actual;
+        if (m_operationCancelled) return false;
 
-        result = rawGetFileAttributes(abuffer, applet->appletID(), fileIndex++, &actual);
-        if (result)
+        if (m_cancelToken && m_cancelToken->isCancelled())
         {
-            if (actual == 0)
-            {
-                result = false;         // No such file.
-            }
-            else
-            {
-                attr->copyFrom(abuffer);
-            }
+            fprintf(stderr, "%s: operation cancelled\n", __FUNCTION__);
+        }
+        else if (kASDeviceNoDeadline != m_deadline && currentTime() >= m_deadline)
+        {
+            fprintf(stderr, "%s: operation deadline expired\n", __FUNCTION__);
+        }
+        else
+        {
+            return true;
         }
 
-        return dialogueEnd(result);
+        m_operationCancelled = true;
+        m_operationRejected = true;
+        return false;
     }
 
 
-    /** Set file attributes.
+    /** Return the timeout to use for a single transfer. With a deadline, this is the time remaining (so a
+     *  stalled transfer cannot overrun it), otherwise zero to select the transport default.
      *
-     *  @param  attr        The attributes to set.
-     *  @param  applet      The applet.
-     *  @param  fileIndex   The file number.
-     *  @return             Logical true if there was no error.
+     *  @return             The timeout, in ms.
      */
-    bool ASDevice::setFileAttributes(const ASApplet* applet, int fileIndex, const ASFileAttributes* attr)
+    unsigned ASDevice::transferTimeout() const
     {
-        if (0 == strlen(attr->fileName())) return false;        // zero length filenames will cause the Neo to crash
-        if (0 == strlen(attr->password())) return false;        // presumably zero length passwords are also bad...
+        if (kASDeviceNoDeadline == m_deadline) return 0;
 
-        if (!dialogueStart()) return false;
-        bool result = rawSetFileAttributes(attr->rawData(), applet->appletID(), fileIndex);
-        if (result)
-        {
-            ASMessage message;
-            message.init(ASMESSAGE_REQUEST_COMMIT);         // Sending this message appears to bind the attributes to a new
-            message.setArgument((unsigned)fileIndex, 4, 1); // file - not sending it will still result in a new file, but
-            message.setArgument(applet->appletID(), 5, 2);  // the attributes will not be correct.
-            result = sendRequestAndGetResponse(&message);
-            result = (result && ASMESSAGE_RESPONSE_COMMIT == message.command());
-        }
-        return dialogueEnd(result);
+        double remaining = (m_deadline - currentTime()) * 1000.0;
+        if (remaining < 1.0) return 1;
+        if (remaining > kASDeviceDeadlineMaxTimeout) return kASDeviceDeadlineMaxTimeout;
+        return (unsigned)remaining;
     }
 
 
 
-    /** Find the resources currently being used by an applet.
+#pragma mark    --------  Write block sizing  --------
+
+
+
+    /** Return the block size to use for the next block write transfer. This is the largest size known
+     *  to work, or double that if the larger size has not yet been tried (so each transfer probes at most
+     *  one new size).
      *
-     *  @param  fc          Returns the number of files used.
-     *  @param  ram         Returns the amount of RAM used by the applet in bytes.
-     *  @param  applet      The applet.
-     *  @return             Logical true if the request succeeded.
+     *  @return             The block size, in bytes.
      */
-    bool ASDevice::getAppletResourceUsage(unsigned* fc, unsigned* ram, const ASApplet* applet)
+    unsigned ASDevice::nextWriteBlockSize() const
     {
-        *fc = 0;
-        *ram = 0;
+        unsigned probe = m_writeBlockSize * 2;
+        if (probe > kASWriteBlockSizeMax) return m_writeBlockSize;
+        if (0 != m_writeBlockRejected && probe >= m_writeBlockRejected) return m_writeBlockSize;
+        return probe;
+    }
 
-        if (!dialogueStart()) return false;
 
-        ASMessage message;
-        message.init(ASMESSAGE_REQUEST_GET_USED_SPACE);
-        message.setArgument(0x00000001, 1, 4);              // set zero to get the size of the largest file, non-zero for all files
-        message.setArgument(applet->appletID(), 5, 2);
-        bool result = sendRequestAndGetResponse(&message);
-        if (result && message.command() == ASMESSAGE_RESPONSE_GET_USED_SPACE)
-        {
-            *ram = message.argument(1, 4);
-            *fc = message.argument(5, 2);
-        }
-        return dialogueEnd(result);
+    /** Record that a block of a given size was written successfully.
+     *
+     *  @param  blockSize   The block size.
+     */
+    void ASDevice::writeBlockAccepted(unsigned blockSize)
+    {
+        if (blockSize <= m_writeBlockSize) return;
+        m_writeBlockSize = blockSize;
+        fprintf(stderr, "%s: device %08x accepts %u byte blocks\n", __FUNCTION__, m_identity, blockSize);
+        saveTransferProfile();
     }
 
 
-
-    /** Ping the device for the ASM protocol version number. This will put the Neo in
-     *  to ASM mode and also return the protocol version. It is also used as a keep-alive
-     *  test.
+    /** Record that a block of a given size was refused by the device, or failed to transfer.
+     *
+     *  @param  blockSize   The block size.
      */
-    bool ASDevice::hello()
+    void ASDevice::writeBlockRejected(unsigned blockSize)
     {
-        static const uint8_t ascCommandRequestProtocol[1] = { 0x01 };
-        uint8_t buffer[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-        unsigned actual = 0;
-        unsigned version = 0;
-        unsigned retry = 10;
+        if (0 != m_writeBlockRejected && blockSize >= m_writeBlockRejected) return;
+        m_writeBlockRejected = blockSize;
+        fprintf(stderr, "%s: device %08x does not accept %u byte blocks - using %u\n", __FUNCTION__, m_identity, blockSize, m_writeBlockSize);
+        saveTransferProfile();
+    }
 
-        bool ok = write(ascCommandRequestProtocol, 1, 100)  &&  read(buffer, 8, &actual, 100);
-        while (!ok || actual != 2)
-        {
-            fprintf(stderr, "%s: unexpected %u byte response: ", __FUNCTION__, actual);
-            for (unsigned i = 0; i < actual; i++) fprintf(stderr, " %02x", buffer[i]);
-            fprintf(stderr, "\n");
 
-            retry --;
-            if (0 == retry)
+    /** Accumulate upload statistics for a block.
+     *
+     *  @param  blockSize   The block size in use for the transfer.
+     *  @param  bytes       The number of bytes in the block (this may be less than blockSize for the last block).
+     *  @param  seconds     The time taken, including the request and acknowledgement.
+     */
+    void ASDevice::recordWriteBlock(unsigned blockSize, unsigned bytes, double seconds)
+    {
+        for (unsigned i = 0; i < kASWriteBlockSizeCount; i++)
+        {
+            ASDeviceWriteBlockStatistics* stats = &m_writeBlockStatistics[i];
+            if (stats->blockSize == blockSize)
             {
-                fprintf(stderr, "%s: this device doesn't look like it wants to talk to us - bailing out.\n", __FUNCTION__);
-                return false;
+                stats->blocks ++;
+                stats->bytes += bytes;
+                stats->seconds += seconds;
+                break;
             }
-
-            reset();        // try to issue a protocol reset
-            usleep(100000); // give the device a little time to see and handle the reset
-            ok = write(ascCommandRequestProtocol, 1, 100)  &&  read(buffer, 8, &actual, 100);
         }
+    }
 
-        version = ((unsigned)buffer[0] << 8) | ((unsigned)buffer[1] << 0);
-        if (version < kASMProtocolVersion)
-        {
-            fprintf(stderr, "%s: ASM protocol version not supported: %0x04x\n", __FUNCTION__, version);
-            ok = false;
-        }
 
-        return ok;
-    }
+    /** Reset the upload statistics.
+     */
+    void ASDevice::resetWriteBlockStatistics()
+    {
+        ASDeviceLease lease(this);
 
+        memset(m_writeBlockStatistics, 0, sizeof m_writeBlockStatistics);
+        for (unsigned i = 0; i < kASWriteBlockSizeCount; i++) m_writeBlockStatistics[i].blockSize = kASWriteBlockSizeMin << i;
+    }
 
 
-    /** Reset the device to a known state.
-     *
-     *  @return Logical true if the device is supported and working correctly.
+    /** Log the upload throughput for each block size that has been used, with the speedup relative to the
+     *  minimum block size.
      */
-    bool ASDevice::reset()
+    void ASDevice::logWriteBlockStatistics() const
     {
-        static const uint8_t ascCommandRequestReset[8] = { 0x3f, 0xff, 0x00, 0x72, 0x65, 0x73, 0x65, 0x74 };
+        double baseline = m_writeBlockStatistics[0].throughput();
+        for (unsigned i = 0; i < kASWriteBlockSizeCount; i++)
+        {
+            const ASDeviceWriteBlockStatistics* stats = &m_writeBlockStatistics[i];
+            if (0 == stats->blocks) continue;
+            fprintf(stderr, "%s: device %08x: %5u byte blocks: %u blocks, %.0f bytes in %.2fs (%.0f bytes/s", __FUNCTION__,
+                m_identity, stats->blockSize, stats->blocks, stats->bytes, stats->seconds, stats->throughput());
+            if (baseline > 0.0) fprintf(stderr, ", %.2fx", stats->throughput() / baseline);
+            fprintf(stderr, ")\n");
+        }
+    }
 
 
-        // Send a reset command
-        bool ok = write(ascCommandRequestReset, sizeof ascCommandRequestReset);
-        if (!ok)
+    /** Pick up the transfer capabilities already found on other devices running the same OS.
+     */
+    void ASDevice::loadTransferProfile()
+    {
+        pthread_mutex_lock(&s_transferProfileLock);
+        for (unsigned i = 0; i < s_transferProfileCount; i++)
         {
-            fprintf(stderr, "%s: Failed to send reset command to Neo.\n", __FUNCTION__);
+            const ASTransferProfile* profile = &s_transferProfiles[i];
+            if (profile->major == m_systemMajor && profile->minor == m_systemMinor && 0 == strcmp(profile->systemName, m_systemName))
+            {
+                if (profile->safeSize > m_writeBlockSize) m_writeBlockSize = profile->safeSize;
+                if (0 != profile->rejectedSize && (0 == m_writeBlockRejected || profile->rejectedSize < m_writeBlockRejected)) m_writeBlockRejected = profile->rejectedSize;
+                if (profile->pipelineFailed) m_pipelineFailed = true;
+                break;
+            }
         }
-        return ok;
+        pthread_mutex_unlock(&s_transferProfileLock);
     }
 
 
-    /** Switch communication to a specific applet.
-     *
-     *  @return Logical true if the device is supported and working correctly.
+    /** Share this device's transfer findings with other devices running the same OS.
      */
-    bool ASDevice::switchApplet(ASAppletID applet)
+    void ASDevice::saveTransferProfile() const
     {
-        static const uint8_t ascCommandRequestSwitch[8] = { 0x3f, 0x53, 0x77, 0x74, 0x63, 0x68, 0x00, 0x00 };
-        static const uint8_t ascCommandResponseSwitched[8] = { 0x53, 0x77, 0x69, 0x74, 0x63, 0x68, 0x65, 0x64 };
-        uint8_t buffer[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-        bool ok;
+        if (!m_systemKnown) return;
 
-        memcpy(buffer, ascCommandRequestSwitch, sizeof buffer);
-        buffer[6] = (applet >> 8) & 0xff;
-        buffer[7] = (applet >> 0) & 0xff;
-        ok = write(buffer, sizeof buffer) && read(buffer, sizeof buffer);
-        if (!ok)
+        pthread_mutex_lock(&s_transferProfileLock);
+        ASTransferProfile* profile = 0;
+        for (unsigned i = 0; i < s_transferProfileCount; i++)
         {
-            fprintf(stderr, "%s: failed to send switch command to device\n", __FUNCTION__);
-            return ok;
+            ASTransferProfile* p = &s_transferProfiles[i];
+            if (p->major == m_systemMajor && p->minor == m_systemMinor && 0 == strcmp(p->systemName, m_systemName))
+            {
+                profile = p;
+                break;
+            }
         }
-
-        ok = (0 == memcmp(buffer, ascCommandResponseSwitched, 8));
-        if (!ok)
+        if (!profile && s_transferProfileCount < kASTransferProfileMaxCount)
         {
-            fprintf(stderr, "%s: failed to switch to applet %04x:  ", __FUNCTION__, applet);
-            for (unsigned i = 0; i < 8; i++) fprintf(stderr, "%c", isprint(buffer[i]) ? buffer[i] : '.');
-            fprintf(stderr, "\n");
+            profile = &s_transferProfiles[s_transferProfileCount++];
+            memset(profile, 0, sizeof *profile);
+            strncpy(profile->systemName, m_systemName, sizeof profile->systemName - 1);
+            profile->major = m_systemMajor;
+            profile->minor = m_systemMinor;
+            profile->safeSize = kASWriteBlockSizeMin;
         }
-
-        return ok;
+        if (profile)
+        {
+            if (m_writeBlockSize > profile->safeSize) profile->safeSize = m_writeBlockSize;
+            if (0 != m_writeBlockRejected && (0 == profile->rejectedSize || m_writeBlockRejected < profile->rejectedSize)) profile->rejectedSize = m_writeBlockRejected;
+            if (m_pipelineFailed) profile->pipelineFailed = true;
+        }
+        pthread_mutex_unlock(&s_transferProfileLock);
     }
 
 
 
-    /** Send a command.
+#pragma mark    --------  State retention  --------
+
+
+
+    /** Copy the state worth keeping after the device is disconnected (see ASDeviceRetainedState). This
+     *  is called by the factory as the device is removed, and the state is attached to a new device
+     *  object with the same identity if it is reconnected.
      *
-     *  @param  request     The command message.
-     *  @return             Logical true if the message was sent.
+     *  @return             The state (to be deleted by the caller), or zero if there is nothing worth keeping.
      */
-    bool ASDevice::sendRequest(const ASMessage* request)
+    ASDeviceRetainedState* ASDevice::detachState()
     {
-        bool result = write(request->rawData(), request->rawSize());
-        if (!result) fprintf(stderr, "%s: error sending to device\n", __FUNCTION__);
-        return result;
+        ASDeviceLease lease(this);
+
+        ASDeviceRetainedState* state = new ASDeviceRetainedState;
+        if (m_systemKnown && m_appletsComplete && 0 != m_appletHeaderCount)
+        {
+            state->appletHeaderData = (uint8_t*)malloc(m_appletHeaderCount * kASAppletHeaderSize);
+            if (state->appletHeaderData)
+            {
+                memcpy(state->appletHeaderData, m_appletHeaderData, m_appletHeaderCount * kASAppletHeaderSize);
+                state->appletHeaderCount = m_appletHeaderCount;
+            }
+        }
+
+        state->identity = m_identity;
+        state->detachTime = currentTime();
+        state->systemMajor = m_systemMajor;
+        state->systemMinor = m_systemMinor;
+        strncpy(state->systemName, m_systemName, sizeof state->systemName - 1);
+        strncpy(state->systemDate, m_systemDate, sizeof state->systemDate - 1);
+        state->writeBlockSize = m_writeBlockSize;
+        state->writeBlockRejected = m_writeBlockRejected;
+        state->pipelineFailed = m_pipelineFailed;
+        state->healthScore = m_healthScore;
+        state->watchdogAborts = m_watchdogAborts;
+        return state;
     }
 
 
-    /** Get a response to a command.
+    /** Attach state retained from a previous connection. This must be called before initialise(), which
+     *  uses the applet headers and transfer parameters if the device identity and OS version still match.
+     *  The health history is carried over regardless, so that it covers the whole session.
      *
-     *  @param  response    Message to receive the response.
-     *  @return             Logical true if the operation completed.
+     *  @param  state       The state (may be zero). The device takes ownership.
      */
-    bool ASDevice::getResponse(ASMessage* response)
+    void ASDevice::attachState(ASDeviceRetainedState* state)
     {
-        bool result = read(response->rawData(), response->rawSize());
-        if (!result) fprintf(stderr, "%s: error reading from device\n", __FUNCTION__);
-        return result;
+        ASDeviceLease lease(this);
+
+        if (state && state->identity == m_identity)
+        {
+            m_healthScore = state->healthScore;
+            m_watchdogAborts = state->watchdogAborts;
+        }
+
+        delete m_retainedState;
+        m_retainedState = state;
     }
 
 
-    /** Send a message and get the response.
+    /** Adopt the attached retained state, if it matches the device. This must be called from initialise(),
+     *  after the OS version has been read. The applet headers still need to be validated by the caller.
      *
-     *  @param  message     On entry, holds the command message to send. On return, contains the reply.
-     *  @return             Logical true if the operation completed successfully.
+     *  @return             Logical true if the applet header data has been loaded from the retained state.
      */
-    bool ASDevice::sendRequestAndGetResponse(ASMessage* message)
+    bool ASDevice::adoptRetainedState()
     {
-        return sendRequest(message) && getResponse(message);
+        assert(0 == m_appletHeaderData);
+
+        ASDeviceRetainedState* state = m_retainedState;
+        if (!state || !state->appletHeaderData) return false;
+        if (state->identity != m_identity || state->systemMajor != m_systemMajor || state->systemMinor != m_systemMinor) return false;
+        if (0 != strncmp(state->systemName, m_systemName, 64) || 0 != strncmp(state->systemDate, m_systemDate, 64)) return false;
+
+        if (state->writeBlockSize > m_writeBlockSize) m_writeBlockSize = state->writeBlockSize;
+        if (0 != state->writeBlockRejected && (0 == m_writeBlockRejected || state->writeBlockRejected < m_writeBlockRejected)) m_writeBlockRejected = state->writeBlockRejected;
+        if (state->pipelineFailed) m_pipelineFailed = true;
+
+        m_appletHeaderData = state->appletHeaderData;
+        m_appletHeaderCount = state->appletHeaderCount;
+        state->appletHeaderData = 0;
+        state->appletHeaderCount = 0;
+        return true;
     }
 
 
-    /** Send a message and get the response, checking for an explicit response code. If the response
-     *  code is not matched and error will be returned.
-     *
-     *  @param  message     On entry, holds the command message to send. On return, contains the reply.
-     *  @param  code        The message code to validate.
-     *  @return             Logical true if the operation completed successfully.
+    /** Destructor. Any states still held are discarded.
      */
-    bool ASDevice::sendRequestAndGetResponse(ASMessage* message, unsigned code)
+    ASDeviceStatePool::~ASDeviceStatePool()
     {
-        unsigned sendCode = message->command();
-        bool result = sendRequest(message) && getResponse(message);
-        if (result && (code != message->command()))
+        for (unsigned i = 0; i < m_states.count(); i++)
         {
-            fprintf(stderr, "%s: unexpected message response: send %02x, received %02x, expected %02x\n", __FUNCTION__, sendCode, message->command(), code);
-            result = false;
+            delete m_states.itemAtIndex(i);
         }
-        return result;
+        m_states.removeAllItems();
     }
 
 
-
-    /** Calculate a data checksum from a block of data.
+    /** Add a state to the pool, replacing any existing state for the same device.
      *
-     *  @param  data        The data to checksum.
-     *  @param  length      The number of bytes present.
-     *  @return             The checksum.
+     *  @param  state       The state (may be zero). The pool takes ownership.
      */
-    unsigned ASDevice::calculateDataChecksum(const void* data, unsigned length) const
+    void ASDeviceStatePool::retain(ASDeviceRetainedState* state)
     {
-        const uint8_t* ptr = (const uint8_t*) data;
-        const uint8_t* end = ptr + length;
+        if (!state) return;
 
-        unsigned result = 0;
-        while (ptr != end)
+        delete take(state->identity);
+        purge();
+        while (m_states.count() >= kASDeviceStatePoolMaxCount)
         {
-            result += ((unsigned)(*ptr++)) & 0xff;
+            delete m_states.itemAtIndex(0);
+            m_states.removeItemAtIndex(0);
         }
-
-        return result & 0xffff;
+        if (!m_states.appendItem(state)) delete state;
     }
 
 
-
-    /** Read binary data blocks in response to some other command, handling segmentation
-     *  and checksum validation.
-     *
-     *  The command sequence is:
-     *
-     *      While data left to read
-     *          OUT:    0x10    ASMESSAGE_REQUEST_BLOCK_READ
-     *          IN:     0x4d    ASMESSAGE_RESPONSE_BLOCK_READ
-     *          OUT:    data
+    /** Remove and return the state for a device.
      *
-     *  @param  dest        Where to put the data.
-     *  @param  size        The number of bytes that are expected to be delivered.
-     *  @param  actual      Used to return the number of bytes actually read.
-     *  @return             The actual number of bytes obtained.
+     *  @param  identity    The device identity.
+     *  @return             The state (to be deleted by the caller), or zero if none is held.
      */
-    bool ASDevice::readExtendedData(void* dest, unsigned size, unsigned* actual)
+    ASDeviceRetainedState* ASDeviceStatePool::take(unsigned identity)
     {
-        uint8_t* ptr = (uint8_t*) dest;
-        unsigned bytesread = 0;
-        bool ok = true;
-
-        const ASMessage request(ASMESSAGE_REQUEST_BLOCK_READ);
-        ASMessage response;
-
-        unsigned remaining = size;
-        while (remaining > 0)
+        purge();
+        for (unsigned i = 0; i < m_states.count(); i++)
         {
-            if (!sendRequest(&request) || !getResponse(&response))
-            {
-                fprintf(stderr, "Error sending commands\n");
-                ok = false;
-                break;
-            }
-            else if (response.command() == ASMESSAGE_RESPONSE_BLOCK_READ_EMPTY)
+            ASDeviceRetainedState* state = m_states.itemAtIndex(i);
+            if (state->identity == identity)
             {
-                // No more data to return
-                break;
+                m_states.removeItemAtIndex(i);
+                return state;
             }
-            else if (response.command() == ASMESSAGE_RESPONSE_BLOCK_READ)
+        }
+        return 0;
+    }
+
+
+    /** Discard states that are older than kASDeviceStatePoolMaxAge.
+     */
+    void ASDeviceStatePool::purge()
+    {
+        double now = currentTime();
+        unsigned i = 0;
+        while (i < m_states.count())
+        {
+            ASDeviceRetainedState* state = m_states.itemAtIndex(i);
+            if ((now - state->detachTime) > kASDeviceStatePoolMaxAge)
             {
-                unsigned blocksize = response.argument(1, 4);
-                unsigned checksum = response.argument(5, 2);
-                ok = read(ptr, blocksize);
-                if (!ok)
-                {
-                    fprintf(stderr, "%s: error reading data\n", __FUNCTION__);
-                    ok = false;
-                    break;
-                }
-                else if (calculateDataChecksum(ptr, blocksize) != checksum)
-                {
-                    fprintf(stderr, "%s: bad checksum: expected %04x, got %04x\n", __FUNCTION__, checksum, calculateDataChecksum(ptr, blocksize));
-                    ok = false;
-                    break;
-                }
-                else
-                {
-                    ptr += blocksize;
-                    bytesread += blocksize;
-                }
+                m_states.removeItemAtIndex(i);
+                delete state;
             }
             else
             {
-                fprintf(stderr, "%s: unexpected response\n", __FUNCTION__);
-                ok = false;
-                break;
+                i ++;
             }
         }
+    }
 
-        assert(bytesread <= size);
-        if (actual) *actual = bytesread;
 
-        if (!ok) fprintf(stderr, "%s: error. last request %02x, response %02x\n", __FUNCTION__, request.command(), response.command());
-        return ok;
-    }
 
+#pragma mark    --------  Health  --------
 
 
 
+    /** Make sure the watchdog is disarmed at the end of a dialogue, and if it aborted a transfer, record the
+     *  hang. The current attempt is then marked so that it is not retried (see retryOperation()): a device
+     *  that has hung once is likely to do so again, and the caller is better placed to decide what to do next.
+     */
+    void ASDevice::watchdogEnd()
+    {
+        ASDeviceWatchdog::sharedWatchdog()->disarm(this);
+        if (m_watchdogFired)
+        {
+            m_watchdogFired = false;
+            m_transferAborted = true;
+            m_watchdogAborts ++;
+            adjustHealth(-kASDeviceHealthHangPenalty);
+            fprintf(stderr, "%s: transfer aborted by the watchdog (health now %u)\n", __FUNCTION__, m_healthScore);
+        }
+    }
 
 
-    /** Write a block of binary data in response to a command.
+    /** Adjust the health score, limiting it to the range 0 to kASDeviceHealthMax.
      *
-     *  This manages the following sequence of commands:
+     *  @param  delta       The change.
+     */
+    void ASDevice::adjustHealth(int delta)
+    {
+        int score = (int)m_healthScore + delta;
+        if (score < 0) score = 0;
+        if (score > kASDeviceHealthMax) score = kASDeviceHealthMax;
+        m_healthScore = (unsigned)score;
+    }
+
+
+
+#pragma mark    --------  Write block probing  --------
+
+
+
+    /** Enable or disable adaptive BLOCK_WRITE sizing for file writes (see writeExtendedData()). This is
+     *  experimental and is off by default, in which case every block is kASWriteBlockSizeMin bytes.
      *
-     *      While data left to send:
-     *          OUT:    0x02    ASMESSAGE_REQUEST_BLOCK_WRITE
-     *          IN:     0x42    ASMESSAGE_RESPONSE_BLOCK_WRITE
-     *          OUT:    data
-     *          IN:     0x43    ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE
+     *  @param  enable      Logical true to probe for and use larger blocks where possible.
+     */
+    void ASDevice::setWriteBlockProbing(bool enable)
+    {
+        ASDeviceLease lease(this);
+
+        m_writeBlockProbing = enable;
+    }
+
+
+
+#pragma mark    --------  Read pipelining  --------
+
+
+
+    /** Enable or disable pipelined block reads (see readExtendedData()). This is experimental and is off by
+     *  default. Pipelining is never used on a device (or on any device with the same OS version) once it
+     *  has been seen to fail, even if enabled here.
      *
-     *  @param  dest        The data.
-     *  @param  size        The number of bytes that are to be written.
-     *  @return             Logical true if the operation succeeded, false otherwise.
+     *  @param  enable      Logical true to use pipelined reads where possible.
      */
-    bool ASDevice::writeExtendedData(const void* source, unsigned size)
+    void ASDevice::setPipelinedReads(bool enable)
+    {
+        ASDeviceLease lease(this);
+
+        m_pipelineRequested = enable;
+    }
+
+
+    /** Record that a pipelined block read failed, so that the device and its OS version fall back to
+     *  unpipelined reads.
+     */
+    void ASDevice::pipelineFailed()
+    {
+        if (m_pipelineFailed) return;
+        m_pipelineFailed = true;
+        fprintf(stderr, "%s: device %08x: pipelined block reads disabled\n", __FUNCTION__, m_identity);
+        saveTransferProfile();
+    }
+
+
+    /** Reset the block read statistics.
+     */
+    void ASDevice::resetReadStatistics()
+    {
+        ASDeviceLease lease(this);
+
+        memset(m_readStatistics, 0, sizeof m_readStatistics);
+    }
+
+
+    /** Log the block read throughput with and without pipelining.
+     */
+    void ASDevice::logReadStatistics() const
+    {
+        for (unsigned i = 0; i < 2; i++)
+        {
+            const ASDeviceReadStatistics* stats = &m_readStatistics[i];
+            if (0 == stats->blocks) continue;
+            fprintf(stderr, "%s: device %08x: %s: %u blocks, %.0f bytes in %.2fs (%.0f bytes/s)\n", __FUNCTION__,
+                m_identity, (i) ? "pipelined" : "unpipelined", stats->blocks, stats->bytes, stats->seconds, stats->throughput());
+        }
+        if (m_readStatistics[0].throughput() > 0.0 && m_readStatistics[1].throughput() > 0.0)
+        {
+            fprintf(stderr, "%s: device %08x: pipelining speedup %.2fx\n", __FUNCTION__, m_identity, m_readStatistics[1].throughput() / m_readStatistics[0].throughput());
+        }
+    }
+
+
+    /** Consume the response to a block read request that was sent speculatively but is no longer wanted,
+     *  including any data block, so that the device is back in step for the following reset(). The default
+     *  transport timeouts are used, as a deadline may already have expired.
+     */
+    void ASDevice::drainBlockRead()
     {
-        ASMessage request;
         ASMessage response;
+        if (!transferRead(response.rawData(), response.rawSize())) return;
+        if (ASMESSAGE_RESPONSE_BLOCK_READ != response.command()) return;
+        discardData(response.argument(1, 4));
+    }
 
-        unsigned remaining = size;
-        const uint8_t* ptr = (const uint8_t*) source;
 
-        while (remaining > 0)
+    /** Read and discard data sent by the device, using the default transport timeouts.
+     *
+     *  @param  size        The number of bytes to discard.
+     *  @return             Logical true if the data was read.
+     */
+    bool ASDevice::discardData(unsigned size)
+    {
+        uint8_t block[kASBlockReadBufferSize];
+        while (size > 0)
         {
-            unsigned blocksize = (remaining < 1024) ? remaining : 1024;
-            unsigned checksum = calculateDataChecksum(ptr, blocksize);
-            request.init(ASMESSAGE_REQUEST_BLOCK_WRITE);
-            request.setArgument(blocksize, 1, 4);
-            request.setArgument(checksum, 5, 2);
-            if (!sendRequest(&request)) goto error;
-            if (!getResponse(&response)) goto error;
-            if (ASMESSAGE_RESPONSE_BLOCK_WRITE != response.command()) goto error;
-            if (!write(ptr, blocksize)) goto error;
-            if (!getResponse(&response)) goto error;
-            if (ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE != response.command()) goto error;
+            unsigned chunk = (size < sizeof block) ? size : sizeof block;
+            if (!transferRead(block, chunk)) return false;
+            size -= chunk;
+        }
+        return true;
+    }
 
-            remaining -= blocksize;
-            ptr += blocksize;
+
+
+#pragma mark    --------  Retry handling  --------
+
+
+
+    /** Set the retry policy. The policy applies to the public operations that can be safely repeated
+     *  after a transport failure (see ASDeviceRetryPolicy).
+     *
+     *  @param  policy      The new policy.
+     */
+    void ASDevice::setRetryPolicy(const ASDeviceRetryPolicy& policy)
+    {
+        ASDeviceLease lease(this);
+
+        m_retryPolicy = policy;
+        if (0 == m_retryPolicy.maxAttempts) m_retryPolicy.maxAttempts = 1;
+    }
+
+
+    /** Reset the retry statistics.
+     */
+    void ASDevice::resetRetryStatistics()
+    {
+        ASDeviceLease lease(this);
+
+        memset(&m_retryStatistics, 0, sizeof m_retryStatistics);
+    }
+
+
+    /** Prepare for an attempt at an operation.
+     */
+    void ASDevice::beginAttempt()
+    {
+        m_operationRejected = false;
+        m_unsafeRequestSent = false;
+        m_transferAborted = false;
+    }
+
+
+    /** Decide if a failed operation should be retried, and if so wait for the backoff period. Successful
+     *  operations are recorded in the statistics and are never retried.
+     *
+     *  An operation is not retried if it was rejected (the device returned an ASMESSAGE_ERROR_xxx response,
+     *  or the request itself was invalid, such as reading a file that does not exist), since repeating it
+     *  would just give the same result. Nor is it retried if a command that cannot safely be repeated was
+     *  sent and @e unsafeOk is not set, or if the watchdog had to abort a hung transfer.
+     *
+     *  @param  result      The result of the last attempt.
+     *  @param  attempt     On entry, the number of retries made so far. Incremented if a retry is needed.
+     *  @param  unsafeOk    Logical true if the caller knows that the operation can be repeated as a whole
+     *                      even though it uses non-idempotent commands.
+     *  @return             Logical true if the operation should be attempted again.
+     */
+    bool ASDevice::retryOperation(bool result, unsigned* attempt, bool unsafeOk)
+    {
+        if (result)
+        {
+            m_retryStatistics.operations ++;
+            if (*attempt > 0) m_retryStatistics.recovered ++;
+            adjustHealth(1);
+            return false;
+        }
+
+        bool rejected = m_operationRejected || m_transferAborted || !checkLimits();
+        bool unsafe = m_unsafeRequestSent && !unsafeOk;
+        if (rejected || unsafe || (*attempt + 1) >= m_retryPolicy.maxAttempts)
+        {
+            if (!m_operationRejected) adjustHealth(-kASDeviceHealthFailPenalty);
+            m_retryStatistics.operations ++;
+            m_retryStatistics.failed ++;
+            if (unsafe) m_retryStatistics.unsafe ++;
+            return false;
+        }
+
+        /* Exponential backoff with jitter: wait a random time between half and the whole of the
+         * current delay, so that several devices on the same bus do not retry in lock-step.
+         */
+        unsigned delay = m_retryPolicy.baseDelay << ((*attempt < 16) ? *attempt : 16);
+        if (delay > m_retryPolicy.maxDelay || delay < m_retryPolicy.baseDelay) delay = m_retryPolicy.maxDelay;
+        if (0 == m_randomSeed) m_randomSeed = (unsigned)time(0) ^ (unsigned)(size_t)this ^ m_identity;
+        delay = (delay / 2) + (unsigned)(rand_r(&m_randomSeed) % (delay / 2 + 1));
+        if (kASDeviceNoDeadline != m_deadline && delay > transferTimeout()) delay = transferTimeout();
+
+        *attempt += 1;
+        m_retryStatistics.retries ++;
+        m_protocolStatistics.retry();
+        fprintf(stderr, "%s: retrying (attempt %u) after %ums\n", __FUNCTION__, *attempt + 1, delay);
+        usleep(delay * 1000);
+        return true;
+    }
+
+
+    /** Read a file, retrying on transport failure (see doReadFile()). The read stops early if the token is
+     *  cancelled or the deadline passes, in which case wasCancelled() returns true.
+     */
+    bool ASDevice::readFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+        const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationReadFile);
+
+        beginLimits(cancel, deadline);
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doReadFile(buffer, size, actual, applet, fileIndex, raw);
+        } while (retryOperation(result, &attempt));
+        endLimits();
+        return result;
+    }
+
+
+    /** Read a file, passing each block to a sink as it arrives (for example, to decode the file while the
+     *  transfer is in progress). The read is not retried, as the sink may already have seen part of the file.
+     *
+     *  @param  sink        The data sink.
+     *  @param  context     Context passed to the sink.
+     *  @param  size        The maximum number of bytes to read.
+     *  @param  actual      Returns the number of bytes delivered to the sink.
+     *  @param  applet      The applet.
+     *  @param  fileIndex   The file number.
+     *  @param  raw         Logical true to read the raw file.
+     *  @return             Logical true if the file was read.
+     */
+    bool ASDevice::readFile(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+        const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationReadFile);
+
+        *actual = 0;
+
+        beginLimits(cancel, deadline);
+        bool result = dialogueStart();
+        if (result)
+        {
+            result = rawReadFile(sink, context, size, actual, applet->appletID(), fileIndex, raw);
+            result = dialogueEnd(result);
+        }
+        endLimits();
+        return result;
+    }
+
+
+    /** Create a new file, retrying on transport failure (see doCreateFile()).
+     *
+     *  Creating a file is not idempotent: once COMMIT has been sent the file may exist on the device, and
+     *  simply repeating the operation could create a second copy. In that case the file attributes are
+     *  checked and, if the file is present, the operation continues as a whole-file write to it.
+     */
+    bool ASDevice::createFile(const char* filename, const char* password, const void* buffer, unsigned size, const ASApplet* applet, int* fileIndex, bool raw)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationCreateFile);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doCreateFile(filename, password, buffer, size, applet, fileIndex, raw);
+            if (!result && m_unsafeRequestSent && !m_operationRejected)
+            {
+                // The COMMIT may have been seen by the device: see if the file now exists
+                ASFileAttributes attr;
+                bool exists = false;
+                bool missing = false;
+                unsigned probe = 0;
+                bool probed;
+                do
+                {
+                    beginAttempt();
+                    probed = doGetFileAttributes(&attr, applet, *fileIndex);
+                    exists = probed && (0 == strcmp(attr.fileName(), filename));
+                    missing = !probed && m_operationRejected && !m_operationCancelled && !m_transferAborted;  // no such file
+                } while (!probed && !missing && retryOperation(false, &probe));
+
+                if (exists)
+                {
+                    do
+                    {
+                        beginAttempt();
+                        result = doWriteFile(buffer, size, applet, *fileIndex, raw, false);
+                    } while (retryOperation(result, &attempt));
+                    return result;
+                }
+                m_unsafeRequestSent = false;        // the file was not created, so the whole operation can be repeated
+                m_operationRejected = !probed && !missing;
+            }
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Write a file, retrying on transport failure (see doWriteFile()). The whole file is rewritten on each
+     *  attempt, so a failure after CONFIRM_WRITE_FILE has been sent is harmless.
+     *
+     *  Cancellation is checked between data blocks. A write abandoned before CONFIRM_WRITE_FILE leaves the
+     *  existing file contents in place.
+     */
+    bool ASDevice::writeFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw,
+        const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationWriteFile);
+
+        beginLimits(cancel, deadline);
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doWriteFile(buffer, size, applet, fileIndex, raw, true);
+        } while (retryOperation(result, &attempt, true));
+        endLimits();
+        return result;
+    }
+
+
+    /** Clear a file, retrying on transport failure (see doClearFile()). Clearing an existing file
+     *  (including its COMMIT) can safely be repeated.
+     */
+    bool ASDevice::clearFile(const ASApplet* applet, int fileIndex)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationClearFile);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doClearFile(applet, fileIndex);
+        } while (retryOperation(result, &attempt, true));
+        return result;
+    }
+
+
+    /** Clear a set of files, retrying on transport failure (see doClearFiles()). A retry restarts from
+     *  the first file that was not cleared.
+     */
+    bool ASDevice::clearFiles(const ASApplet* applet, const int* indices, unsigned count, unsigned* cleared)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationClearFile);
+
+        unsigned attempt = 0;
+        unsigned done = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            unsigned n;
+            result = doClearFiles(applet, indices + done, count - done, &n);
+            done += n;
+        } while (retryOperation(result, &attempt, true));
+        *cleared = done;
+        return result;
+    }
+
+
+    /** List the files owned by an applet, retrying on transport failure (see doListFiles()). Cancellation
+     *  is checked between files.
+     */
+    bool ASDevice::listFiles(const ASApplet* applet, AQContainer<ASFileAttributes>* files,
+        const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationListFiles);
+
+        beginLimits(cancel, deadline);
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doListFiles(applet, files);
+        } while (retryOperation(result, &attempt));
+        endLimits();
+        return result;
+    }
+
+
+    /** Read file attributes, retrying on transport failure (see doGetFileAttributes()).
+     */
+    bool ASDevice::getFileAttributes(ASFileAttributes* attr, const ASApplet* applet, int fileIndex)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationFileAttributes);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doGetFileAttributes(attr, applet, fileIndex);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Write file attributes, retrying on transport failure (see doSetFileAttributes()). Setting the
+     *  attributes of an existing file (including its COMMIT) can safely be repeated.
+     */
+    bool ASDevice::setFileAttributes(const ASApplet* applet, int fileIndex, const ASFileAttributes* attr)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationFileAttributes);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doSetFileAttributes(applet, fileIndex, attr);
+        } while (retryOperation(result, &attempt, true));
+        return result;
+    }
+
+
+    /** Read applet resource usage, retrying on transport failure (see doGetAppletResourceUsage()).
+     */
+    bool ASDevice::getAppletResourceUsage(unsigned* fc, unsigned* ram, const ASApplet* applet)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationResourceUsage);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doGetAppletResourceUsage(fc, ram, applet);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Read the OS version, retrying on transport failure (see doSystemVersion()).
+     */
+    bool ASDevice::systemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64])
+    {
+        ASDeviceLease lease(this, kASDeviceOperationSystemInfo);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doSystemVersion(major, minor, systemName, systemDate);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Read the free memory, retrying on transport failure (see doSystemMemory()).
+     */
+    bool ASDevice::systemMemory(unsigned* ram, unsigned* rom)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationSystemInfo);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doSystemMemory(ram, rom);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Read applet settings, retrying on transport failure (see doReadSettings()).
+     */
+    bool ASDevice::readSettings(void* buffer, unsigned* actual, unsigned size, const ASApplet* applet, unsigned flags)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationReadSettings);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doReadSettings(buffer, actual, size, applet, flags);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+    /** Read all applet settings, retrying on transport failure (see doReadAllSettings()).
+     */
+    bool ASDevice::readAllSettings(ASSettingsCollection* collection, unsigned flags)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationReadSettings);
+
+        unsigned attempt = 0;
+        bool result;
+        do
+        {
+            beginAttempt();
+            result = doReadAllSettings(collection, flags);
+        } while (retryOperation(result, &attempt));
+        return result;
+    }
+
+
+
+#pragma mark    --------  Raw access methods  --------
+
+
+
+
+
+    /** Read a block of applet headers.
+     *
+     *  @param  buffer      Byte buffer of length @e count * kASAppletHeaderSize.
+     *  @param  index       The index of the first header.
+     *  @param  count       The number of headers to try to read (max 7).
+     *  @param  actual      Returns the actual number of headers read.
+     *  @return             Logical true if the operation succeeded, false if an IO error occurred.
+     */
+    bool ASDevice::rawReadAppletHeaders(uint8_t* buffer, int index, unsigned count, unsigned* actual)
+    {
+        assert(count <= 7);     // Reading more than 7 headers will cause a crash on some Neos (1k buffer overflow?)
+
+        *actual = 0;
+        memset(buffer, 0, kASAppletHeaderSize * count);
+
+        if (count > 7) return false;    // Don't trash the Neo!
+
+        ASMessage message(ASMESSAGE_REQUEST_LIST_APPLETS);
+        message.setArgument((unsigned)index, 1, 4);
+        message.setArgument(count, 5, 2);
+        bool result = sendRequestAndCheckResponse(&message);
+        if (!result) return false;                              // Error handling command
+
+        unsigned size = message.argument(1, 4);
+        unsigned expectedChecksum = message.argument(5, 2);
+
+        if (size > (count * kASAppletHeaderSize))
+        {
+            fprintf(stderr, "%s: reply will return too much data!\n", __FUNCTION__);
+            return false;                                       // Unexpected data overrun
+        }
+
+        if (0 == size) return true;                             // no (more) applets present
+
+        unsigned actualBytes;
+        result = transferRead(buffer, size, &actualBytes);
+        if (result) m_protocolStatistics.dataReceived(actualBytes);
+        if (!result || actualBytes != size) return false;       // Unexpected read failure
+
+        if ((actualBytes % kASAppletHeaderSize) != 0)
+        {
+            fprintf(stderr, "%s: warning: read returned a partial header (expected header size %u, bytes read %u)\n",
+                __FUNCTION__, kASAppletHeaderSize, actualBytes);
+            assert(0);
+            // the partial header will be ignored rather than treated as an error (unless the checksum is also invalid)
+        }
+
+        unsigned actualChecksum = calculateDataChecksum(buffer, actualBytes);
+        if (actualChecksum != expectedChecksum)
+        {
+            fprintf(stderr, "%s: data checksum error\n", __FUNCTION__);
+            m_protocolStatistics.checksumFailure();
+            return false;
+        }
+
+        *actual = actualBytes / kASAppletHeaderSize;            // Return the actual number of headers read
+        return true;
+    }
+
+
+    /** Return the applet object for a specified index. If the applet list has not yet been enumerated
+     *  this far, header pages are read from the device until the index is reached.
+     */
+    const ASApplet* ASDevice::appletAtIndex(int appletIndex)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationEnumerateApplets);
+
+        if (appletIndex < 0) return 0;
+
+        while ((unsigned)appletIndex >= m_applets.count() && !m_appletsComplete)
+        {
+            if (!enumerateAppletPage()) break;
+        }
+        return m_applets.itemAtIndex((unsigned)appletIndex);
+    }
+
+
+    /** Return the applet object for a specified applet ID. If the applet is not in the part of the list
+     *  enumerated so far, header pages are read from the device until it is found or the list is complete.
+     */
+    const ASApplet* ASDevice::appletForID(ASAppletID appletID)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationEnumerateApplets);
+
+        unsigned index = 0;
+        while (true)
+        {
+            const ASApplet* applet;
+            while ((applet = m_applets.itemAtIndex(index)))
+            {
+                if (applet->appletID() == appletID) return applet;
+                ++ index;
+            }
+
+            if (m_appletsComplete || !enumerateAppletPage()) break;
+        }
+        return 0;
+    }
+
+
+    /** Read the image of an applet from the device. The image is streamed to a sink one block at
+     *  a time, so it is never held in memory as a whole. The data can be parsed with ASApplet::loadApplet()
+     *  (or ASApplet::loadOS() for the system applet).
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x0f    ASMESSAGE_REQUEST_READ_APPLET
+     *      IN:     0x53    ASMESSAGE_RESPONSE_READ_FILE
+     *      then the block read sequence (see readExtendedData())
+     *
+     *  @param  sink        The data sink (use ASDevice::fileSink with a FILE* context to write to a file).
+     *  @param  context     Context passed to the sink.
+     *  @param  applet      The applet to read.
+     *  @param  actual      Returns the number of bytes delivered to the sink.
+     *  @return             Logical true if the complete image was read.
+     */
+    bool ASDevice::readApplet(ASDeviceDataSink sink, void* context, const ASApplet* applet, unsigned* actual,
+        const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationReadApplet);
+
+        *actual = 0;
+
+        beginLimits(cancel, deadline);
+        bool result = dialogueStart();
+        if (!result)
+        {
+            endLimits();
+            return false;
+        }
+
+        ASMessage message;
+        message.init(ASMESSAGE_REQUEST_READ_APPLET);
+        message.setArgument(applet->appletID(), 5, 2);
+        result = sendRequestAndGetResponse(&message);
+        if (result && ASMESSAGE_RESPONSE_READ_FILE != message.command())
+        {
+            // REVIEW: the response code is assumed to match READ_FILE (length32) - other responses are treated as errors
+            fprintf(stderr, "%s: unexpected response %02x\n", __FUNCTION__, message.command());
+            result = false;
+        }
+        if (result)
+        {
+            unsigned expected = message.argument(1, 4);
+            result = readExtendedData(sink, context, kASBlockReadUnbounded, actual);
+            if (result && expected != *actual)
+            {
+                fprintf(stderr, "%s: warning: expected %u bytes, read %u\n", __FUNCTION__, expected, *actual);
+            }
+        }
+
+        result = dialogueEnd(result);
+        endLimits();
+        return result;
+    }
+
+
+    /** Write an applet image to the device. The image must have been loaded with ASApplet::loadApplet().
+     *  The applet list held by this object is not updated - the device should be re-enumerated (for
+     *  example, by reconnecting) before the new applet is used.
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x06    ASMESSAGE_REQUEST_WRITE_APPLET
+     *      IN:     0x46    ASMESSAGE_RESPONSE_WRITE_APPLET
+     *      then the block write sequence (see writeExtendedData())
+     *      OUT:    0x0b    ASMESSAGE_REQUEST_0B
+     *      IN:     0x47    ASMESSAGE_RESPONSE_47
+     *      OUT:    0x07    ASMESSAGE_REQUEST_07
+     *      IN:     0x48    ASMESSAGE_RESPONSE_48
+     *
+     *  REVIEW: the purpose of requests 0x0b and 0x07 is not known, and the order used here is a best guess
+     *  from the response codes noted in ASMessage.h. Requests 0x16/0x17 and SMALL_ROM_UPDATER appear to be
+     *  related to OS updates and are not used.
+     *
+     *  Until the sequence is confirmed, this fails unless enabled with setAppletWriteEnabled(). The image is
+     *  written in kASWriteBlockSizeMin blocks (see writeExtendedData()), and the watchdog is not used: the
+     *  time taken to program the flash is not known, and an aborted transfer part way through could leave
+     *  the device unusable.
+     *
+     *  @param  image       The applet image.
+     *  @return             Logical true if the applet was written.
+     */
+    bool ASDevice::writeApplet(const ASApplet* image)
+    {
+        ASDeviceLease lease(this, kASDeviceOperationWriteApplet);
+
+        if (!image->isAppletLoaded()) return false;
+        if (!s_appletWriteEnabled)
+        {
+            fprintf(stderr, "%s: applet installation is not enabled\n", __FUNCTION__);
+            return false;
+        }
+
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        m_watchdogDisabled = true;
+
+        unsigned ram;
+        unsigned rom;
+        result = rawGetAvailableSpace(&ram, &rom);
+        if (result && image->appletDataSize() > rom)
+        {
+            fprintf(stderr, "%s: insufficient space for applet (need %u, free %u)\n", __FUNCTION__, image->appletDataSize(), rom);
+            result = false;
+        }
+
+        ASMessage message;
+        if (result)
+        {
+            message.init(ASMESSAGE_REQUEST_WRITE_APPLET);
+            message.setArgument(image->appletDataSize(), 1, 4);
+            result = sendRequestAndCheckResponse(&message);
+        }
+        if (result) result = writeExtendedData(image->appletData(), image->appletDataSize());
+        if (result)
+        {
+            message.init(ASMESSAGE_REQUEST_0B);
+            result = sendRequestAndCheckResponse(&message);
+        }
+        if (result)
+        {
+            message.init(ASMESSAGE_REQUEST_07);
+            result = sendRequestAndCheckResponse(&message);
+        }
+
+        m_watchdogDisabled = false;
+        invalidateMemoryAccounting();
+        return dialogueEnd(result);
+    }
+
+
+    /** Read the attributes of every file owned by an applet, in a single dialogue.
+     *
+     *  @param  applet      The applet.
+     *  @param  files       Container to receive the attributes, in file index order (the first entry is
+     *                      file index 1). Any existing entries are left in place. The caller is responsible
+     *                      for deleting the objects added.
+     *  @return             Logical true if the request succeeded. False is returned if the applet reports
+     *                      more files than can be addressed (see kASDeviceMaxFileIndex).
+     */
+    bool ASDevice::doListFiles(const ASApplet* applet, AQContainer<ASFileAttributes>* files)
+    {
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        unsigned initialCount = files->count();
+        for (int fileIndex = 1; result; fileIndex++)
+        {
+            if (fileIndex > kASDeviceMaxFileIndex)
+            {
+                fprintf(stderr, "%s: applet %04x has more than %u files\n", __FUNCTION__, applet->appletID(), kASDeviceMaxFileIndex);
+                m_operationRejected = true;
+                result = false;
+                break;
+            }
+
+            uint8_t abuffer[kASFileAttributesSize];
+            unsigned actual;
+            result = checkLimits() && rawGetFileAttributes(abuffer, applet->appletID(), fileIndex, &actual);
+            if (!result || 0 == actual) break;          // No more files.
+            files->appendItem(new ASFileAttributes(abuffer));
+        }
+
+        if (!result)
+        {
+            // Discard partial results so that a retry starts cleanly
+            while (files->count() > initialCount)
+            {
+                unsigned last = files->count() - 1;
+                delete files->itemAtIndex(last);
+                files->removeItemAtIndex(last);
+            }
+        }
+
+        return dialogueEnd(result);
+    }
+
+
+    /** Return the file attributes for a given applet and file index.
+     */
+    bool ASDevice::doGetFileAttributes(ASFileAttributes* attr, const ASApplet* applet, int fileIndex)
+    {
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        uint8_t abuffer[kASFileAttributesSize];
+        unsigned actual;
+
+        result = rawGetFileAttributes(abuffer, applet->appletID(), fileIndex++, &actual);
+        if (result)
+        {
+            if (actual == 0)
+            {
+                m_operationRejected = true;
+                result = false;         // No such file.
+            }
+            else
+            {
+                attr->copyFrom(abuffer);
+            }
+        }
+
+        return dialogueEnd(result);
+    }
+
+
+    /** Set file attributes.
+     *
+     *  @param  attr        The attributes to set.
+     *  @param  applet      The applet.
+     *  @param  fileIndex   The file number.
+     *  @return             Logical true if there was no error.
+     */
+    bool ASDevice::doSetFileAttributes(const ASApplet* applet, int fileIndex, const ASFileAttributes* attr)
+    {
+        m_operationRejected = true;
+        if (0 == strlen(attr->fileName())) return false;        // zero length filenames will cause the Neo to crash
+        if (0 == strlen(attr->password())) return false;        // presumably zero length passwords are also bad...
+        m_operationRejected = false;
+
+        if (!dialogueStart()) return false;
+        bool result = rawSetFileAttributes(attr->rawData(), applet->appletID(), fileIndex);
+        if (result)
+        {
+            ASMessage message;
+            message.init(ASMESSAGE_REQUEST_COMMIT);         // Sending this message appears to bind the attributes to a new
+            message.setArgument((unsigned)fileIndex, 4, 1); // file - not sending it will still result in a new file, but
+            message.setArgument(applet->appletID(), 5, 2);  // the attributes will not be correct.
+            result = sendRequestAndGetResponse(&message);
+            result = (result && ASMESSAGE_RESPONSE_COMMIT == message.command());
+        }
+        return dialogueEnd(result);
+    }
+
+
+
+    /** Find the resources currently being used by an applet.
+     *
+     *  @param  fc          Returns the number of files used.
+     *  @param  ram         Returns the amount of RAM used by the applet in bytes.
+     *  @param  applet      The applet.
+     *  @return             Logical true if the request succeeded.
+     */
+    bool ASDevice::doGetAppletResourceUsage(unsigned* fc, unsigned* ram, const ASApplet* applet)
+    {
+        *fc = 0;
+        *ram = 0;
+
+        if (!dialogueStart()) return false;
+        bool result = rawGetUsedSpace(fc, ram, applet->appletID());
+        return dialogueEnd(result);
+    }
+
+
+
+    /** Ping the device for the ASM protocol version number. This will put the Neo in
+     *  to ASM mode and also return the protocol version. It is also used as a keep-alive
+     *  test.
+     */
+    bool ASDevice::hello()
+    {
+        static const uint8_t ascCommandRequestProtocol[1] = { 0x01 };
+        uint8_t buffer[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        unsigned actual = 0;
+        unsigned version = 0;
+        unsigned retry = 10;
+
+        bool ok = transferWrite(ascCommandRequestProtocol, 1, 100)  &&  transferRead(buffer, 8, &actual, 100);
+        while (!ok || actual != 2)
+        {
+            m_protocolStatistics.stall();
+            fprintf(stderr, "%s: unexpected %u byte response: ", __FUNCTION__, actual);
+            for (unsigned i = 0; i < actual; i++) fprintf(stderr, " %02x", buffer[i]);
+            fprintf(stderr, "\n");
+
+            retry --;
+            if (0 == retry)
+            {
+                fprintf(stderr, "%s: this device doesn't look like it wants to talk to us - bailing out.\n", __FUNCTION__);
+                return false;
+            }
+
+            reset();        // try to issue a protocol reset
+            usleep(100000); // give the device a little time to see and handle the reset
+            ok = transferWrite(ascCommandRequestProtocol, 1, 100)  &&  transferRead(buffer, 8, &actual, 100);
+        }
+
+        version = ((unsigned)buffer[0] << 8) | ((unsigned)buffer[1] << 0);
+        if (version < kASMProtocolVersion)
+        {
+            fprintf(stderr, "%s: ASM protocol version not supported: %0x04x\n", __FUNCTION__, version);
+            ok = false;
+        }
+
+        return ok;
+    }
+
+
+
+    /** Reset the device to a known state.
+     *
+     *  @return Logical true if the device is supported and working correctly.
+     */
+    bool ASDevice::reset()
+    {
+        static const uint8_t ascCommandRequestReset[8] = { 0x3f, 0xff, 0x00, 0x72, 0x65, 0x73, 0x65, 0x74 };
+
+
+        // Send a reset command
+        bool ok = transferWrite(ascCommandRequestReset, sizeof ascCommandRequestReset);
+        if (!ok)
+        {
+            fprintf(stderr, "%s: Failed to send reset command to Neo.\n", __FUNCTION__);
+        }
+        return ok;
+    }
+
+
+    /** Switch communication to a specific applet.
+     *
+     *  @return Logical true if the device is supported and working correctly.
+     */
+    bool ASDevice::switchApplet(ASAppletID applet)
+    {
+        static const uint8_t ascCommandRequestSwitch[8] = { 0x3f, 0x53, 0x77, 0x74, 0x63, 0x68, 0x00, 0x00 };
+        static const uint8_t ascCommandResponseSwitched[8] = { 0x53, 0x77, 0x69, 0x74, 0x63, 0x68, 0x65, 0x64 };
+        uint8_t buffer[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        bool ok;
+
+        memcpy(buffer, ascCommandRequestSwitch, sizeof buffer);
+        buffer[6] = (applet >> 8) & 0xff;
+        buffer[7] = (applet >> 0) & 0xff;
+        ok = transferWrite(buffer, sizeof buffer) && transferRead(buffer, sizeof buffer);
+        if (!ok)
+        {
+            fprintf(stderr, "%s: failed to send switch command to device\n", __FUNCTION__);
+            return ok;
+        }
+
+        ok = (0 == memcmp(buffer, ascCommandResponseSwitched, 8));
+        if (!ok)
+        {
+            fprintf(stderr, "%s: failed to switch to applet %04x:  ", __FUNCTION__, applet);
+            for (unsigned i = 0; i < 8; i++) fprintf(stderr, "%c", isprint(buffer[i]) ? buffer[i] : '.');
+            fprintf(stderr, "\n");
+        }
+
+        return ok;
+    }
+
+
+
+    /** Return the watchdog limit for an exchange.
+     *
+     *  @param  command     The request code.
+     *  @return             The time allowed for each transfer in the exchange, in ms, or zero for no limit.
+     */
+    unsigned ASDevice::watchdogLimit(unsigned command)
+    {
+        switch (command)
+        {
+            case ASMESSAGE_REQUEST_WRITE_APPLET:
+            case ASMESSAGE_REQUEST_0B:
+            case ASMESSAGE_REQUEST_07:
+            case ASMESSAGE_REQUEST_ERASE_APPLETS:
+                return 0;                       // flash operations: the time taken is not known
+
+            default:
+                break;
+        }
+        return (kASMessageRetrySafe == ASMessage::retryClass(command)) ? kASWatchdogDefaultLimit : kASWatchdogSlowLimit;
+    }
+
+
+    /** Read from the device with the watchdog armed for the current exchange (see watchdogLimit()). The
+     *  watchdog is disarmed again as soon as the transfer completes, so time spent processing the data
+     *  is not counted against the device.
+     */
+    bool ASDevice::transferRead(void* buffer, unsigned length, unsigned* actual, unsigned timeout)
+    {
+        if (0 != m_watchdogLimit) ASDeviceWatchdog::sharedWatchdog()->arm(this, m_watchdogLimit);
+        bool result = read(buffer, length, actual, timeout);
+        if (0 != m_watchdogLimit) ASDeviceWatchdog::sharedWatchdog()->disarm(this);
+        return result;
+    }
+
+
+    /** Write to the device with the watchdog armed for the current exchange (see transferRead()).
+     */
+    bool ASDevice::transferWrite(const void* buffer, unsigned length, unsigned timeout)
+    {
+        if (0 != m_watchdogLimit) ASDeviceWatchdog::sharedWatchdog()->arm(this, m_watchdogLimit);
+        bool result = write(buffer, length, timeout);
+        if (0 != m_watchdogLimit) ASDeviceWatchdog::sharedWatchdog()->disarm(this);
+        return result;
+    }
+
+
+    /** Send a command.
+     *
+     *  @param  request     The command message.
+     *  @return             Logical true if the message was sent.
+     */
+    bool ASDevice::sendRequest(const ASMessage* request)
+    {
+        unsigned retryClass = ASMessage::retryClass(request->command());
+        if (kASMessageRetryUnsafe == retryClass) m_unsafeRequestSent = true;
+        m_watchdogLimit = (m_watchdogDisabled) ? 0 : watchdogLimit(request->command());
+
+        m_protocolStatistics.requestSent(request->command(), request->rawSize());
+        bool result = transferWrite(request->rawData(), request->rawSize(), transferTimeout());
+        if (!result)
+        {
+            fprintf(stderr, "%s: error sending to device\n", __FUNCTION__);
+            m_protocolStatistics.stall();
+        }
+        return result;
+    }
+
+
+    /** Get a response to a command.
+     *
+     *  @param  response    Message to receive the response.
+     *  @return             Logical true if the operation completed.
+     */
+    bool ASDevice::getResponse(ASMessage* response)
+    {
+        bool result = transferRead(response->rawData(), response->rawSize(), 0, transferTimeout());
+        if (result) m_protocolStatistics.responseReceived(response->rawSize());
+        else m_protocolStatistics.stall();
+
+        if (!result) fprintf(stderr, "%s: error reading from device\n", __FUNCTION__);
+        else if (ASMessage::isErrorCode(response->command())) m_operationRejected = true;
+        return result;
+    }
+
+
+    /** Send a message and get the response.
+     *
+     *  @param  message     On entry, holds the command message to send. On return, contains the reply.
+     *  @return             Logical true if the operation completed successfully.
+     */
+    bool ASDevice::sendRequestAndGetResponse(ASMessage* message)
+    {
+        return sendRequest(message) && getResponse(message);
+    }
+
+
+    /** Send a message and get the response, checking for an explicit response code. If the response
+     *  code is not matched and error will be returned.
+     *
+     *  @param  message     On entry, holds the command message to send. On return, contains the reply.
+     *  @param  code        The message code to validate.
+     *  @return             Logical true if the operation completed successfully.
+     */
+    bool ASDevice::sendRequestAndGetResponse(ASMessage* message, unsigned code)
+    {
+        unsigned sendCode = message->command();
+        bool result = sendRequest(message) && getResponse(message);
+        if (result && (code != message->command()))
+        {
+            fprintf(stderr, "%s: unexpected message response: send %02x (%s), received %02x (%s), expected %02x\n", __FUNCTION__,
+                sendCode, ASMessage::name(sendCode), message->command(), ASMessage::name(message->command()), code);
+            result = false;
+        }
+        return result;
+    }
+
+
+    /** Send a message and get the response, checking that the response is the one listed for the request
+     *  in the message descriptor table (see ASMessage::descriptor()).
+     *
+     *  @param  message     On entry, holds the command message to send. On return, contains the reply.
+     *  @return             Logical true if the operation completed successfully.
+     */
+    bool ASDevice::sendRequestAndCheckResponse(ASMessage* message)
+    {
+        unsigned code = ASMessage::expectedResponse(message->command());
+        assert(kASMessageResponseUnknown != code);
+        return sendRequestAndGetResponse(message, code);
+    }
+
+
+
+    /** Calculate a data checksum from a block of data.
+     *
+     *  @param  data        The data to checksum.
+     *  @param  length      The number of bytes present.
+     *  @return             The checksum.
+     */
+    unsigned ASDevice::calculateDataChecksum(const void* data, unsigned length) const
+    {
+        const uint8_t* ptr = (const uint8_t*) data;
+        const uint8_t* end = ptr + length;
+
+        unsigned result = 0;
+        while (ptr != end)
+        {
+            result += ((unsigned)(*ptr++)) & 0xff;
+        }
+
+        return result & 0xffff;
+    }
+
+
+
+    /** Context used by readExtendedData() to collect data in to a caller supplied buffer.
+     */
+    struct ASDeviceBufferSink
+    {
+        uint8_t* ptr;                           /**< Where to put the next byte. */
+        unsigned remaining;                     /**< The number of bytes of space left. */
+    };
+
+
+    /** Sink used by readExtendedData().
+     */
+    static bool bufferSink(void* context, const void* data, unsigned size)
+    {
+        ASDeviceBufferSink* buffer = (ASDeviceBufferSink*)context;
+        if (size > buffer->remaining)
+        {
+            fprintf(stderr, "%s: device returned more data than expected\n", __FUNCTION__);
+            return false;
+        }
+        memcpy(buffer->ptr, data, size);
+        buffer->ptr += size;
+        buffer->remaining -= size;
+        return true;
+    }
+
+
+    /** Sink that writes data to a stdio file. The context must be the FILE pointer.
+     */
+    bool ASDevice::fileSink(void* context, const void* data, unsigned size)
+    {
+        return (size == fwrite(data, 1, size, (FILE*)context));
+    }
+
+
+    /** Read binary data blocks in response to some other command, handling segmentation
+     *  and checksum validation.
+     *
+     *  @param  dest        Where to put the data.
+     *  @param  size        The number of bytes that are expected to be delivered.
+     *  @param  actual      Used to return the number of bytes actually read.
+     *  @return             Logical true if the data was read successfully.
+     */
+    bool ASDevice::readExtendedData(void* dest, unsigned size, unsigned* actual)
+    {
+        ASDeviceBufferSink buffer;
+        buffer.ptr = (uint8_t*)dest;
+        buffer.remaining = size;
+        return readExtendedData(bufferSink, &buffer, size, actual);
+    }
+
+
+    /** Read binary data blocks in response to some other command, handling segmentation
+     *  and checksum validation. Each block is passed to a sink as soon as it has been read
+     *  and validated, so the transfer is never buffered as a whole.
+     *
+     *  The command sequence is:
+     *
+     *      While data left to read (or until the device returns ASMESSAGE_RESPONSE_BLOCK_READ_EMPTY)
+     *          OUT:    0x10    ASMESSAGE_REQUEST_BLOCK_READ
+     *          IN:     0x4d    ASMESSAGE_RESPONSE_BLOCK_READ
+     *          OUT:    data
+     *
+     *  Blocks are normally no more than 1k. If the device returns a block larger than the local
+     *  buffer, it is passed to the sink in pieces and the checksum is only verified once the last
+     *  piece has been delivered - in that case a false return means that the sink has seen bad data.
+     *
+     *  With pipelining enabled (see setPipelinedReads()), the request for the next block is sent as
+     *  soon as the response for the current block arrives, before its data is read, verified and passed
+     *  to the sink. This hides the request latency behind the data transfer. No request is sent once the
+     *  expected number of bytes has been seen. If the transfer ends early
+     *  with a request outstanding, the rest of the current block and then the response to the outstanding
+     *  request are drained so the device can be reset cleanly. Any device error during a pipelined read
+     *  disables pipelining for the device and its OS version, and the read fails so that the caller's
+     *  retry (if any) uses the unpipelined sequence.
+     *
+     *  @param  sink        The data sink.
+     *  @param  context     Context passed to the sink.
+     *  @param  size        The number of bytes that are expected to be delivered, or kASBlockReadUnbounded
+     *                      to read until the device reports that there is no more data.
+     *  @param  actual      Used to return the number of bytes actually read.
+     *  @return             Logical true if the data was read successfully.
+     */
+    bool ASDevice::readExtendedData(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual)
+    {
+        uint8_t block[kASBlockReadBufferSize];
+        unsigned bytesread = 0;
+        unsigned blocks = 0;
+        bool ok = true;
+        bool deviceFault = false;               // failure attributable to the device rather than the sink or a cancel
+        bool pipelined = m_pipelineRequested && !m_pipelineFailed;
+        bool requestSent = false;               // a request has been sent whose response has not been read
+        double start = currentTime();
+
+        static const uint8_t ascCommandRequestBlockRead[8] = ASMESSAGE_FRAME(ASMESSAGE_REQUEST_BLOCK_READ, 0, 0, 0, 0, 0, 0);
+        const ASMessage request(ascCommandRequestBlockRead);
+        ASMessage response;
+
+        unsigned remaining = size;
+        while (remaining > 0)
+        {
+            if (!checkLimits())
+            {
+                ok = false;
+                break;
+            }
+
+            if (!requestSent && !sendRequest(&request))
+            {
+                fprintf(stderr, "Error sending commands\n");
+                ok = false;
+                deviceFault = true;
+                break;
+            }
+            requestSent = false;
+
+            if (!getResponse(&response))
+            {
+                fprintf(stderr, "Error sending commands\n");
+                ok = false;
+                deviceFault = true;
+                break;
+            }
+            else if (response.command() == ASMESSAGE_RESPONSE_BLOCK_READ_EMPTY)
+            {
+                // No more data to return
+                break;
+            }
+            else if (response.command() == ASMESSAGE_RESPONSE_BLOCK_READ)
+            {
+                unsigned blocksize = response.argument(1, 4);
+                unsigned checksum = response.argument(5, 2);
+                unsigned sum = 0;
+                unsigned offset = 0;
+
+                if (blocksize > remaining)
+                {
+                    fprintf(stderr, "%s: device returned more data than expected\n", __FUNCTION__);
+                    ok = false;
+                    deviceFault = true;
+                    break;
+                }
+                if (size != kASBlockReadUnbounded) remaining -= blocksize;
+
+                if (pipelined && remaining > 0)
+                {
+                    requestSent = sendRequest(&request);
+                    if (!requestSent)
+                    {
+                        ok = false;
+                        deviceFault = true;
+                        break;
+                    }
+                }
+
+                while (ok && offset < blocksize)
+                {
+                    unsigned chunk = blocksize - offset;
+                    if (chunk > sizeof block) chunk = sizeof block;
+                    ok = transferRead(block, chunk, 0, transferTimeout());
+                    if (!ok)
+                    {
+                        fprintf(stderr, "%s: error reading data\n", __FUNCTION__);
+                        m_protocolStatistics.stall();
+                        deviceFault = true;
+                        break;
+                    }
+                    m_protocolStatistics.dataReceived(chunk);
+                    sum += calculateDataChecksum(block, chunk);
+                    offset += chunk;
+
+                    if (offset == blocksize && (sum & 0xffff) != checksum)
+                    {
+                        fprintf(stderr, "%s: bad checksum: expected %04x, got %04x\n", __FUNCTION__, checksum, sum & 0xffff);
+                        m_protocolStatistics.checksumFailure();
+                        ok = false;
+                        deviceFault = true;
+                        break;
+                    }
+
+                    ok = sink(context, block, chunk);
+                    if (ok) bytesread += chunk;
+                    else if (requestSent && offset < blocksize && !discardData(blocksize - offset)) requestSent = false;
+                }
+                if (!ok) break;
+                blocks ++;
+            }
+            else
+            {
+                fprintf(stderr, "%s: unexpected response\n", __FUNCTION__);
+                ok = false;
+                deviceFault = true;
+                break;
+            }
+        }
+
+        if (requestSent) drainBlockRead();
+        if (!ok && pipelined && deviceFault) pipelineFailed();
+
+        if (ok)
+        {
+            ASDeviceReadStatistics* stats = &m_readStatistics[(pipelined) ? 1 : 0];
+            stats->blocks += blocks;
+            stats->bytes += bytesread;
+            stats->seconds += currentTime() - start;
+        }
+
+        if (actual) *actual = bytesread;
+
+        if (!ok) fprintf(stderr, "%s: error. last request %02x, response %02x\n", __FUNCTION__, request.command(), response.command());
+        return ok;
+    }
+
+
+
+
+
+
+    /** Write a block of binary data in response to a command.
+     *
+     *  This manages the following sequence of commands:
+     *
+     *      While data left to send:
+     *          OUT:    0x02    ASMESSAGE_REQUEST_BLOCK_WRITE
+     *          IN:     0x42    ASMESSAGE_RESPONSE_BLOCK_WRITE
+     *          OUT:    data
+     *          IN:     0x43    ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE
+     *
+     *  Every device accepts 1k blocks, and these are used unless adaptive sizing has been enabled for the
+     *  device (see setWriteBlockProbing()) and is allowed by the caller. Larger blocks reduce the number of
+     *  handshakes. The block size is then found by probing: each transfer tries double the largest size known
+     *  to work (see nextWriteBlockSize()). If the device refuses the larger block in its response to the
+     *  request, no data has been sent and the block is simply re-requested at the known good size. If the
+     *  larger block is accepted but the data transfer then fails, the size is marked as unusable and the
+     *  transfer fails, so that a retry of the operation uses the smaller size.
+     *
+     *  Probing is off by default because it has not been confirmed that a refused BLOCK_WRITE request leaves
+     *  the device waiting for another block request (as it does after a completed block), and some units are
+     *  thought to have only 1k of buffer. It is never used for file creation or applet installation, where
+     *  a failed transfer cannot simply be repeated.
+     *
+     *  @param  dest        The data.
+     *  @param  size        The number of bytes that are to be written.
+     *  @param  adaptive    Logical true to use (and probe) the adaptive block size if enabled for the
+     *                      device, false to always use kASWriteBlockSizeMin blocks.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::writeExtendedData(const void* source, unsigned size, bool adaptive)
+    {
+        ASMessage request;
+        ASMessage response;
+
+        unsigned remaining = size;
+        const uint8_t* ptr = (const uint8_t*) source;
+        unsigned blockLimit = (adaptive && m_writeBlockProbing) ? nextWriteBlockSize() : kASWriteBlockSizeMin;
+
+        while (remaining > 0)
+        {
+            if (!checkLimits()) goto error;
+
+            unsigned blocksize = (remaining < blockLimit) ? remaining : blockLimit;
+            bool probing = (blocksize > m_writeBlockSize);
+            double start = currentTime();
+            unsigned checksum = calculateDataChecksum(ptr, blocksize);
+            request.init(ASMESSAGE_REQUEST_BLOCK_WRITE);
+            request.setArgument(blocksize, 1, 4);
+            request.setArgument(checksum, 5, 2);
+            if (!sendRequest(&request)) goto error;
+            if (!getResponse(&response)) goto error;
+            if (ASMESSAGE_RESPONSE_BLOCK_WRITE != response.command())
+            {
+                if (!probing) goto error;
+                writeBlockRejected(blockLimit);
+                m_operationRejected = false;
+                blockLimit = m_writeBlockSize;
+                continue;
+            }
+            bool written = transferWrite(ptr, blocksize, transferTimeout());
+            if (written) m_protocolStatistics.dataSent(blocksize);
+            else m_protocolStatistics.stall();
+            if (!written || !getResponse(&response) || ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE != response.command())
+            {
+                if (probing)
+                {
+                    writeBlockRejected(blockLimit);
+                    m_operationRejected = false;
+                }
+                goto error;
+            }
+            if (probing && blocksize == blockLimit) writeBlockAccepted(blocksize);
+            recordWriteBlock(blockLimit, blocksize, currentTime() - start);
+
+            remaining -= blocksize;
+            ptr += blocksize;
+        }
+
+        return true;
+
+    error:
+
+        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
+        return 0;
+    }
+
+
+
+    #pragma mark    ---------------- Public API providing access to the protocol ----------------
+
+
+
+    /** Send a restart request to the Neo. The should cause the Neo to reset and revert back to its HID state.
+     *
+     *  @return     Logical true if the request completed successfully.
+     */
+    bool ASDevice::restart()
+    {
+        ASDeviceLease lease(this, kASDeviceOperationRestart);
+
+        bool result = dialogueStart();
+        if (!result) return result;
+
+        ASMessage message(ASMESSAGE_REQUEST_RESTART);
+        result = (sendRequestAndGetResponse(&message), ASMESSAGE_RESPONSE_RESTART);
+
+        return dialogueEnd(result);
+    }
+
+
+    /** Obtain the OS version information.
+     *
+     *  @param  major       Returns the OS major version number.
+     *  @param  minor       Returns the OS minor version number.
+     *  @param  systemName  The build system name.
+     *  @param  systemDate  The build system date.
+     *  @return             Logical true if the request was successful.
+     *
+     *  @bug    Later UK Neo systems appear to report 3.6 on the device but 3.4 in response to this command.
+     *          There also appear to be additional non-zero bytes at the end of the version information
+     *          and the checksum is wrong by one.
+     */
+    bool ASDevice::doSystemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64])
+    {
+        *major = 0;
+        *minor = 0;
+        systemName[0] = 0;
+        systemDate[0] = 0;
+
+        if (!dialogueStart()) return false;
+        bool result = rawSystemVersion(major, minor, systemName, systemDate);
+        return dialogueEnd(result);
+    }
+
+
+    /** Query the remaining memory on the system.
+     *
+     *  @param  ram     Returns the free RAM space.
+     *  @param  rom     Returns the free ROM space.
+     *  @return         Logical true unless there was an IO error.
+     */
+    bool ASDevice::doSystemMemory(unsigned* ram, unsigned* rom)
+    {
+        *ram = 0;
+        *rom = 0;
+
+        if (!dialogueStart()) return false;
+        bool result = rawGetAvailableSpace(ram, rom);
+        return dialogueEnd(result);
+    }
+
+
+
+
+
+
+    /** Initialise a new file.
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x1e    ASMESSAGE_REQUEST_COMMIT
+     *      IN:     0x5c    ASMESSAGE_RESPONSE_COMMIT
+     *
+     *  @param  index       The file number.
+     *  @param  applet      The applet ID.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::rawCreateFile(ASAppletID applet, int index)
+    {
+        bool result = dialogueStart();
+        if (!result) return false;
+
+        ASMessage message(ASMESSAGE_REQUEST_COMMIT);
+        message.setArgument((unsigned)index, 4, 1);
+        message.setArgument(applet, 5, 2);
+        result = sendRequestAndCheckResponse(&message);
+
+        return dialogueEnd(result);
+    }
+
+
+
+
+
+    /** Read the file information (attributes).
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x13    ASMESSAGE_REQUEST_GET_FILE_ATTRIBUTES
+     *      IN:     0x5a    ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES
+     *      IN:     data
+     *
+     *  @param  attr        Returns the file attribute data.
+     *  @param  applet      The applet ID.
+     *  @param  index       The file number.
+     *  @param  actual      The actual number of headers read (either zero or one). If zero, no header
+     *                      exists.
+     *  @return             Logical true if all ok, or false if an IO error occurred.
+     */
+    bool ASDevice::rawGetFileAttributes(uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index, unsigned* actual)
+    {
+        assert(index < 256);
+
+        *actual = 0;
+        memset(attr, 0, kASFileAttributesSize);
+
+        ASMessage message;
+        message.init(ASMESSAGE_REQUEST_GET_FILE_ATTRIBUTES);
+        message.setArgument((unsigned)index, 4, 1);
+        message.setArgument(applet, 5, 2);
+        bool result = sendRequestAndGetResponse(&message);
+        if (!result) return false;
+
+        if (ASMESSAGE_ERROR_PARAMETER == message.command())
+        {
+            // Entry not found. This probably just means that the iteration has exceeded the number of files available.
+            return true;
+        }
+
+        if (ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES != message.command())
+        {
+            fprintf(stderr, "%s: unexpected response:", __FUNCTION__);
+            message.dump(stderr);
+            fprintf(stderr, "\n");
+            return false;
+        }
+
+        unsigned length = message.argument(1, 4);
+        unsigned checksum = message.argument(5, 2);
+
+        if (length != kASFileAttributesSize)
+        {
+            fprintf(stderr, "%s: unexpected size %d for attribute data.\n", __FUNCTION__, length);
+            return false;
+        }
+
+        if (!transferRead(attr, kASFileAttributesSize))
+        {
+            fprintf(stderr, "%s: unexpected error reading attribute data.\n", __FUNCTION__);
+            m_protocolStatistics.stall();
+            return false;
+        }
+        m_protocolStatistics.dataReceived(kASFileAttributesSize);
+
+        unsigned actualChecksum = calculateDataChecksum(attr, kASFileAttributesSize);
+        if (!(actualChecksum == checksum))
+        {
+            fprintf(stderr, "%s: data checksum error: wanted %04x, got %04x.\n", __FUNCTION__, actualChecksum, checksum);
+            m_protocolStatistics.checksumFailure();
+            return false;
+        }
+
+        *actual = 1;        // If here, we managed to successfully read the attributes
+        return true;
+    }
+
+
+
+    /** Set the file information (attributes).
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x1d    ASMESSAGE_REQUEST_SET_FILE_ATTRIBUTES
+     *      IN:     0x5b    ASMESSAGE_RESPONSE_SET_FILE_ATTRIBUTES
+     *      OUT:    0x02    ASMESSAGE_REQUEST_BLOCK_WRITE
+     *      IN:     0x42    ASMESSAGE_RESPONSE_BLOCK_WRITE
+     *      OUT:    data
+     *      IN:     0x43    ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE
+     *
+     *  @param  attr        The attribute data to be written.
+     *  @param  applet      The applet ID.
+     *  @param  index       The file number.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::rawSetFileAttributes(const uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index)
+    {
+        assert(index < 256);
+
+        ASMessage message;
+
+        message.init(ASMESSAGE_REQUEST_SET_FILE_ATTRIBUTES);
+        message.setArgument((unsigned)index, 1, 4);
+        message.setArgument(applet, 5, 2);
+
+        bool result = sendRequestAndCheckResponse(&message);
+        if (!result)
+        {
+            fprintf(stderr, "%s: unexpected response: ", __FUNCTION__);
+            message.dump(stderr);
+            fprintf(stderr, "\n");
+        }
+        else
+        {
+            result = writeExtendedData(attr, kASFileAttributesSize);
+        }
+
+        return result;
+    }
+
+
+
+    /** Read a file.
+     *
+     *  Transfer sequence:
+     *
+     *      OUT:    0x12|0x1c   ASMESSAGE_REQUEST_READ_FILE | ASMESSAGE_REQUEST_READ_RAW_FILE
+     *      IN:     0x53        ASMESSAGE_RESPONSE_READ_FILE
+     *      [block read sequence]
+     *
+     *  @param  dest        Where to put the data.
+     *  @param  size        The maximum number of bytes to read.
+     *  @param  actual      Used to return the actual number of bytes read.
+     *  @param  applet      The applet ID.
+     *  @param  index       The file number.
+     *  @param  raw         Logical true to use WRITE-RAW rather than plain WRITE. Default false.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::rawReadFile(void* dest, unsigned size, unsigned* actual, ASAppletID applet, int index, bool raw)
+    {
+        ASDeviceBufferSink buffer;
+        buffer.ptr = (uint8_t*)dest;
+        buffer.remaining = size;
+        return rawReadFile(bufferSink, &buffer, size, actual, applet, index, raw);
+    }
+
+
+    /** Read a file, passing the data to a sink (see rawReadFile() above).
+     *
+     *  @param  sink        The data sink.
+     *  @param  context     Context passed to the sink.
+     *  @param  size        The maximum number of bytes to read.
+     *  @param  actual      Used to return the actual number of bytes read.
+     *  @param  applet      The applet ID.
+     *  @param  index       The file number.
+     *  @param  raw         Logical true to use READ-RAW rather than plain READ. Default false.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::rawReadFile(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual, ASAppletID applet, int index, bool raw)
+    {
+        *actual = 0;
+
+        ASMessage request;
+        ASMessage response;
+
+        request.init(raw ? ASMESSAGE_REQUEST_READ_RAW_FILE : ASMESSAGE_REQUEST_READ_FILE);
+        request.setArgument(size, 1, 3);
+        request.setArgument((unsigned)index, 4, 1);
+        request.setArgument(applet, 5, 2);
+
+        if (!sendRequest(&request)) goto error;
+        if (!getResponse(&response)) goto error;
+        if (!readExtendedData(sink, context, size, actual)) goto error;
+
+        return true;
+
+    error:
+        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
+        return false;
+    }
+
+
+
+    /** Write a file.
+     *
+     *  @param  dest        The data.
+     *  @param  size        The number of bytes that are to be written.
+     *  @param  applet      The applet ID.
+     *  @param  index       The file number.
+     *  @param  raw         Logical true to use WRITE-RAW rather than plain WRITE. Default false.
+     *  @param  adaptive    Logical true to allow adaptive block sizes (see writeExtendedData()). Default false.
+     *  @return             Logical true if the operation succeeded, false otherwise.
+     */
+    bool ASDevice::rawWriteFile(const void* source, unsigned size, ASAppletID applet, int index, bool raw, bool adaptive)
+    {
+        ASMessage request;
+        ASMessage response;
+
+        request.init(raw ? ASMESSAGE_REQUEST_WRITE_RAW_FILE : ASMESSAGE_REQUEST_WRITE_FILE);
+        request.setArgument((unsigned)index, 1, 1);
+        request.setArgument(size, 2, 3);
+        request.setArgument(applet, 5, 2);
+        if (!sendRequest(&request)) goto error;
+        if (!getResponse(&response)) goto error;
+        if (ASMESSAGE_RESPONSE_WRITE_FILE != response.command()) goto error;
+        if (!writeExtendedData(source, size, adaptive)) goto error;
+        request.init(ASMESSAGE_REQUEST_CONFIRM_WRITE_FILE);
+        if (!sendRequest(&request)) goto error;
+        if (!getResponse(&response)) goto error;
+        if (ASMESSAGE_RESPONSE_CONFIRM_WRITE_FILE != response.command()) goto error;
+
+        return true;
+
+
+    error:
+        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
+        return false;
+    }
+
+
+    /** Query the remaining memory on the system. The local memory accounting is re-seeded
+     *  from the result.
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x1a    ASMESSAGE_REQUEST_GET_AVAIL_SPACE
+     *      IN:     0x58    ASMESSAGE_RESPONSE_GET_AVAIL_SPACE
+     *
+     *  @param  ram     Returns the free RAM space.
+     *  @param  rom     Returns the free ROM space.
+     *  @return         Logical true unless there was an IO error.
+     */
+    bool ASDevice::rawGetAvailableSpace(unsigned* ram, unsigned* rom)
+    {
+        *ram = 0;
+        *rom = 0;
+
+        ASMessage message(ASMESSAGE_REQUEST_GET_AVAIL_SPACE);
+        bool result = sendRequestAndGetResponse(&message);
+        if (result && message.command() == ASMESSAGE_RESPONSE_GET_AVAIL_SPACE)
+        {
+            *rom = message.argument(1, 4);
+            *ram = (message.argument(5, 2) * 256);
+
+            m_freeRam = *ram;
+            m_freeRom = *rom;
+            m_memoryValid = true;
+        }
+        return result;
+    }
+
+
+    /** Find the resources currently being used by an applet. The local memory accounting for
+     *  the applet is re-seeded from the result.
+     *
+     *  The command sequence is:
+     *
+     *      OUT:    0x1b    ASMESSAGE_REQUEST_GET_USED_SPACE
+     *      IN:     0x59    ASMESSAGE_RESPONSE_GET_USED_SPACE
+     *
+     *  @param  fc          Returns the number of files used.
+     *  @param  ram         Returns the amount of RAM used by the applet in bytes.
+     *  @param  applet      The applet ID.
+     *  @return             Logical true if the request succeeded.
+     */
+    bool ASDevice::rawGetUsedSpace(unsigned* fc, unsigned* ram, ASAppletID applet)
+    {
+        *fc = 0;
+        *ram = 0;
+
+        ASMessage message;
+        message.init(ASMESSAGE_REQUEST_GET_USED_SPACE);
+        message.setArgument(0x00000001, 1, 4);              // set zero to get the size of the largest file, non-zero for all files
+        message.setArgument(applet, 5, 2);
+        bool result = sendRequestAndGetResponse(&message);
+        if (result && message.command() == ASMESSAGE_RESPONSE_GET_USED_SPACE)
+        {
+            *ram = message.argument(1, 4);
+            *fc = message.argument(5, 2);
+            setAppletUsage(applet, *fc, *ram);
+        }
+        return result;
+    }
+
+
+
+
+    /** Create a single new file. This must be called from within a dialogue, after the memory
+     *  accounting has been synchronised and the space checked.
+     *
+     *  @param  filename    The name for the new file.
+     *  @param  password    The password for the new file.
+     *  @param  buffer      The file data.
+     *  @param  size        The number of bytes of file data.
+     *  @param  applet      The applet ID.
+     *  @param  usage       The tracked usage for the applet.
+     *  @param  fileIndex   Returns the index of the new file.
+     *  @param  raw         Logical true to write raw data.
+     *  @return             Logical true if the file was created.
+     */
+    bool ASDevice::createFileInDialogue(const char* filename, const char* password, const void* buffer, unsigned size, ASAppletID applet, AppletUsage* usage, int* fileIndex, bool raw)
+    {
+        *fileIndex = (int)(usage->fileCount + 1);
+
+        ASFileAttributes attr;
+        attr.setFileName(filename);
+        attr.setPassword(password);
+        attr.setAllocSize(size);
+        attr.setMinSize(size);
+        attr.setFileSpace(0);           // unbound
+        bool result = rawSetFileAttributes(attr.rawData(), applet, *fileIndex);
+        if (result)
+        {
+            ASMessage message;
+            message.init(ASMESSAGE_REQUEST_COMMIT);             // Sending this message appears to bind the attributes to a new
+            message.setArgument((unsigned)*fileIndex, 4, 1);    // file - not sending it will still result in a new file, but
+            message.setArgument(applet, 5, 2);                  // the attributes will not be correct.
+            result = sendRequestAndGetResponse(&message);
+            if (result && ASMESSAGE_RESPONSE_COMMIT == message.command())
+            {
+                result = rawWriteFile(buffer, size, applet, *fileIndex, raw);
+            }
+        }
+
+        if (result)
+        {
+            usage->fileCount ++;
+            accountForResize(applet, 0, size);
+            setTrackedFileSize(applet, *fileIndex, size);
+        }
+        else
+        {
+            invalidateMemoryAccounting();               // device state is uncertain - re-sync on next use
+        }
+
+        return result;
+    }
+
+
+    /** Clear a single file. This must be called from within a dialogue.
+     *
+     *  @param  applet          The applet ID.
+     *  @param  fileIndex       The file index.
+     *  @return                 Logical true if succeeded.
+     */
+    bool ASDevice::clearFileInDialogue(ASAppletID applet, int fileIndex)
+    {
+        uint8_t abuffer[kASFileAttributesSize];
+        unsigned actual;
+        bool result = rawGetFileAttributes(abuffer, applet, fileIndex, &actual);
+        if (result && 0 == actual)
+        {
+            m_operationRejected = true;
+            result = false;                             // No such file.
+        }
+        if (result)
+        {
+            ASFileAttributes attr(abuffer);
+            unsigned oldSize = attr.allocSize();
+            attr.setAllocSize(0);
+            attr.setMinSize(0);
+            result = rawSetFileAttributes(attr.rawData(), applet, fileIndex);
+            if (result)
+            {
+                ASMessage message;
+                message.init(ASMESSAGE_REQUEST_COMMIT);         // Sending this message appears to bind the attributes to a new
+                message.setArgument((unsigned)fileIndex, 4, 1); // file - not sending it will still result in a new file, but
+                message.setArgument(applet, 5, 2);              // the attributes will not be correct.
+                result = sendRequestAndGetResponse(&message);
+                if (result && ASMESSAGE_RESPONSE_COMMIT == message.command())
+                {
+                    result = rawWriteFile(0, 0, applet, fileIndex, true);
+                }
+            }
+            if (result)
+            {
+                accountForResize(applet, oldSize, 0);
+                setTrackedFileSize(applet, fileIndex, 0);
+            }
         }
 
-        return true;
-
-    error:
-
-        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
-        return 0;
+        if (!result) invalidateMemoryAccounting();
+        return result;
     }
 
 
 
-    #pragma mark    ---------------- Public API providing access to the protocol ----------------
-
-
-
-    /** Send a restart request to the Neo. The should cause the Neo to reset and revert back to its HID state.
-     *
-     *  @return     Logical true if the request completed successfully.
-     */
-    bool ASDevice::restart()
-    {
-        bool result = dialogueStart();
-        if (!result) return result;
-
-        ASMessage message(ASMESSAGE_REQUEST_RESTART);
-        result = (sendRequestAndGetResponse(&message), ASMESSAGE_RESPONSE_RESTART);
-
-        return dialogueEnd(result);
-    }
-
-
-    /** Obtain the OS version information.
+    /** Obtain the OS version information. This must be called from within a dialogue.
      *
      *  @param  major       Returns the OS major version number.
      *  @param  minor       Returns the OS minor version number.
      *  @param  systemName  The build system name.
      *  @param  systemDate  The build system date.
      *  @return             Logical true if the request was successful.
-     *
-     *  @bug    Later UK Neo systems appear to report 3.6 on the device but 3.4 in response to this command.
-     *          There also appear to be additional non-zero bytes at the end of the version information
-     *          and the checksum is wrong by one.
      */
-    bool ASDevice::systemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64])
+    bool ASDevice::rawSystemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64])
     {
         *major = 0;
         *minor = 0;
         systemName[0] = 0;
         systemDate[0] = 0;
 
-        bool result = dialogueStart();
-        if (!result) return result;
-
-
         ASMessage message(ASMESSAGE_REQUEST_VERSION);
-        result = (sendRequestAndGetResponse(&message), ASMESSAGE_RESPONSE_VERSION);
+        bool result = sendRequestAndCheckResponse(&message);
         if (result)
         {
             unsigned size = message.argument(1, 4);
@@ -884,7 +3271,8 @@ namespace ts
             memset(buffer, 0, sizeof buffer);
 
             unsigned actual;
-            if (!read(buffer, size, &actual)) return false;
+            if (!transferRead(buffer, size, &actual)) return false;
+            m_protocolStatistics.dataReceived(actual);
 
             buffer[actual] = 0;
             unsigned actualChecksum = calculateDataChecksum(buffer, actual);
@@ -892,6 +3280,7 @@ namespace ts
             {
                 // OS 3.6 Neo device appear to calculate the checksum wrongly (off by one error?)
                 fprintf(stderr, "%s: ignoring data checksum error: wanted %04x, got %04x\n", __FUNCTION__, expectedChecksum, actualChecksum);
+                m_protocolStatistics.checksumFailure();
             }
             /* The returned data appears to contain:
              *
@@ -916,255 +3305,226 @@ namespace ts
             fprintf(stderr, "OS Revision %u.%u   %08x    '%s'  '%s'\n", *major, *minor, unknown, systemName, systemDate);
         }
 
-        return dialogueEnd(result);
+        return result;
     }
 
 
-    /** Query the remaining memory on the system.
+
+    /** Request settings data. On success, the caller must then read the number of bytes given by @e size.
+     *  This must be called from within a dialogue.
      *
-     *  @param  ram     Returns the free RAM space.
-     *  @param  rom     Returns the free ROM space.
-     *  @return         Logical true unless there was an IO error.
+     *  The command sequence is:
+     *
+     *      OUT:    0x0c    ASMESSAGE_REQUEST_GET_SETTINGS
+     *      IN:     0x4b    ASMESSAGE_RESPONSE_GET_SETTINGS
+     *
+     *  @param  applet      The applet ID.
+     *  @param  flags       The flags to select the data.
+     *  @param  size        Returns the number of bytes of settings data to follow.
+     *  @param  checksum    Returns the expected data checksum.
+     *  @return             Logical true if the request succeeded.
      */
-    bool ASDevice::systemMemory(unsigned* ram, unsigned* rom)
+    bool ASDevice::rawRequestSettings(ASAppletID applet, unsigned flags, unsigned* size, unsigned* checksum)
     {
-        *ram = 0;
-        *rom = 0;
-
-        if (!dialogueStart()) return false;
+        *size = 0;
+        *checksum = 0;
 
-        ASMessage message(ASMESSAGE_REQUEST_GET_AVAIL_SPACE);
+        ASMessage message;
+        message.init(ASMESSAGE_REQUEST_GET_SETTINGS);
+        message.setArgument(flags, 1, 4);               // flags
+        message.setArgument(applet, 5, 2);              // applet id
         bool result = sendRequestAndGetResponse(&message);
-        if (result && message.command() == ASMESSAGE_RESPONSE_GET_AVAIL_SPACE)
+        if (ASMESSAGE_RESPONSE_GET_SETTINGS != message.command())  result = false;
+        if (result)
         {
-            *rom = message.argument(1, 4);
-            *ram = (message.argument(5, 2) * 256);
+            *size = message.argument(1, 4);
+            *checksum = message.argument(5, 2);
         }
-        return dialogueEnd(result);
-
+        return result;
     }
 
 
-
-
-
-
-    /** Initialise a new file.
-     *
-     *  The command sequence is:
+    /** Read the settings for an applet in to a settings collection. This must be called from within a dialogue.
      *
-     *      OUT:    0x1e    ASMESSAGE_REQUEST_COMMIT
-     *      IN:     0x5c    ASMESSAGE_RESPONSE_COMMIT
-     *
-     *  @param  index       The file number.
+     *  @param  collection  The collection.
      *  @param  applet      The applet ID.
-     *  @return             Logical true if the operation succeeded, false otherwise.
+     *  @param  flags       The flags to select the data.
+     *  @return             Logical true if the request succeeded.
      */
-    bool ASDevice::rawCreateFile(ASAppletID applet, int index)
+    bool ASDevice::rawReadSettings(ASSettingsCollection* collection, ASAppletID applet, unsigned flags)
     {
-        bool result = dialogueStart();
+        unsigned size;
+        unsigned expectedChecksum;
+        bool result = rawRequestSettings(applet, flags, &size, &expectedChecksum);
         if (!result) return false;
 
-        ASMessage message(ASMESSAGE_REQUEST_COMMIT);
-        message.setArgument((unsigned)index, 4, 1);
-        message.setArgument(applet, 5, 2);
-        result = sendRequestAndGetResponse(&message, ASMESSAGE_RESPONSE_COMMIT);
+        uint8_t* buffer = collection->reserve(size);
+        if (!buffer)
+        {
+            // Drain the data so that the protocol stays in sync
+            uint8_t tmp[1024];
+            unsigned remaining = size;
+            unsigned actual;
+            while (remaining > 0 && transferRead(tmp, (sizeof tmp < remaining) ? sizeof tmp : remaining, &actual) && actual > 0) remaining -= actual;
+            return false;
+        }
 
-        return dialogueEnd(result);
+        result = transferRead(buffer, size);
+        if (result)
+        {
+            m_protocolStatistics.dataReceived(size);
+            result = (calculateDataChecksum(buffer, size) == expectedChecksum);
+            if (!result) m_protocolStatistics.checksumFailure();
+        }
+        if (result) result = collection->commit(applet, flags, size);
+        return result;
     }
 
 
 
+#pragma mark    --------  Memory accounting  --------
 
 
-    /** Read the file information (attributes).
-     *
-     *  The command sequence is:
-     *
-     *      OUT:    0x13    ASMESSAGE_REQUEST_GET_FILE_ATTRIBUTES
-     *      IN:     0x5a    ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES
-     *      IN:     data
+
+    /** Make sure that the locally tracked free memory and the usage for an applet are valid,
+     *  querying the device only for values that are not already known. This must be called
+     *  from within a dialogue.
      *
-     *  @param  attr        Returns the file attribute data.
      *  @param  applet      The applet ID.
-     *  @param  index       The file number.
-     *  @param  actual      The actual number of headers read (either zero or one). If zero, no header
-     *                      exists.
-     *  @return             Logical true if all ok, or false if an IO error occurred.
+     *  @param  usage       Returns the tracked usage record for the applet.
+     *  @return             Logical true if the accounting is valid, false if there was an IO error.
      */
-    bool ASDevice::rawGetFileAttributes(uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index, unsigned* actual)
+    bool ASDevice::syncMemoryAccounting(ASAppletID applet, AppletUsage** usage)
     {
-        assert(index < 256);
-
-        *actual = 0;
-        memset(attr, 0, kASFileAttributesSize);
+        *usage = 0;
 
-        ASMessage message;
-        message.init(ASMESSAGE_REQUEST_GET_FILE_ATTRIBUTES);
-        message.setArgument((unsigned)index, 4, 1);
-        message.setArgument(applet, 5, 2);
-        bool result = sendRequestAndGetResponse(&message);
-        if (!result) return false;
+        unsigned ram;
+        unsigned rom;
+        unsigned fc;
+        if (!m_memoryValid && !rawGetAvailableSpace(&ram, &rom)) return false;
+        if (!m_memoryValid) return false;
 
-        if (ASMESSAGE_ERROR_PARAMETER == message.command())
+        AppletUsage* record = findAppletUsage(applet);
+        if (!record)
         {
-            // Entry not found. This probably just means that the iteration has exceeded the number of files available.
-            return true;
+            if (!rawGetUsedSpace(&fc, &ram, applet)) return false;
+            record = findAppletUsage(applet);
+            if (!record) return false;
         }
 
-        if (ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES != message.command())
-        {
-            fprintf(stderr, "%s: unexpected response:", __FUNCTION__);
-            message.dump(stderr);
-            fprintf(stderr, "\n");
-            return false;
-        }
+        *usage = record;
+        return true;
+    }
 
-        unsigned length = message.argument(1, 4);
-        unsigned checksum = message.argument(5, 2);
 
-        if (length != kASFileAttributesSize)
+    /** Return the tracked usage record for an applet, or zero if none is known.
+     */
+    ASDevice::AppletUsage* ASDevice::findAppletUsage(ASAppletID applet) const
+    {
+        for (unsigned i = 0; i < m_appletUsage.count(); i++)
         {
-            fprintf(stderr, "%s: unexpected size %d for attribute data.\n", __FUNCTION__, length);
-            return false;
+            AppletUsage* usage = m_appletUsage.itemAtIndex(i);
+            if (usage->appletID == applet) return usage;
         }
+        return 0;
+    }
+
 
-        if (!read(attr, kASFileAttributesSize))
+    /** Record the usage for an applet, as reported by the device.
+     */
+    void ASDevice::setAppletUsage(ASAppletID applet, unsigned fc, unsigned ram)
+    {
+        AppletUsage* usage = findAppletUsage(applet);
+        if (!usage)
         {
-            fprintf(stderr, "%s: unexpected error reading attribute data.\n", __FUNCTION__);
-            return false;
+            usage = new AppletUsage;
+            usage->appletID = applet;
+            m_appletUsage.appendItem(usage);
         }
-
-        unsigned actualChecksum = calculateDataChecksum(attr, kASFileAttributesSize);
-        if (!(actualChecksum == checksum))
+        usage->fileCount = fc;
+        usage->ramUsed = ram;
+        for (unsigned i = 0; i <= kASDeviceMaxFileIndex; i++)
         {
-            fprintf(stderr, "%s: data checksum error: wanted %04x, got %04x.\n", __FUNCTION__, actualChecksum, checksum);
-            return false;
+            usage->fileSize[i] = kASDeviceFileSizeUnknown;     // the device only reports the total
         }
-
-        *actual = 1;        // If here, we managed to successfully read the attributes
-        return true;
     }
 
 
-
-    /** Set the file information (attributes).
-     *
-     *  The command sequence is:
-     *
-     *      OUT:    0x1d    ASMESSAGE_REQUEST_SET_FILE_ATTRIBUTES
-     *      IN:     0x5b    ASMESSAGE_RESPONSE_SET_FILE_ATTRIBUTES
-     *      OUT:    0x02    ASMESSAGE_REQUEST_BLOCK_WRITE
-     *      IN:     0x42    ASMESSAGE_RESPONSE_BLOCK_WRITE
-     *      OUT:    data
-     *      IN:     0x43    ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE
+    /** Record the allocated size of a file following a successful create, write or clear. This
+     *  does nothing if the applet's usage is not being tracked.
      *
-     *  @param  attr        The attribute data to be written.
      *  @param  applet      The applet ID.
-     *  @param  index       The file number.
-     *  @return             Logical true if the operation succeeded, false otherwise.
+     *  @param  fileIndex   The file index.
+     *  @param  size        The new file size.
      */
-    bool ASDevice::rawSetFileAttributes(const uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index)
+    void ASDevice::setTrackedFileSize(ASAppletID applet, int fileIndex, unsigned size)
     {
-        assert(index < 256);
-
-        ASMessage message;
-
-        message.init(ASMESSAGE_REQUEST_SET_FILE_ATTRIBUTES);
-        message.setArgument((unsigned)index, 1, 4);
-        message.setArgument(applet, 5, 2);
-
-        bool result = sendRequestAndGetResponse(&message, ASMESSAGE_RESPONSE_SET_FILE_ATTRIBUTES);
-        if (!result)
-        {
-            fprintf(stderr, "%s: unexpected response: ", __FUNCTION__);
-            message.dump(stderr);
-            fprintf(stderr, "\n");
-        }
-        else
+        AppletUsage* usage = findAppletUsage(applet);
+        if (usage && fileIndex >= 0 && fileIndex <= kASDeviceMaxFileIndex)
         {
-            result = writeExtendedData(attr, kASFileAttributesSize);
+            usage->fileSize[fileIndex] = size;
         }
-
-        return result;
     }
 
 
-
-    /** Read a file.
-     *
-     *  Transfer sequence:
-     *
-     *      OUT:    0x12|0x1c   ASMESSAGE_REQUEST_READ_FILE | ASMESSAGE_REQUEST_READ_RAW_FILE
-     *      IN:     0x53        ASMESSAGE_RESPONSE_READ_FILE
-     *      [block read sequence]
+    /** Return the locally known allocated size of a file.
      *
-     *  @param  dest        Where to put the data.
-     *  @param  size        The maximum number of bytes to read.
-     *  @param  actual      Used to return the actual number of bytes read.
      *  @param  applet      The applet ID.
-     *  @param  index       The file number.
-     *  @param  raw         Logical true to use WRITE-RAW rather than plain WRITE. Default false.
-     *  @return             Logical true if the operation succeeded, false otherwise.
+     *  @param  fileIndex   The file index.
+     *  @return             The file size, or kASDeviceFileSizeUnknown if the size has not been seen
+     *                      since the accounting was last synchronised.
      */
-    bool ASDevice::rawReadFile(void* dest, unsigned size, unsigned* actual, ASAppletID applet, int index, bool raw)
+    unsigned ASDevice::trackedFileSize(ASAppletID applet, int fileIndex) const
     {
-        *actual = 0;
-
-        ASMessage request;
-        ASMessage response;
-
-        request.init(raw ? ASMESSAGE_REQUEST_READ_RAW_FILE : ASMESSAGE_REQUEST_READ_FILE);
-        request.setArgument(size, 1, 3);
-        request.setArgument((unsigned)index, 4, 1);
-        request.setArgument(applet, 5, 2);
-
-        if (!sendRequest(&request)) goto error;
-        if (!getResponse(&response)) goto error;
-        if (!readExtendedData(dest, size, actual)) goto error;
-
-        return true;
-
-    error:
-        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
-        return false;
+        AppletUsage* usage = findAppletUsage(applet);
+        if (!m_memoryValid || !usage || fileIndex < 0 || fileIndex > kASDeviceMaxFileIndex) return kASDeviceFileSizeUnknown;
+        return usage->fileSize[fileIndex];
     }
 
 
-
-    /** Write a file.
+    /** Update the tracked memory following a successful change of file size.
      *
-     *  @param  dest        The data.
-     *  @param  size        The number of bytes that are to be written.
      *  @param  applet      The applet ID.
-     *  @param  index       The file number.
-     *  @param  raw         Logical true to use WRITE-RAW rather than plain WRITE. Default false.
-     *  @return             Logical true if the operation succeeded, false otherwise.
+     *  @param  oldSize     The previous file size (zero for a new file).
+     *  @param  newSize     The new file size.
      */
-    bool ASDevice::rawWriteFile(const void* source, unsigned size, ASAppletID applet, int index, bool raw)
+    void ASDevice::accountForResize(ASAppletID applet, unsigned oldSize, unsigned newSize)
     {
-        ASMessage request;
-        ASMessage response;
+        AppletUsage* usage = findAppletUsage(applet);
+        if (!m_memoryValid || !usage)
+        {
+            invalidateMemoryAccounting();
+            return;
+        }
 
-        request.init(raw ? ASMESSAGE_REQUEST_WRITE_RAW_FILE : ASMESSAGE_REQUEST_WRITE_FILE);
-        request.setArgument((unsigned)index, 1, 1);
-        request.setArgument(size, 2, 3);
-        request.setArgument(applet, 5, 2);
-        if (!sendRequest(&request)) goto error;
-        if (!getResponse(&response)) goto error;
-        if (ASMESSAGE_RESPONSE_WRITE_FILE != response.command()) goto error;
-        if (!writeExtendedData(source, size)) goto error;
-        request.init(ASMESSAGE_REQUEST_CONFIRM_WRITE_FILE);
-        if (!sendRequest(&request)) goto error;
-        if (!getResponse(&response)) goto error;
-        if (ASMESSAGE_RESPONSE_CONFIRM_WRITE_FILE != response.command()) goto error;
+        if (newSize >= oldSize)
+        {
+            unsigned delta = newSize - oldSize;
+            m_freeRam = (delta < m_freeRam) ? (m_freeRam - delta) : 0;
+            usage->ramUsed += delta;
+        }
+        else
+        {
+            unsigned delta = oldSize - newSize;
+            m_freeRam += delta;
+            usage->ramUsed = (delta < usage->ramUsed) ? (usage->ramUsed - delta) : 0;
+        }
+    }
 
-        return true;
 
+    /** Discard all tracked memory information, forcing a re-sync with the device on next use.
+     */
+    void ASDevice::invalidateMemoryAccounting()
+    {
+        for (unsigned i = 0; i < m_appletUsage.count(); i++)
+        {
+            delete m_appletUsage.itemAtIndex(i);
+        }
+        m_appletUsage.removeAllItems();
 
-    error:
-        fprintf(stderr, "Error in %s: last request: %02x, last response: %02x\n", __FUNCTION__, request.command(), response.command());
-        return false;
+        m_memoryValid = false;
+        m_freeRam = 0;
+        m_freeRom = 0;
     }
 
 
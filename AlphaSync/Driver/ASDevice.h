@@ -33,14 +33,190 @@
 #define COM_TSONIQ_ASDevice_H   (1)
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ASAppletID.h"
 #include "ASMessage.h"
 #include "ASFileAttributes.h"
 #include "ASApplet.h"
+#include "ASSettings.h"
+#include "ASDeviceScheduler.h"
+#include "ASDeviceProtocolStatistics.h"
+#include "ASDeviceWatchdog.h"
 #include "AQContainer.h"
 
+#define kASDeviceRetryDefaultAttempts   (3)     /**< Default maximum number of attempts for retryable operations. */
+#define kASDeviceRetryDefaultBaseDelay  (50)    /**< Default initial retry delay, in ms. */
+#define kASDeviceRetryDefaultMaxDelay   (1000)  /**< Default maximum retry delay, in ms. */
+#define kASBlockReadBufferSize      (0x400)     /**< Local buffer size used when streaming block reads. */
+#define kASBlockReadUnbounded       (~0u)       /**< Block read length meaning "read until the device has no more data". */
+#define kASAppletCacheTag           "ASH1"      /**< Tag identifying an applet header cache file. */
+#define kASAppletCacheMaxCount      (256)       /**< Upper limit for the number of headers accepted from a cache file. */
+#define kASDeviceMaxFileIndex       (255)       /**< The largest file index that the protocol can address. */
+#define kASDeviceFileSizeUnknown    (~0u)       /**< Tracked file size meaning that the size has not been seen locally. */
+#define kASDeviceNoDeadline         (0.0)       /**< Deadline value meaning that an operation is not time limited. */
+#define kASDeviceDeadlineMaxTimeout (20000)     /**< Upper limit for a single transfer timeout when a deadline applies, in ms. */
+#define kASWriteBlockSizeMin        (0x400)     /**< BLOCK_WRITE size accepted by every device. */
+#define kASWriteBlockSizeMax        (0x2000)    /**< Largest BLOCK_WRITE size that will be probed. */
+#define kASWriteBlockSizeCount      (4)         /**< The number of probed sizes (powers of two from min to max). */
+#define kASDeviceStatePoolMaxCount  (8)         /**< The number of disconnected device states retained. */
+#define kASDeviceStatePoolMaxAge    (600.0)     /**< How long a disconnected device state is retained, in seconds. */
+#define kASDeviceHealthMax          (100)       /**< Health score of a device with no history of problems. */
+#define kASDeviceHealthyScore       (50)        /**< Devices scoring below this are considered unhealthy. */
+#define kASDeviceHealthHangPenalty  (25)        /**< Health lost when the watchdog aborts a hung transfer. */
+#define kASDeviceHealthFailPenalty  (5)         /**< Health lost when an operation fails. */
+
 namespace ts
 {
+    /** Data sink used for streamed reads. The sink is called with each block of data as it arrives.
+     *
+     *  @param  context     The context pointer supplied by the client.
+     *  @param  data        The data.
+     *  @param  size        The number of bytes of data.
+     *  @return             Logical true to continue, false to abort the transfer.
+     */
+    typedef bool (*ASDeviceDataSink)(void* context, const void* data, unsigned size);
+
+
+    /** Retry policy for operations that fail due to a transport error. Only operations that can be
+     *  safely repeated are retried, and each retry restarts the operation from a new dialogue.
+     */
+    struct ASDeviceRetryPolicy
+    {
+        unsigned maxAttempts;                   /**< The maximum number of attempts (including the first). One disables retries. */
+        unsigned baseDelay;                     /**< The delay before the first retry, in ms. This doubles for each retry. */
+        unsigned maxDelay;                      /**< The upper limit for the retry delay, in ms. */
+    };
+
+
+    /** Retry statistics.
+     */
+    struct ASDeviceRetryStatistics
+    {
+        unsigned operations;                    /**< The number of operations completed (successfully or not). */
+        unsigned retries;                       /**< The total number of retries. */
+        unsigned recovered;                     /**< The number of operations that succeeded after at least one retry. */
+        unsigned failed;                        /**< The number of operations that failed. */
+        unsigned unsafe;                        /**< The number of failures that could not be retried because a non-idempotent command had been sent. */
+    };
+
+
+    /** Upload statistics for a single BLOCK_WRITE size (see ASDevice::writeBlockStatistics()).
+     */
+    struct ASDeviceWriteBlockStatistics
+    {
+        unsigned blockSize;                     /**< The block size. */
+        unsigned blocks;                        /**< The number of blocks written. */
+        double bytes;                           /**< The number of bytes written. */
+        double seconds;                         /**< The time spent writing, including the per-block handshake. */
+
+        double throughput() const { return (seconds > 0.0) ? (bytes / seconds) : 0.0; }
+    };
+
+
+    /** Block read statistics (see ASDevice::readStatistics()).
+     */
+    struct ASDeviceReadStatistics
+    {
+        unsigned blocks;                        /**< The number of blocks read. */
+        double bytes;                           /**< The number of bytes read. */
+        double seconds;                         /**< The time spent reading, including the per-block handshake. */
+
+        double throughput() const { return (seconds > 0.0) ? (bytes / seconds) : 0.0; }
+    };
+
+
+    /** Cancellation token for long-running operations. The token may be cancelled from any thread, and
+     *  an operation using it stops at the next block boundary. The device is reset and released as usual
+     *  when the operation ends, so it is immediately available for further requests.
+     */
+    class ASDeviceCancelToken
+    {
+    public:
+
+        ASDeviceCancelToken() : m_cancelled(0) { }
+
+        void cancel() { m_cancelled = 1; }
+        void reset() { m_cancelled = 0; }
+        bool isCancelled() const { return 0 != m_cancelled; }
+
+    private:
+
+        volatile int m_cancelled;               /**< Non-zero once cancelled. */
+
+        ASDeviceCancelToken(const ASDeviceCancelToken&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceCancelToken& operator=(const ASDeviceCancelToken&);     /**< Prevent the use of the assignment operator. */
+    };
+
+
+    /** State retained for a device after it has been disconnected, so that a device that is unplugged and
+     *  then reconnected can reuse what was learned about it (see ASDevice::detachState()). Only state that
+     *  cannot change while the device is away from the host is kept: the applet headers (which are checked
+     *  against the device before use) and the negotiated transfer parameters. File contents and memory usage
+     *  are not retained, since the device can be used while it is unplugged.
+     */
+    struct ASDeviceRetainedState
+    {
+        unsigned identity;                      /**< The device identity. */
+        double detachTime;                      /**< The time the state was detached. */
+        unsigned systemMajor;                   /**< The OS major version. */
+        unsigned systemMinor;                   /**< The OS minor version. */
+        char systemName[64];                    /**< The OS name. */
+        char systemDate[64];                    /**< The OS build date. */
+        uint8_t* appletHeaderData;              /**< The complete raw applet header data (malloc'd). */
+        unsigned appletHeaderCount;             /**< The number of applet headers. */
+        unsigned writeBlockSize;                /**< The largest BLOCK_WRITE size known to work. */
+        unsigned writeBlockRejected;            /**< The smallest BLOCK_WRITE size known to fail, or zero. */
+        bool pipelineFailed;                    /**< Logical true if pipelined reads failed on the device. */
+        unsigned healthScore;                   /**< The device health score. */
+        unsigned watchdogAborts;                /**< The number of hung transfers aborted by the watchdog. */
+
+        ASDeviceRetainedState() { memset(this, 0, sizeof *this); }
+        ~ASDeviceRetainedState() { free(appletHeaderData); }
+
+    private:
+
+        ASDeviceRetainedState(const ASDeviceRetainedState&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceRetainedState& operator=(const ASDeviceRetainedState&);     /**< Prevent the use of the assignment operator. */
+    };
+
+
+    /** A bounded pool of recently disconnected device states, keyed by device identity. States are discarded
+     *  after kASDeviceStatePoolMaxAge seconds, and the oldest state is discarded if the pool is full. The pool
+     *  is not thread safe and is intended to be used from the thread handling device arrival and removal.
+     */
+    class ASDeviceStatePool
+    {
+    public:
+
+        ASDeviceStatePool() : m_states() { }
+        ~ASDeviceStatePool();
+
+        void retain(ASDeviceRetainedState* state);
+        ASDeviceRetainedState* take(unsigned identity);
+        void purge();
+
+    private:
+
+        AQContainer<ASDeviceRetainedState> m_states;       /**< Retained states, oldest first. */
+
+        ASDeviceStatePool(const ASDeviceStatePool&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceStatePool& operator=(const ASDeviceStatePool&);     /**< Prevent the use of the assignment operator. */
+    };
+
+
+    /** Description of a single file in a batched create request (see ASDevice::createFiles).
+     */
+    struct ASDeviceFileRequest
+    {
+        const char* filename;                   /**< The name for the new file. */
+        const char* password;                   /**< The password for the new file. */
+        const void* buffer;                     /**< The file data. */
+        unsigned size;                          /**< The number of bytes of file data. */
+        int fileIndex;                          /**< Returns the index of the created file, or -1 if it was not created. */
+    };
+
+
     /** Device object. This represents a single physical instance of a Neo or similar device in comms mode.
      *
      *  Device objects may only be created or destroyed by an instance of ASDeviceFactory, which
@@ -59,18 +235,100 @@ namespace ts
             m_identity(0),
             m_appletHeaderData(0),
             m_appletHeaderCount(0),
-            m_applets()
+            m_appletsComplete(false),
+            m_applets(),
+            m_memoryValid(false),
+            m_freeRam(0),
+            m_freeRom(0),
+            m_appletUsage(),
+            m_operationRejected(false),
+            m_unsafeRequestSent(false),
+            m_randomSeed(0),
+            m_cancelToken(0),
+            m_deadline(kASDeviceNoDeadline),
+            m_operationCancelled(false),
+            m_lastOperationCancelled(false),
+            m_systemMajor(0),
+            m_systemMinor(0),
+            m_systemKnown(false),
+            m_writeBlockSize(kASWriteBlockSizeMin),
+            m_writeBlockRejected(0),
+            m_writeBlockProbing(false),
+            m_pipelineRequested(false),
+            m_pipelineFailed(false),
+            m_scheduler(),
+            m_dialogueDepth(0),
+            m_protocolStatistics(),
+            m_retainedState(0),
+            m_watchdogDeadline(0.0),
+            m_watchdogFired(false),
+            m_watchdogDisabled(false),
+            m_watchdogLimit(0),
+            m_transferAborted(false),
+            m_watchdogAborts(0),
+            m_healthScore(kASDeviceHealthMax)
         {
-            // Nothing
+            m_retryPolicy.maxAttempts = kASDeviceRetryDefaultAttempts;
+            m_retryPolicy.baseDelay = kASDeviceRetryDefaultBaseDelay;
+            m_retryPolicy.maxDelay = kASDeviceRetryDefaultMaxDelay;
+            resetRetryStatistics();
+            resetWriteBlockStatistics();
+            resetReadStatistics();
+
+            m_appletCachePath[0] = 0;
+            m_systemName[0] = 0;
+            m_systemDate[0] = 0;
+
+            ASDeviceWatchdog::sharedWatchdog()->addDevice(this);
         }
 
 
         virtual ~ASDevice()
         {
+            ASDeviceWatchdog::sharedWatchdog()->removeDevice(this);
+            invalidateMemoryAccounting();
             clearEnumeratedApplets();
+            delete m_retainedState;
         }
 
+        static void setAppletCacheDirectory(const char* path);
+        static void setAppletWriteEnabled(bool enable);
+        static bool appletWriteEnabled();
+
+        void setRetryPolicy(const ASDeviceRetryPolicy& policy);
+        const ASDeviceRetryPolicy& retryPolicy() const { return m_retryPolicy; }
+        const ASDeviceRetryStatistics& retryStatistics() const { return m_retryStatistics; }
+        void resetRetryStatistics();
+
         unsigned identity() const { return m_identity; }
+        ASDeviceRetainedState* detachState();
+        unsigned healthScore() const { return m_healthScore; }
+        bool isHealthy() const { return m_healthScore >= kASDeviceHealthyScore; }
+        unsigned watchdogAborts() const { return m_watchdogAborts; }
+        void attachState(ASDeviceRetainedState* state);
+
+        void beginSession() { m_scheduler.acquire(); }
+        void endSession() { m_scheduler.release(); }
+        ASDeviceSchedulerStatistics contentionStatistics() const { return m_scheduler.statistics(); }
+        void resetContentionStatistics() { m_scheduler.resetStatistics(); }
+        const ASDeviceProtocolStatistics& protocolStatistics() const { return m_protocolStatistics; }
+        void resetProtocolStatistics() { m_protocolStatistics.reset(); }
+
+        static double deadlineAfter(unsigned ms);
+        bool wasCancelled() const { return m_lastOperationCancelled; }
+
+        void setWriteBlockProbing(bool enable);
+        bool writeBlockProbing() const { return m_writeBlockProbing; }
+        unsigned writeBlockSize() const { return m_writeBlockSize; }
+        const ASDeviceWriteBlockStatistics* writeBlockStatistics(unsigned* count) const { *count = kASWriteBlockSizeCount; return m_writeBlockStatistics; }
+        void resetWriteBlockStatistics();
+        void logWriteBlockStatistics() const;
+
+        void setPipelinedReads(bool enable);
+        bool pipelinedReads() const { return m_pipelineRequested && !m_pipelineFailed; }
+        const ASDeviceReadStatistics& readStatistics(bool pipelined) const { return m_readStatistics[(pipelined) ? 1 : 0]; }
+        void resetReadStatistics();
+        void logReadStatistics() const;
 
         bool restart();
 
@@ -79,6 +337,13 @@ namespace ts
 
         const ASApplet* appletAtIndex(int appletIndex);
         const ASApplet* appletForID(ASAppletID appletID);
+        bool continueAppletEnumeration(unsigned pageLimit, bool* complete);
+        bool isAppletEnumerationComplete() const { return m_appletsComplete; }
+
+        bool readApplet(ASDeviceDataSink sink, void* context, const ASApplet* applet, unsigned* actual,
+            const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+        bool writeApplet(const ASApplet* image);
+        static bool fileSink(void* context, const void* data, unsigned size);
 
         bool getAppletResourceUsage(unsigned* fc, unsigned* ram, const ASApplet* applet);
 
@@ -92,14 +357,24 @@ namespace ts
             return -1;  // REVIEW: implement me?
         }
         unsigned fileSize(const ASApplet* applet, int fileIndex);
-        bool readFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw);
+        bool listFiles(const ASApplet* applet, AQContainer<ASFileAttributes>* files,
+            const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+        bool readFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+            const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+        bool readFile(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+            const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
         bool createFile(const char* filename, const char* password, const void* buffer, unsigned size, const ASApplet* applet, int* fileIndex, bool raw);
-        bool writeFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw);
+        bool createFiles(ASDeviceFileRequest* files, unsigned count, const ASApplet* applet, bool raw, bool trim, unsigned* created);
+        bool writeFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw,
+            const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
 
         bool clearAllFiles(const ASApplet* applet);
         bool clearFile(const ASApplet* applet, int fileIndex);
+        bool clearFiles(const ASApplet* applet, const int* indices, unsigned count, unsigned* cleared);
+        static bool clearFilesOnDevices(ASDevice* const* devices, unsigned deviceCount, ASAppletID appletID, const int* indices, unsigned count, bool* results=0);
 
         bool readSettings(void* buffer, unsigned* actual, unsigned size, const ASApplet* applet, unsigned flags);
+        bool readAllSettings(ASSettingsCollection* collection, unsigned flags=0x0b);
 
     protected:
 
@@ -111,12 +386,18 @@ namespace ts
         bool rawGetFileAttributes(uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index, unsigned* actual);
         bool rawSetFileAttributes(const uint8_t attr[kASFileAttributesSize], ASAppletID applet, int index);
         bool rawReadFile(void* dest, unsigned size, unsigned* actual, ASAppletID applet, int index, bool raw=false);
-        bool rawWriteFile(const void* source, unsigned size, ASAppletID applet, int index, bool raw=false);
+        bool rawReadFile(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual, ASAppletID applet, int index, bool raw=false);
+        bool rawWriteFile(const void* source, unsigned size, ASAppletID applet, int index, bool raw=false, bool adaptive=false);
+        bool rawSystemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64]);
+        bool rawRequestSettings(ASAppletID applet, unsigned flags, unsigned* size, unsigned* checksum);
+        bool rawReadSettings(ASSettingsCollection* collection, ASAppletID applet, unsigned flags);
+        bool rawGetAvailableSpace(unsigned* ram, unsigned* rom);
+        bool rawGetUsedSpace(unsigned* fc, unsigned* ram, ASAppletID applet);
 
 
         /** The derived class should call this once it has completed its initialisation.
          */
-        void initialise();
+        void initialise(const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
 
 
         /** Read data from the device.
@@ -141,20 +422,147 @@ namespace ts
          */
         virtual bool write(const void* buffer, unsigned length, unsigned timeout=0) = 0;
 
+        /** Abort any transfer in progress, causing a blocked read() or write() to fail promptly. This is
+         *  called by the watchdog (see ASDeviceWatchdog) from its own thread. The default does nothing, in
+         *  which case a hung transfer will wait for the transport timeout as before.
+         */
+        virtual void abortTransfer() { }
+
 
     private:
 
+        /** Locally tracked resource usage for a single applet.
+         */
+        struct AppletUsage
+        {
+            ASAppletID appletID;                            /**< The applet. */
+            unsigned fileCount;                             /**< The number of files owned by the applet. */
+            unsigned ramUsed;                               /**< The number of bytes of RAM used by the applet's files. */
+            unsigned fileSize[kASDeviceMaxFileIndex + 1];   /**< Allocated size of each file, by index, or kASDeviceFileSizeUnknown. */
+        };
+
         uint8_t* m_appletHeaderData;                        /**< Locally cached copy of the applet header data. */
-        unsigned m_appletHeaderCount;                       /**< The number of applet headers present on the device. */
+        unsigned m_appletHeaderCount;                       /**< The number of applet headers read from the device so far. */
+        bool m_appletsComplete;                             /**< Logical true once every applet header has been read. */
         AQContainer<ASApplet> m_applets;                    /**< Applet list for the device. */
+        char m_appletCachePath[1200];                       /**< Applet header cache file, or empty if not caching. */
+        char m_systemName[64];                              /**< The OS name (used to validate the applet header cache). */
+        char m_systemDate[64];                              /**< The OS build date (used to validate the applet header cache). */
+
+        bool m_memoryValid;                                 /**< Logical true if m_freeRam and m_freeRom are in sync with the device. */
+        unsigned m_freeRam;                                 /**< Locally tracked free RAM, in bytes. */
+        unsigned m_freeRom;                                 /**< Locally tracked free ROM, in bytes. */
+        AQContainer<AppletUsage> m_appletUsage;             /**< Locally tracked per-applet usage (only applets queried so far). */
+
+        ASDeviceRetryPolicy m_retryPolicy;                  /**< The retry policy. */
+        ASDeviceRetryStatistics m_retryStatistics;          /**< Retry statistics. */
+        bool m_operationRejected;                           /**< Set if the current attempt failed for a reason that a retry cannot fix. */
+        bool m_unsafeRequestSent;                           /**< Set if the current attempt has sent a non-idempotent command. */
+        unsigned m_randomSeed;                              /**< State for the retry jitter (rand_r()), or zero if not yet seeded. */
+
+        const ASDeviceCancelToken* m_cancelToken;           /**< Cancellation token for the current operation, or zero. */
+        double m_deadline;                                  /**< Deadline for the current operation, or kASDeviceNoDeadline. */
+        bool m_operationCancelled;                          /**< Set if the current operation has been cancelled or has run out of time. */
+        bool m_lastOperationCancelled;                      /**< Set if the last operation with limits was cancelled (see wasCancelled()). */
+
+        unsigned m_systemMajor;                             /**< The OS major version (valid if m_systemKnown). */
+        unsigned m_systemMinor;                             /**< The OS minor version (valid if m_systemKnown). */
+        bool m_systemKnown;                                 /**< Logical true if the OS version was read by initialise(). */
+        unsigned m_writeBlockSize;                          /**< The largest BLOCK_WRITE size known to work. */
+        unsigned m_writeBlockRejected;                      /**< The smallest BLOCK_WRITE size known to fail, or zero. */
+        bool m_writeBlockProbing;                           /**< Logical true if the client has enabled adaptive BLOCK_WRITE sizing. */
+        ASDeviceWriteBlockStatistics m_writeBlockStatistics[kASWriteBlockSizeCount];   /**< Upload statistics, by size. */
+        bool m_pipelineRequested;                           /**< Logical true if the client has enabled pipelined reads. */
+        bool m_pipelineFailed;                              /**< Logical true if pipelined reads have failed on this device or OS. */
+        ASDeviceReadStatistics m_readStatistics[2];         /**< Read statistics, unpipelined and pipelined. */
+
+        ASDeviceScheduler m_scheduler;                      /**< Arbitrates access to the device between threads. */
+        unsigned m_dialogueDepth;                           /**< The number of open dialogues (only changed by the scheduler owner). */
+        ASDeviceProtocolStatistics m_protocolStatistics;    /**< Protocol counters and latency histograms. */
+        ASDeviceRetainedState* m_retainedState;             /**< State from a previous connection, to be used by initialise(). */
+        double m_watchdogDeadline;                          /**< Time limit for the current exchange, or zero (protected by the watchdog). */
+        volatile bool m_watchdogFired;                      /**< Set by the watchdog when it aborts a transfer. */
+        bool m_watchdogDisabled;                            /**< Set while writing flash, when the watchdog is not armed. */
+        unsigned m_watchdogLimit;                           /**< Watchdog limit for each transfer in the current exchange, in ms, or zero. */
+        bool m_transferAborted;                             /**< Set if the watchdog aborted a transfer in the current attempt. */
+        unsigned m_watchdogAborts;                          /**< The number of hung transfers aborted. */
+        unsigned m_healthScore;                             /**< The device health score (0 to kASDeviceHealthMax). */
+
+        friend class ASDeviceWatchdog;
+
+        friend class ASDeviceLease;
 
         void clearEnumeratedApplets();
+
+        // Retry handling. The public operations wrap these, which each perform a single attempt.
+        void beginAttempt();
+        bool retryOperation(bool result, unsigned* attempt, bool unsafeOk=false);
+
+        // Cancellation and deadlines. The limits apply from beginLimits() until endLimits().
+        void beginLimits(const ASDeviceCancelToken* cancel, double deadline);
+        void endLimits();
+        bool checkLimits();
+        unsigned transferTimeout() const;
+
+        // Adaptive BLOCK_WRITE sizing (see writeExtendedData())
+        unsigned nextWriteBlockSize() const;
+        void writeBlockAccepted(unsigned blockSize);
+        void writeBlockRejected(unsigned blockSize);
+        void recordWriteBlock(unsigned blockSize, unsigned bytes, double seconds);
+        void loadTransferProfile();
+        void saveTransferProfile() const;
+        bool adoptRetainedState();
+        void watchdogEnd();
+        void adjustHealth(int delta);
+
+        // Pipelined block reads (see readExtendedData())
+        void pipelineFailed();
+        void drainBlockRead();
+        bool discardData(unsigned size);
+        bool doReadFile(void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw);
+        bool doCreateFile(const char* filename, const char* password, const void* buffer, unsigned size, const ASApplet* applet, int* fileIndex, bool raw);
+        bool doWriteFile(const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw, bool adaptive);
+        bool doClearFile(const ASApplet* applet, int fileIndex);
+        bool doClearFiles(const ASApplet* applet, const int* indices, unsigned count, unsigned* cleared);
+        bool doListFiles(const ASApplet* applet, AQContainer<ASFileAttributes>* files);
+        bool doGetFileAttributes(ASFileAttributes* attr, const ASApplet* applet, int fileIndex);
+        bool doSetFileAttributes(const ASApplet* applet, int fileIndex, const ASFileAttributes* attr);
+        bool doGetAppletResourceUsage(unsigned* fc, unsigned* ram, const ASApplet* applet);
+        bool doSystemVersion(unsigned* major, unsigned* minor, char systemName[64], char systemDate[64]);
+        bool doSystemMemory(unsigned* ram, unsigned* rom);
+        bool doReadSettings(void* buffer, unsigned* actual, unsigned size, const ASApplet* applet, unsigned flags);
+        bool doReadAllSettings(ASSettingsCollection* collection, unsigned flags);
+
+        bool enumerateAppletPage();
+        void appendApplets(unsigned first);
+        bool readAppletHeaderPage(bool* complete);
+        bool loadAppletCache(const char* path, const char* systemName, const char* systemDate);
+        void saveAppletCache(const char* path, const char* systemName, const char* systemDate) const;
+        bool validateAppletCache();
+
+        // Local memory accounting (avoids re-querying the device for every file operation)
+        bool syncMemoryAccounting(ASAppletID applet, AppletUsage** usage);
+        AppletUsage* findAppletUsage(ASAppletID applet) const;
+        void setAppletUsage(ASAppletID applet, unsigned fc, unsigned ram);
+        void accountForResize(ASAppletID applet, unsigned oldSize, unsigned newSize);
+        void setTrackedFileSize(ASAppletID applet, int fileIndex, unsigned size);
+        unsigned trackedFileSize(ASAppletID applet, int fileIndex) const;
+        void invalidateMemoryAccounting();
+
+        bool clearFileInDialogue(ASAppletID applet, int fileIndex);
+        bool createFileInDialogue(const char* filename, const char* password, const void* buffer, unsigned size, ASAppletID applet, AppletUsage* usage, int* fileIndex, bool raw);
+
+        static unsigned watchdogLimit(unsigned command);
+        bool transferRead(void* buffer, unsigned length, unsigned* actual=0, unsigned timeout=0);
+        bool transferWrite(const void* buffer, unsigned length, unsigned timeout=0);
         bool sendRequest(const ASMessage* request);
         bool getResponse(ASMessage* response);
         bool sendRequestAndGetResponse(ASMessage* message);
         bool sendRequestAndGetResponse(ASMessage* message, unsigned code);
+        bool sendRequestAndCheckResponse(ASMessage* message);
         bool readExtendedData(void *dest, unsigned size, unsigned* actual);
-        bool writeExtendedData(const void* source, unsigned size);
+        bool readExtendedData(ASDeviceDataSink sink, void* context, unsigned size, unsigned* actual);
+        bool writeExtendedData(const void* source, unsigned size, bool adaptive=false);
         unsigned calculateDataChecksum(const void *data, unsigned int length) const;
 
         // Basic protocol
@@ -162,23 +570,77 @@ namespace ts
         bool reset();
         bool switchApplet(ASAppletID applet=kASAppletID_System);
 
-        // Framing for command transactions
+        // Framing for command transactions. Each dialogue holds the device scheduler, so dialogues from different
+        // threads are serialised (with interactive requests taking priority).
         bool dialogueStart(ASAppletID applet=kASAppletID_System)
         {
-            return hello() && reset() && switchApplet(applet);
+            m_scheduler.acquire();
+            m_dialogueDepth ++;
+            m_protocolStatistics.dialogue();
+            m_watchdogLimit = kASWatchdogDialogueLimit;
+            if (checkLimits() && hello() && reset() && switchApplet(applet)) return true;
+            watchdogEnd();
+            m_dialogueDepth --;
+            m_scheduler.release();
+            return false;
         }
 
         bool dialogueEnd(bool status)
         {
+            m_watchdogLimit = kASWatchdogDialogueLimit;
             reset();
+            watchdogEnd();
+            m_dialogueDepth --;
+            m_scheduler.release();
             return status;
         }
 
+        // The device can only be yielded while it is held by the operation's own lease and one dialogue
+        bool yieldRequested() const { return (1 == m_dialogueDepth) && m_scheduler.yieldRequested(2); }
+
+        bool dialogueYield(ASAppletID applet=kASAppletID_System);
+
 
         ASDevice(const ASDevice&);              /**< Prevent the use of the copy constructor. */
         ASDevice& operator=(const ASDevice&);   /**< Prevent the use of the assignment operator. */
     };
 
+
+    /** Session lease: holds a device for the lifetime of the object. Every public ASDevice operation holds
+     *  a lease internally, so concurrent callers are serialised a whole operation at a time. Clients can
+     *  also hold a lease themselves to run a sequence of operations without other threads interleaving.
+     *  Leases nest, so operations can be called freely while one is held.
+     *
+     *  The lease also names the operation that protocol traffic is attributed to in the device's
+     *  protocol statistics (see ASDeviceProtocolStatistics).
+     */
+    class ASDeviceLease
+    {
+    public:
+
+        explicit ASDeviceLease(ASDevice* device, unsigned operation=kASDeviceOperationNone)
+            :
+            m_device(device)
+        {
+            m_device->beginSession();
+            m_previousOperation = m_device->m_protocolStatistics.enterOperation(operation);
+        }
+
+        ~ASDeviceLease()
+        {
+            m_device->m_protocolStatistics.leaveOperation(m_previousOperation);
+            m_device->endSession();
+        }
+
+    private:
+
+        ASDevice* m_device;                     /**< The device. */
+        unsigned m_previousOperation;           /**< The operation to restore when the lease ends. */
+
+        ASDeviceLease(const ASDeviceLease&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceLease& operator=(const ASDeviceLease&);     /**< Prevent the use of the assignment operator. */
+    };
+
 }   // namespace
 
 #endif      // COM_TSONIQ_ASDevice_H
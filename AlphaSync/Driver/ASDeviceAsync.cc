@@ -0,0 +1,351 @@
+/** @file   ASDeviceAsync.cc
+ *  @brief  Device operations run on a worker thread pool, with completion callbacks.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ASDeviceAsync.h"
+
+#define kASDeviceAsyncListFiles     (0)         /**< Job code for ASDevice::listFiles(). */
+#define kASDeviceAsyncReadFile      (1)         /**< Job code for ASDevice::readFile(). */
+#define kASDeviceAsyncWriteFile     (2)         /**< Job code for ASDevice::writeFile(). */
+
+namespace ts
+{
+    /** A queued operation and its arguments.
+     */
+    struct ASDeviceAsyncJob
+    {
+        unsigned operation;                     /**< The job code. */
+        ASDevice* device;                       /**< The device. */
+        const ASApplet* applet;                 /**< The applet. */
+        int fileIndex;                          /**< The file index (read and write). */
+        void* buffer;                           /**< The read buffer. */
+        const void* data;                       /**< The write data. */
+        unsigned size;                          /**< The buffer or data size, in bytes. */
+        unsigned* actual;                       /**< Returns the number of bytes read. */
+        bool raw;                               /**< Logical true for raw file data. */
+        AQContainer<ASFileAttributes>* files;   /**< Receives the file list. */
+        ASDeviceCompletion completion;          /**< The completion callback, or zero. */
+        void* context;                          /**< The completion context. */
+        const ASDeviceCancelToken* cancel;      /**< The cancellation token, or zero. */
+        double deadline;                        /**< The deadline, or kASDeviceNoDeadline. */
+    };
+
+
+    /** Constructor.
+     *
+     *  @param  threadCount     The number of worker threads. Zero is treated as one. If no threads can be
+     *                          started, operations are run synchronously when they are queued.
+     */
+    ASDeviceAsync::ASDeviceAsync(unsigned threadCount)
+        :
+        m_queue(),
+        m_busy(),
+        m_pending(0),
+        m_stopping(false),
+        m_threads(0),
+        m_threadCount(0)
+    {
+        pthread_mutex_init(&m_lock, 0);
+        pthread_cond_init(&m_workChanged, 0);
+        pthread_cond_init(&m_idle, 0);
+
+        if (0 == threadCount) threadCount = 1;
+        m_threads = (pthread_t*)calloc(threadCount, sizeof (pthread_t));
+        if (m_threads)
+        {
+            while (m_threadCount < threadCount && 0 == pthread_create(&m_threads[m_threadCount], 0, workerThread, this)) m_threadCount ++;
+        }
+        if (0 == m_threadCount) fprintf(stderr, "%s: no worker threads - operations will run synchronously\n", __FUNCTION__);
+    }
+
+
+    /** Destructor. Any outstanding operations are completed before the worker threads exit.
+     */
+    ASDeviceAsync::~ASDeviceAsync()
+    {
+        waitAll();
+
+        pthread_mutex_lock(&m_lock);
+        m_stopping = true;
+        pthread_cond_broadcast(&m_workChanged);
+        pthread_mutex_unlock(&m_lock);
+
+        for (unsigned i = 0; i < m_threadCount; i++) pthread_join(m_threads[i], 0);
+        free(m_threads);
+
+        pthread_cond_destroy(&m_idle);
+        pthread_cond_destroy(&m_workChanged);
+        pthread_mutex_destroy(&m_lock);
+    }
+
+
+    /** Queue a request for the attributes of every file owned by an applet (see ASDevice::listFiles()).
+     *  The operation fails if the applet has more files than the protocol can address (kASDeviceMaxFileIndex).
+     *
+     *  @param  device      The device.
+     *  @param  applet      The applet.
+     *  @param  files       Container to receive the attributes.
+     *  @param  completion  The completion callback, or zero.
+     *  @param  context     The completion context.
+     *  @param  cancel      Optional cancellation token.
+     *  @param  deadline    Optional absolute deadline (see ASDevice::deadlineAfter()).
+     *  @return             Logical true if the operation was queued.
+     */
+    bool ASDeviceAsync::listFiles(ASDevice* device, const ASApplet* applet, AQContainer<ASFileAttributes>* files,
+        ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceAsyncJob* job = (ASDeviceAsyncJob*)calloc(1, sizeof (ASDeviceAsyncJob));
+        if (!job) return false;
+        job->operation = kASDeviceAsyncListFiles;
+        job->device = device;
+        job->applet = applet;
+        job->files = files;
+        job->completion = completion;
+        job->context = context;
+        job->cancel = cancel;
+        job->deadline = deadline;
+        return submit(job);
+    }
+
+
+    /** Queue a file read (see ASDevice::readFile()). The buffer must remain valid until the completion
+     *  callback has run.
+     *
+     *  @param  device      The device.
+     *  @param  buffer      Buffer to receive the file data.
+     *  @param  size        The buffer size, in bytes.
+     *  @param  actual      Returns the number of bytes read.
+     *  @param  applet      The applet.
+     *  @param  fileIndex   The file index.
+     *  @param  raw         Logical true to return raw data.
+     *  @param  completion  The completion callback, or zero.
+     *  @param  context     The completion context.
+     *  @param  cancel      Optional cancellation token.
+     *  @param  deadline    Optional absolute deadline (see ASDevice::deadlineAfter()).
+     *  @return             Logical true if the operation was queued.
+     */
+    bool ASDeviceAsync::readFile(ASDevice* device, void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+        ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceAsyncJob* job = (ASDeviceAsyncJob*)calloc(1, sizeof (ASDeviceAsyncJob));
+        if (!job) return false;
+        job->operation = kASDeviceAsyncReadFile;
+        job->device = device;
+        job->applet = applet;
+        job->fileIndex = fileIndex;
+        job->buffer = buffer;
+        job->size = size;
+        job->actual = actual;
+        job->raw = raw;
+        job->completion = completion;
+        job->context = context;
+        job->cancel = cancel;
+        job->deadline = deadline;
+        return submit(job);
+    }
+
+
+    /** Queue a file write (see ASDevice::writeFile()). The data must remain valid until the completion
+     *  callback has run.
+     *
+     *  @param  device      The device.
+     *  @param  buffer      The file data.
+     *  @param  size        The data size, in bytes.
+     *  @param  applet      The applet.
+     *  @param  fileIndex   The file index.
+     *  @param  raw         Logical true if the data is raw.
+     *  @param  completion  The completion callback, or zero.
+     *  @param  context     The completion context.
+     *  @param  cancel      Optional cancellation token.
+     *  @param  deadline    Optional absolute deadline (see ASDevice::deadlineAfter()).
+     *  @return             Logical true if the operation was queued.
+     */
+    bool ASDeviceAsync::writeFile(ASDevice* device, const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw,
+        ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel, double deadline)
+    {
+        ASDeviceAsyncJob* job = (ASDeviceAsyncJob*)calloc(1, sizeof (ASDeviceAsyncJob));
+        if (!job) return false;
+        job->operation = kASDeviceAsyncWriteFile;
+        job->device = device;
+        job->applet = applet;
+        job->fileIndex = fileIndex;
+        job->data = buffer;
+        job->size = size;
+        job->raw = raw;
+        job->completion = completion;
+        job->context = context;
+        job->cancel = cancel;
+        job->deadline = deadline;
+        return submit(job);
+    }
+
+
+    /** Return the number of operations that are queued or running.
+     */
+    unsigned ASDeviceAsync::pendingCount()
+    {
+        pthread_mutex_lock(&m_lock);
+        unsigned pending = m_pending;
+        pthread_mutex_unlock(&m_lock);
+        return pending;
+    }
+
+
+    /** Block until every queued operation has completed. This must not be called from a completion callback.
+     */
+    void ASDeviceAsync::waitAll()
+    {
+        pthread_mutex_lock(&m_lock);
+        while (0 != m_pending) pthread_cond_wait(&m_idle, &m_lock);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Queue a job, taking ownership of it.
+     *
+     *  @param  job         The job.
+     *  @return             Logical true if the job was queued.
+     */
+    bool ASDeviceAsync::submit(ASDeviceAsyncJob* job)
+    {
+        if (0 == m_threadCount)
+        {
+            // No workers: run now, on the caller's thread
+            bool result = runJob(job);
+            if (job->completion) job->completion(job->context, job->device, result);
+            free(job);
+            return true;
+        }
+
+        pthread_mutex_lock(&m_lock);
+        bool result = m_queue.appendItem(job);
+        if (result)
+        {
+            m_pending ++;
+            pthread_cond_signal(&m_workChanged);
+        }
+        pthread_mutex_unlock(&m_lock);
+
+        if (!result) free(job);
+        return result;
+    }
+
+
+    /** Remove and return the oldest queued job whose device is idle, marking the device busy. This
+     *  keeps the operations for any one device in submission order. The lock must be held.
+     *
+     *  @return             The job, or zero if there is nothing that can run yet.
+     */
+    ASDeviceAsyncJob* ASDeviceAsync::nextJob()
+    {
+        unsigned count = m_queue.count();
+        for (unsigned i = 0; i < count; i++)
+        {
+            ASDeviceAsyncJob* job = m_queue.itemAtIndex(i);
+            if (m_busy.containsItem(job->device)) continue;
+            if (!m_busy.appendItem(job->device)) return 0;
+            m_queue.removeItemAtIndex(i);
+            return job;
+        }
+        return 0;
+    }
+
+
+    /** Complete a job: mark its device idle and release the job. The lock must be held.
+     *
+     *  @param  job         The job.
+     */
+    void ASDeviceAsync::finishJob(ASDeviceAsyncJob* job)
+    {
+        m_busy.removeItem(job->device);
+        free(job);
+        m_pending --;
+        if (0 == m_pending) pthread_cond_broadcast(&m_idle);
+        pthread_cond_broadcast(&m_workChanged);         // other jobs for the device may now run
+    }
+
+
+    /** Perform the device operation for a job.
+     *
+     *  @param  job         The job.
+     *  @return             The operation result.
+     */
+    bool ASDeviceAsync::runJob(ASDeviceAsyncJob* job)
+    {
+        switch (job->operation)
+        {
+            case kASDeviceAsyncListFiles:
+                return job->device->listFiles(job->applet, job->files, job->cancel, job->deadline);
+
+            case kASDeviceAsyncReadFile:
+                return job->device->readFile(job->buffer, job->size, job->actual, job->applet, job->fileIndex, job->raw, job->cancel, job->deadline);
+
+            case kASDeviceAsyncWriteFile:
+                return job->device->writeFile(job->data, job->size, job->applet, job->fileIndex, job->raw, job->cancel, job->deadline);
+
+            default:
+                fprintf(stderr, "%s: unknown operation %u\n", __FUNCTION__, job->operation);
+                return false;
+        }
+    }
+
+
+    /** Worker thread: run jobs until asked to stop.
+     */
+    void* ASDeviceAsync::workerThread(void* context)
+    {
+        ASDeviceAsync* async = (ASDeviceAsync*)context;
+        ASDeviceScheduler::setThreadPriority(kASDevicePriorityBulk);
+
+        pthread_mutex_lock(&async->m_lock);
+        while (true)
+        {
+            ASDeviceAsyncJob* job = async->nextJob();
+            if (!job)
+            {
+                if (async->m_stopping) break;
+                pthread_cond_wait(&async->m_workChanged, &async->m_lock);
+                continue;
+            }
+            pthread_mutex_unlock(&async->m_lock);
+
+            bool result = runJob(job);
+            if (job->completion) job->completion(job->context, job->device, result);
+
+            pthread_mutex_lock(&async->m_lock);
+            async->finishJob(job);
+        }
+        pthread_mutex_unlock(&async->m_lock);
+        return 0;
+    }
+
+}   // namespace
@@ -0,0 +1,109 @@
+/** @file   ASDeviceAsync.h
+ *  @brief  Device operations run on a worker thread pool, with completion callbacks.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef COM_TSONIQ_ASDeviceAsync_H
+#define COM_TSONIQ_ASDeviceAsync_H   (1)
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ASDevice.h"
+#include "AQContainer.h"
+
+namespace ts
+{
+    struct ASDeviceAsyncJob;
+
+    /** Completion callback for an asynchronous operation. This is called on a worker thread once the
+     *  operation has finished. Any output arguments passed when the operation was queued are valid
+     *  by the time the callback runs.
+     *
+     *  @param  context     The client context passed when the operation was queued.
+     *  @param  device      The device.
+     *  @param  result      Logical true if the operation succeeded.
+     */
+    typedef void (*ASDeviceCompletion)(void* context, ASDevice* device, bool result);
+
+
+    /** Class used to run device operations on a bounded pool of worker threads, with completion callbacks.
+     *
+     *  Operations are queued and return immediately, with the result reported through a completion
+     *  callback. Each worker runs one operation at a time using the normal blocking ASDevice calls, so
+     *  the number of transfers actually in progress is limited to the number of worker threads; further
+     *  requests wait in the queue. Operations for the same device run one at a time in the order they
+     *  were queued, while operations for different devices run in parallel, up to the number of worker
+     *  threads. The devices must not be used directly by any other thread while they have operations
+     *  outstanding.
+     *
+     *  A cancellation token passed with an operation is checked both before the operation starts and
+     *  while it runs, so a batch of queued requests can be abandoned by cancelling a shared token.
+     */
+    class ASDeviceAsync
+    {
+    public:
+
+        ASDeviceAsync(unsigned threadCount);
+        ~ASDeviceAsync();
+
+        bool listFiles(ASDevice* device, const ASApplet* applet, AQContainer<ASFileAttributes>* files,
+            ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+        bool readFile(ASDevice* device, void* buffer, unsigned size, unsigned* actual, const ASApplet* applet, int fileIndex, bool raw,
+            ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+        bool writeFile(ASDevice* device, const void* buffer, unsigned size, const ASApplet* applet, int fileIndex, bool raw,
+            ASDeviceCompletion completion, void* context, const ASDeviceCancelToken* cancel=0, double deadline=kASDeviceNoDeadline);
+
+        unsigned pendingCount();
+        void waitAll();
+
+    private:
+
+        pthread_mutex_t m_lock;                         /**< Protects all of the following. */
+        pthread_cond_t m_workChanged;                   /**< Signalled when a job is queued or a device becomes free. */
+        pthread_cond_t m_idle;                          /**< Signalled when the last pending job completes. */
+        AQContainer<ASDeviceAsyncJob> m_queue;          /**< Jobs that have not yet started, in submission order. */
+        AQContainer<ASDevice> m_busy;                   /**< Devices with a job currently running. */
+        unsigned m_pending;                             /**< Jobs queued or running. */
+        bool m_stopping;                                /**< Logical true once the workers have been asked to exit. */
+        pthread_t* m_threads;                           /**< The worker threads. */
+        unsigned m_threadCount;                         /**< The number of worker threads started. */
+
+        bool submit(ASDeviceAsyncJob* job);
+        ASDeviceAsyncJob* nextJob();
+        void finishJob(ASDeviceAsyncJob* job);
+        static bool runJob(ASDeviceAsyncJob* job);
+        static void* workerThread(void* context);
+
+        ASDeviceAsync(const ASDeviceAsync&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceAsync& operator=(const ASDeviceAsync&);     /**< Prevent the use of the assignment operator. */
+    };
+
+}   // namespace
+
+#endif      // COM_TSONIQ_ASDeviceAsync_H
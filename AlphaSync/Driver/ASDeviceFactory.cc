@@ -73,7 +73,7 @@ namespace ts
         ASDeviceUSB();
         ~ASDeviceUSB();
 
-        bool init(io_service_t serviceHandle);
+        bool init(io_service_t serviceHandle, ASDeviceStatePool* pool);
 
         /** Return the service handle passed at the call to init().
          */
@@ -89,6 +89,7 @@ namespace ts
 
         virtual bool read(void* buffer, unsigned length, unsigned* actual, unsigned timeout);
         virtual bool write(const void* buffer, unsigned length, unsigned timeout);
+        virtual void abortTransfer();
 
     private:
 
@@ -136,12 +137,17 @@ namespace ts
     /** Initialise the object.
      *
      *  @param  serviceHandle   The service handle.
+     *  @param  pool            Pool of state retained from disconnected devices, or zero.
      *  @return                 Logical true if the device could be initialised.
      */
-    bool ASDeviceUSB::init(io_service_t serviceHandle)
+    bool ASDeviceUSB::init(io_service_t serviceHandle, ASDeviceStatePool* pool)
     {
         m_service = serviceHandle;
-        return open();
+        if (!open()) return false;
+
+        if (pool) attachState(pool->take(m_identity));     // Reuse state from an earlier connection, if any
+        initialise();       // Initialise the parent class, now that the transport is operational
+        return true;
     }
 
 
@@ -288,8 +294,6 @@ namespace ts
         m_pipeOut = pipeOut;
         m_pipeIn = pipeIn;
 
-        initialise();       // Initialise the parent class, now that the transport is operational
-
         return true;
 
 
@@ -455,6 +459,22 @@ namespace ts
 
 
 
+    /** Abort any transfer in progress on either pipe. This is called from the watchdog thread. The blocked
+     *  read or write fails with kIOReturnAborted, and its stall recovery clears the pipe for further use.
+     */
+    void ASDeviceUSB::abortTransfer()
+    {
+        if (m_interface)
+        {
+            (*m_interface)->AbortPipe(m_interface, m_pipeIn);
+            (*m_interface)->AbortPipe(m_interface, m_pipeOut);
+        }
+    }
+
+
+
+
+
     #pragma mark    ---------------- ASDeviceFactoryUSB : MacOSX specific USB implementation ----------------
 
 
@@ -495,6 +515,7 @@ namespace ts
         io_iterator_t m_comDeviceAddedIter;                 /**< Iterator for COM device added. */
         io_iterator_t m_comDeviceRemovedIter;               /**< Iterator for COM device removed. */
         ASDeviceUSB* m_deviceList[kAQMaxDevices];           /**< Array of active device references. */
+        ASDeviceStatePool m_retainedStates;                 /**< State of recently removed devices. */
 
         friend void aq_hidDeviceAdded(void *refCon, io_iterator_t iterator);
         friend void aq_comDeviceAdded(void *refCon, io_iterator_t iterator);
@@ -519,7 +540,8 @@ namespace ts
             m_hidDeviceAddedIter(0),
             m_comDeviceAddedIter(0),
             m_comDeviceRemovedIter(0),
-            m_deviceList()
+            m_deviceList(),
+            m_retainedStates()
     {
         for (unsigned i = 0; i < kAQMaxDevices; i++)
         {
@@ -781,7 +803,7 @@ namespace ts
             ASDeviceUSB* device = new ASDeviceUSB;
             if (device)
             {
-                if (!device->init(serviceHandle))
+                if (!device->init(serviceHandle, &m_retainedStates))
                 {
                     fprintf(stderr, "%s: ASDeviceUSB init failed\n", __FUNCTION__);
                     delete device;
@@ -813,6 +835,7 @@ namespace ts
             ASDeviceUSB* device = m_deviceList[index];
             if (m_callbackDisconnect) m_callbackDisconnect(m_factory, m_callbackContext, device->identity(), device);
             m_deviceList[index] = 0;
+            m_retainedStates.retain(device->detachState());
             delete device;
         }
     }
@@ -0,0 +1,427 @@
+/** @file   ASDeviceProtocolStatistics.cc
+ *  @brief  Per-device protocol counters and latency histograms.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ASDeviceProtocolStatistics.h"
+#include "ASMessage.h"
+
+namespace ts
+{
+    /** Operation names, indexed by kASDeviceOperationXXX.
+     */
+    static const char* const s_operationNames[kASDeviceOperationCount] =
+    {
+        "none",
+        "initialise",
+        "enumerate applets",
+        "read file",
+        "write file",
+        "create file",
+        "clear file",
+        "list files",
+        "file attributes",
+        "resource usage",
+        "system info",
+        "read settings",
+        "read applet",
+        "write applet",
+        "restart"
+    };
+
+
+    /** Return the name of an operation class.
+     */
+    const char* ASDeviceProtocolStatistics::operationName(unsigned operation)
+    {
+        return (operation < kASDeviceOperationCount) ? s_operationNames[operation] : "unknown";
+    }
+
+
+
+#pragma mark    --------  Latency histogram  --------
+
+
+
+    /** Return the bucket for a value. Values below kASLatencySubBuckets have a bucket each. Above that, the
+     *  value's top three significant bits select one of eight buckets for its power of two.
+     */
+    unsigned ASLatencyHistogram::bucketForValue(unsigned value)
+    {
+        if (value > kASLatencyMaxValue) value = kASLatencyMaxValue;
+        if (value < kASLatencySubBuckets) return value;
+
+        unsigned shift = 0;
+        while ((value >> shift) >= (2 * kASLatencySubBuckets)) shift ++;
+        return kASLatencySubBuckets + (shift * kASLatencySubBuckets) + ((value >> shift) - kASLatencySubBuckets);
+    }
+
+
+    /** Return the lowest value that maps to a bucket.
+     */
+    unsigned ASLatencyHistogram::valueForBucket(unsigned bucket)
+    {
+        if (bucket < kASLatencySubBuckets) return bucket;
+
+        unsigned shift = (bucket - kASLatencySubBuckets) / kASLatencySubBuckets;
+        unsigned top = kASLatencySubBuckets + ((bucket - kASLatencySubBuckets) % kASLatencySubBuckets);
+        return top << shift;
+    }
+
+
+    /** Remove all samples.
+     */
+    void ASLatencyHistogram::clear()
+    {
+        memset(this, 0, sizeof *this);
+    }
+
+
+    /** Record a sample.
+     *
+     *  @param  value       The sample, in microseconds.
+     */
+    void ASLatencyHistogram::record(unsigned value)
+    {
+        counts[bucketForValue(value)] ++;
+        if (0 == count || value < minimum) minimum = value;
+        if (value > maximum) maximum = value;
+        total += value;
+        count ++;
+    }
+
+
+    /** Return an approximate percentile (the lower bound of the bucket holding it, limited to the actual
+     *  range of the samples).
+     *
+     *  @param  percent     The percentile (0 to 100).
+     *  @return             The value, in microseconds, or zero if there are no samples.
+     */
+    unsigned ASLatencyHistogram::percentile(double percent) const
+    {
+        if (0 == count) return 0;
+
+        double target = (percent / 100.0) * count;
+        unsigned seen = 0;
+        for (unsigned i = 0; i < kASLatencyBuckets; i++)
+        {
+            seen += counts[i];
+            if (seen > 0 && seen >= target)
+            {
+                unsigned value = valueForBucket(i);
+                if (value < minimum) value = minimum;
+                if (value > maximum) value = maximum;
+                return value;
+            }
+        }
+        return maximum;
+    }
+
+
+
+#pragma mark    --------  Collection  --------
+
+
+
+#if ASDEVICE_STATISTICS
+
+    /** Return the current time, in seconds.
+     */
+    static double currentTime()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + (tv.tv_usec / 1000000.0);
+    }
+
+
+    ASDeviceProtocolStatistics::ASDeviceProtocolStatistics()
+        :
+        m_operation(kASDeviceOperationNone),
+        m_requestCode(0),
+        m_requestTime(0.0)
+    {
+        pthread_mutex_init(&m_lock, 0);
+        memset(m_counters, 0, sizeof m_counters);
+        memset(m_latency, 0, sizeof m_latency);
+    }
+
+
+    ASDeviceProtocolStatistics::~ASDeviceProtocolStatistics()
+    {
+        for (unsigned i = 0; i < 256; i++) free(m_latency[i]);
+        pthread_mutex_destroy(&m_lock);
+    }
+
+
+    /** Start attributing traffic to an operation. Operations nest, with traffic going to the innermost
+     *  one. kASDeviceOperationNone leaves the current operation unchanged.
+     *
+     *  @param  operation   The operation (kASDeviceOperationXXX).
+     *  @return             The previous operation, to be passed to leaveOperation().
+     */
+    unsigned ASDeviceProtocolStatistics::enterOperation(unsigned operation)
+    {
+        unsigned previous = m_operation;
+        if (kASDeviceOperationNone != operation && operation < kASDeviceOperationCount)
+        {
+            pthread_mutex_lock(&m_lock);
+            m_operation = operation;
+            m_counters[operation].calls ++;
+            pthread_mutex_unlock(&m_lock);
+        }
+        return previous;
+    }
+
+
+    /** Stop attributing traffic to the current operation.
+     *
+     *  @param  previous    The value returned by the matching enterOperation().
+     */
+    void ASDeviceProtocolStatistics::leaveOperation(unsigned previous)
+    {
+        m_operation = previous;
+    }
+
+
+    /** Record that a request has been sent. The time is noted so that the response latency can be measured.
+     *
+     *  @param  code        The request code.
+     *  @param  bytes       The message size.
+     */
+    void ASDeviceProtocolStatistics::requestSent(unsigned code, unsigned bytes)
+    {
+        m_requestCode = code & 0xff;
+        m_requestTime = currentTime();
+
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].bytesOut += bytes;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record that a response has been received, completing a round trip. The latency is recorded against
+     *  the last request sent. With pipelined block reads this is measured from the request that was sent
+     *  most recently, so it excludes the time the request spent queued behind the previous block.
+     *
+     *  @param  bytes       The message size.
+     */
+    void ASDeviceProtocolStatistics::responseReceived(unsigned bytes)
+    {
+        double latency = (currentTime() - m_requestTime) * 1000000.0;
+        unsigned value = (latency < 0.0) ? 0 : (latency > kASLatencyMaxValue) ? kASLatencyMaxValue : (unsigned)latency;
+
+        pthread_mutex_lock(&m_lock);
+        ASDeviceOperationCounters* counters = &m_counters[m_operation];
+        counters->roundTrips ++;
+        counters->bytesIn += bytes;
+
+        ASLatencyHistogram* histogram = m_latency[m_requestCode];
+        if (!histogram) histogram = m_latency[m_requestCode] = (ASLatencyHistogram*) calloc(1, sizeof (ASLatencyHistogram));
+        if (histogram) histogram->record(value);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record bulk data sent outside of an ASM message.
+     */
+    void ASDeviceProtocolStatistics::dataSent(unsigned bytes)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].bytesOut += bytes;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record bulk data received outside of an ASM message.
+     */
+    void ASDeviceProtocolStatistics::dataReceived(unsigned bytes)
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].bytesIn += bytes;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record a dialogue setup.
+     */
+    void ASDeviceProtocolStatistics::dialogue()
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].dialogues ++;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record a retried attempt.
+     */
+    void ASDeviceProtocolStatistics::retry()
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].retries ++;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record a data checksum failure.
+     */
+    void ASDeviceProtocolStatistics::checksumFailure()
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].checksumFailures ++;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Record a failed or timed out transport read or write.
+     */
+    void ASDeviceProtocolStatistics::stall()
+    {
+        pthread_mutex_lock(&m_lock);
+        m_counters[m_operation].stalls ++;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Take a snapshot of the counters for an operation.
+     *
+     *  @param  operation   The operation (kASDeviceOperationXXX).
+     *  @param  counters    Returns the counters.
+     *  @return             Logical true if the operation is valid.
+     */
+    bool ASDeviceProtocolStatistics::operationCounters(unsigned operation, ASDeviceOperationCounters* counters) const
+    {
+        memset(counters, 0, sizeof *counters);
+        if (operation >= kASDeviceOperationCount) return false;
+
+        pthread_mutex_lock(&m_lock);
+        *counters = m_counters[operation];
+        pthread_mutex_unlock(&m_lock);
+        return true;
+    }
+
+
+    /** Take a snapshot of the latency histogram for a request code.
+     *
+     *  @param  code        The request code (ASMESSAGE_REQUEST_XXX).
+     *  @param  histogram   Returns the histogram.
+     *  @return             Logical true if any samples have been recorded for the code.
+     */
+    bool ASDeviceProtocolStatistics::latencyHistogram(unsigned code, ASLatencyHistogram* histogram) const
+    {
+        histogram->clear();
+        if (code > 0xff) return false;
+
+        pthread_mutex_lock(&m_lock);
+        if (m_latency[code]) *histogram = *m_latency[code];
+        pthread_mutex_unlock(&m_lock);
+        return histogram->count > 0;
+    }
+
+
+    /** Reset all counters and histograms.
+     */
+    void ASDeviceProtocolStatistics::reset()
+    {
+        pthread_mutex_lock(&m_lock);
+        memset(m_counters, 0, sizeof m_counters);
+        for (unsigned i = 0; i < 256; i++)
+        {
+            if (m_latency[i]) m_latency[i]->clear();
+        }
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Log the statistics to stderr.
+     */
+    void ASDeviceProtocolStatistics::log() const
+    {
+        ASDeviceOperationCounters counters;
+        for (unsigned i = 0; i < kASDeviceOperationCount; i++)
+        {
+            operationCounters(i, &counters);
+            if (0 == counters.calls && 0 == counters.roundTrips) continue;
+            fprintf(stderr, "%s: %-17s calls %u, round trips %u, dialogues %u, retries %u, checksum failures %u, stalls %u, out %llu, in %llu\n",
+                __FUNCTION__, operationName(i), counters.calls, counters.roundTrips, counters.dialogues, counters.retries,
+                counters.checksumFailures, counters.stalls, (unsigned long long)counters.bytesOut, (unsigned long long)counters.bytesIn);
+        }
+
+        ASLatencyHistogram histogram;
+        for (unsigned code = 0; code < 256; code++)
+        {
+            if (!latencyHistogram(code, &histogram)) continue;
+            fprintf(stderr, "%s: %02x %-28s n %u, mean %.0fus, p50 %uus, p90 %uus, p99 %uus, max %uus\n",
+                __FUNCTION__, code, ASMessage::name(code), histogram.count, histogram.mean(),
+                histogram.percentile(50.0), histogram.percentile(90.0), histogram.percentile(99.0), histogram.maximum);
+        }
+    }
+
+#else   // ASDEVICE_STATISTICS
+
+    ASDeviceProtocolStatistics::ASDeviceProtocolStatistics()
+    {
+    }
+
+
+    ASDeviceProtocolStatistics::~ASDeviceProtocolStatistics()
+    {
+    }
+
+
+    bool ASDeviceProtocolStatistics::operationCounters(unsigned, ASDeviceOperationCounters* counters) const
+    {
+        memset(counters, 0, sizeof *counters);
+        return false;
+    }
+
+
+    bool ASDeviceProtocolStatistics::latencyHistogram(unsigned, ASLatencyHistogram* histogram) const
+    {
+        histogram->clear();
+        return false;
+    }
+
+
+    void ASDeviceProtocolStatistics::reset()
+    {
+    }
+
+
+    void ASDeviceProtocolStatistics::log() const
+    {
+    }
+
+#endif  // ASDEVICE_STATISTICS
+
+}   // namespace
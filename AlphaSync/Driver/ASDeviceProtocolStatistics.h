@@ -0,0 +1,172 @@
+/** @file   ASDeviceProtocolStatistics.h
+ *  @brief  Per-device protocol counters and latency histograms.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef COM_TSONIQ_ASDeviceProtocolStatistics_H
+#define COM_TSONIQ_ASDeviceProtocolStatistics_H   (1)
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Compile time policy: define ASDEVICE_STATISTICS as zero in the build settings to remove the protocol
+ * statistics. The recording calls then become empty inline functions.
+ */
+#ifndef ASDEVICE_STATISTICS
+#define ASDEVICE_STATISTICS     (1)
+#endif
+
+namespace ts
+{
+    /* Public operation classes used to attribute protocol traffic (see ASDeviceLease).
+     */
+    #define kASDeviceOperationNone              (0)     /**< No operation (traffic is attributed to the enclosing operation). */
+    #define kASDeviceOperationInitialise        (1)     /**< ASDevice::initialise(). */
+    #define kASDeviceOperationEnumerateApplets  (2)     /**< Applet enumeration and lookup. */
+    #define kASDeviceOperationReadFile          (3)     /**< ASDevice::readFile(). */
+    #define kASDeviceOperationWriteFile         (4)     /**< ASDevice::writeFile(). */
+    #define kASDeviceOperationCreateFile        (5)     /**< ASDevice::createFile() and createFiles(). */
+    #define kASDeviceOperationClearFile         (6)     /**< ASDevice::clearFile(), clearFiles() and clearAllFiles(). */
+    #define kASDeviceOperationListFiles         (7)     /**< ASDevice::listFiles(). */
+    #define kASDeviceOperationFileAttributes    (8)     /**< ASDevice::getFileAttributes() and setFileAttributes(). */
+    #define kASDeviceOperationResourceUsage     (9)     /**< ASDevice::getAppletResourceUsage(). */
+    #define kASDeviceOperationSystemInfo        (10)    /**< ASDevice::systemVersion() and systemMemory(). */
+    #define kASDeviceOperationReadSettings      (11)    /**< ASDevice::readSettings() and readAllSettings(). */
+    #define kASDeviceOperationReadApplet        (12)    /**< ASDevice::readApplet(). */
+    #define kASDeviceOperationWriteApplet       (13)    /**< ASDevice::writeApplet(). */
+    #define kASDeviceOperationRestart           (14)    /**< ASDevice::restart(). */
+    #define kASDeviceOperationCount             (15)    /**< The number of operation classes. */
+
+    /* Latency histogram layout. Values are in microseconds. The first eight buckets are one microsecond
+     * wide; above that each power of two is split in to eight buckets, so the error is at most 12.5%.
+     */
+    #define kASLatencySubBuckets                (8)             /**< Buckets per power of two. */
+    #define kASLatencyBuckets                   (200)           /**< Buckets needed to reach kASLatencyMaxValue. */
+    #define kASLatencyMaxValue                  (0x7ffffff)     /**< Largest value recorded (about 134 seconds). */
+
+
+    /** Protocol counters for one class of operation.
+     */
+    struct ASDeviceOperationCounters
+    {
+        unsigned calls;                         /**< The number of calls to the operation. */
+        unsigned roundTrips;                    /**< ASM request/response exchanges. */
+        unsigned dialogues;                     /**< Dialogue setups (hello, reset and applet switch). */
+        unsigned retries;                       /**< Retried attempts. */
+        unsigned checksumFailures;              /**< Data blocks received with a bad checksum. */
+        unsigned stalls;                        /**< Transport reads or writes that failed or timed out. */
+        uint64_t bytesOut;                      /**< Bytes sent (messages and data). */
+        uint64_t bytesIn;                       /**< Bytes received (messages and data). */
+    };
+
+
+    /** Latency histogram for a single ASM request code.
+     */
+    struct ASLatencyHistogram
+    {
+        uint32_t counts[kASLatencyBuckets];     /**< Samples per bucket. */
+        unsigned count;                         /**< Total number of samples. */
+        unsigned minimum;                       /**< Smallest sample. */
+        unsigned maximum;                       /**< Largest sample. */
+        double total;                           /**< Sum of all samples. */
+
+        void clear();
+        void record(unsigned value);
+        unsigned percentile(double percent) const;
+        double mean() const { return (count > 0) ? (total / count) : 0.0; }
+
+        static unsigned bucketForValue(unsigned value);
+        static unsigned valueForBucket(unsigned bucket);
+    };
+
+
+    /** Class used to collect protocol statistics for a device. Counters are attributed to the public
+     *  operation in progress, and the time between each ASM request and its response is recorded in a
+     *  histogram for the request code. Histograms are only allocated for codes that are actually used.
+     *
+     *  Recording is done by the thread that owns the device, but snapshots can be taken from any thread
+     *  at any time.
+     */
+    class ASDeviceProtocolStatistics
+    {
+    public:
+
+        ASDeviceProtocolStatistics();
+        ~ASDeviceProtocolStatistics();
+
+        static bool enabled() { return ASDEVICE_STATISTICS; }
+        static const char* operationName(unsigned operation);
+
+#if ASDEVICE_STATISTICS
+        unsigned enterOperation(unsigned operation);
+        void leaveOperation(unsigned previous);
+        void requestSent(unsigned code, unsigned bytes);
+        void responseReceived(unsigned bytes);
+        void dataSent(unsigned bytes);
+        void dataReceived(unsigned bytes);
+        void dialogue();
+        void retry();
+        void checksumFailure();
+        void stall();
+#else
+        unsigned enterOperation(unsigned) { return kASDeviceOperationNone; }
+        void leaveOperation(unsigned) { }
+        void requestSent(unsigned, unsigned) { }
+        void responseReceived(unsigned) { }
+        void dataSent(unsigned) { }
+        void dataReceived(unsigned) { }
+        void dialogue() { }
+        void retry() { }
+        void checksumFailure() { }
+        void stall() { }
+#endif
+
+        bool operationCounters(unsigned operation, ASDeviceOperationCounters* counters) const;
+        bool latencyHistogram(unsigned code, ASLatencyHistogram* histogram) const;
+        void reset();
+        void log() const;
+
+    private:
+
+#if ASDEVICE_STATISTICS
+        mutable pthread_mutex_t m_lock;                             /**< Protects the counters and histograms. */
+        unsigned m_operation;                                       /**< The operation in progress. */
+        unsigned m_requestCode;                                     /**< The code of the last request sent. */
+        double m_requestTime;                                       /**< The time the last request was sent. */
+        ASDeviceOperationCounters m_counters[kASDeviceOperationCount];  /**< Counters per operation. */
+        ASLatencyHistogram* m_latency[256];                         /**< Latency per request code (allocated on first use). */
+#endif
+
+        ASDeviceProtocolStatistics(const ASDeviceProtocolStatistics&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceProtocolStatistics& operator=(const ASDeviceProtocolStatistics&);     /**< Prevent the use of the assignment operator. */
+    };
+
+}   // namespace
+
+#endif      // COM_TSONIQ_ASDeviceProtocolStatistics_H
@@ -0,0 +1,244 @@
+/** @file   ASDeviceScheduler.cc
+ *  @brief  Per-device priority scheduling of protocol dialogues.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include "ASDeviceScheduler.h"
+
+namespace ts
+{
+    static pthread_key_t s_priorityKey;                     /**< Thread specific key holding the thread priority. */
+    static pthread_once_t s_priorityKeyOnce = PTHREAD_ONCE_INIT;
+
+
+    /** Return the current time, in seconds.
+     */
+    static double currentTime()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + (tv.tv_usec / 1000000.0);
+    }
+
+
+    /** Create the thread specific key used to hold the thread priority.
+     */
+    static void createPriorityKey()
+    {
+        pthread_key_create(&s_priorityKey, 0);
+    }
+
+
+    /** Constructor.
+     */
+    ASDeviceScheduler::ASDeviceScheduler()
+        :
+        m_owner(),
+        m_depth(0),
+        m_ownerPriority(kASDevicePriorityInteractive),
+        m_interactiveWaiting(0)
+    {
+        pthread_mutex_init(&m_lock, 0);
+        pthread_cond_init(&m_available, 0);
+        memset(&m_statistics, 0, sizeof m_statistics);
+    }
+
+
+    /** Destructor.
+     */
+    ASDeviceScheduler::~ASDeviceScheduler()
+    {
+        assert(0 == m_depth);
+        pthread_cond_destroy(&m_available);
+        pthread_mutex_destroy(&m_lock);
+    }
+
+
+    /** Set the scheduling priority for all device requests made by the calling thread.
+     *
+     *  @param  priority    The priority class.
+     */
+    void ASDeviceScheduler::setThreadPriority(ASDevicePriority priority)
+    {
+        pthread_once(&s_priorityKeyOnce, createPriorityKey);
+        pthread_setspecific(s_priorityKey, (void*)(uintptr_t)(priority + 1));     // zero means not set
+    }
+
+
+    /** Return the scheduling priority for the calling thread.
+     */
+    ASDevicePriority ASDeviceScheduler::threadPriority()
+    {
+        pthread_once(&s_priorityKeyOnce, createPriorityKey);
+        uintptr_t value = (uintptr_t)pthread_getspecific(s_priorityKey);
+        return (0 == value) ? kASDevicePriorityInteractive : (ASDevicePriority)(value - 1);
+    }
+
+
+    /** Wait until the calling thread can take ownership of the device, then take it at depth one. Bulk
+     *  requests wait while any interactive request is pending. The lock must be held.
+     *
+     *  @param  priority    The priority of the calling thread.
+     */
+    void ASDeviceScheduler::waitForOwnership(ASDevicePriority priority)
+    {
+        bool interactive = (kASDevicePriorityInteractive == priority);
+        bool blocked = (m_depth > 0 || (!interactive && m_interactiveWaiting > 0));
+        double start = (blocked) ? currentTime() : 0.0;
+
+        if (interactive) m_interactiveWaiting ++;
+        while (m_depth > 0 || (!interactive && m_interactiveWaiting > 0))
+        {
+            pthread_cond_wait(&m_available, &m_lock);
+        }
+        if (interactive) m_interactiveWaiting --;
+
+        m_owner = pthread_self();
+        m_depth = 1;
+        m_ownerPriority = priority;
+
+        m_statistics.acquisitions ++;
+        if (blocked)
+        {
+            double wait = currentTime() - start;
+            m_statistics.contended ++;
+            m_statistics.totalWait += wait;
+            if (wait > m_statistics.maxWait) m_statistics.maxWait = wait;
+        }
+    }
+
+
+    /** Acquire the device for the calling thread, waiting if necessary. Bulk requests wait while any
+     *  interactive request is pending. If the calling thread already owns the device, this just adds
+     *  a level of nesting.
+     */
+    void ASDeviceScheduler::acquire()
+    {
+        pthread_t self = pthread_self();
+        ASDevicePriority priority = threadPriority();
+
+        pthread_mutex_lock(&m_lock);
+        if (m_depth > 0 && pthread_equal(m_owner, self))
+        {
+            m_depth ++;                         // nested acquisition
+        }
+        else
+        {
+            waitForOwnership(priority);
+        }
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Release the device. This must be called once for each call to acquire().
+     */
+    void ASDeviceScheduler::release()
+    {
+        pthread_mutex_lock(&m_lock);
+        assert(m_depth > 0 && pthread_equal(m_owner, pthread_self()));
+        if (m_depth > 0) m_depth --;
+        if (0 == m_depth) pthread_cond_broadcast(&m_available);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Test if the owner should briefly release the device. This is true if the owner holds the device
+     *  at bulk priority, interactive work is waiting, and the device is held at exactly the given depth
+     *  (so a yield cannot break an outer acquisition, such as a lease held by a client across several
+     *  operations). The caller is responsible for only yielding at a point where the device can be
+     *  released (see ASDevice::dialogueYield()).
+     *
+     *  @param  depth       The nesting depth at which the caller is able to release the device.
+     */
+    bool ASDeviceScheduler::yieldRequested(unsigned depth) const
+    {
+        pthread_mutex_lock(const_cast<pthread_mutex_t*>(&m_lock));
+        bool result = (depth == m_depth && kASDevicePriorityBulk == m_ownerPriority && m_interactiveWaiting > 0);
+        pthread_mutex_unlock(const_cast<pthread_mutex_t*>(&m_lock));
+        return result;
+    }
+
+
+    /** Release the device completely, whatever the nesting depth, so that waiting threads can run.
+     *
+     *  @return             The nesting depth, to be passed to resume().
+     */
+    unsigned ASDeviceScheduler::suspend()
+    {
+        pthread_mutex_lock(&m_lock);
+        assert(m_depth > 0 && pthread_equal(m_owner, pthread_self()));
+        unsigned depth = m_depth;
+        m_depth = 0;
+        m_statistics.yields ++;
+        pthread_cond_broadcast(&m_available);
+        pthread_mutex_unlock(&m_lock);
+        return depth;
+    }
+
+
+    /** Reacquire the device after suspend(), restoring the nesting depth.
+     *
+     *  @param  depth       The value returned by suspend().
+     */
+    void ASDeviceScheduler::resume(unsigned depth)
+    {
+        ASDevicePriority priority = threadPriority();
+
+        pthread_mutex_lock(&m_lock);
+        waitForOwnership(priority);
+        m_depth = depth;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Return a snapshot of the contention statistics.
+     */
+    ASDeviceSchedulerStatistics ASDeviceScheduler::statistics() const
+    {
+        pthread_mutex_lock(const_cast<pthread_mutex_t*>(&m_lock));
+        ASDeviceSchedulerStatistics result = m_statistics;
+        pthread_mutex_unlock(const_cast<pthread_mutex_t*>(&m_lock));
+        return result;
+    }
+
+
+    /** Reset the contention statistics.
+     */
+    void ASDeviceScheduler::resetStatistics()
+    {
+        pthread_mutex_lock(&m_lock);
+        memset(&m_statistics, 0, sizeof m_statistics);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+}   // namespace
@@ -0,0 +1,115 @@
+/** @file   ASDeviceScheduler.h
+ *  @brief  Per-device priority scheduling of protocol dialogues.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef COM_TSONIQ_ASDeviceScheduler_H
+#define COM_TSONIQ_ASDeviceScheduler_H   (1)
+
+#include <pthread.h>
+
+namespace ts
+{
+    /* Scheduling priority classes.
+     */
+    #define kASDevicePriorityInteractive    (0)     /**< Short requests on behalf of the user (previews, attribute reads). */
+    #define kASDevicePriorityBulk           (1)     /**< Long running transfers (backups, harvests, installs). */
+
+    typedef unsigned ASDevicePriority;
+
+
+    /** Contention statistics for a device (see ASDeviceScheduler::statistics()).
+     */
+    struct ASDeviceSchedulerStatistics
+    {
+        unsigned acquisitions;                  /**< The number of times the device was acquired (excluding nested acquisitions). */
+        unsigned contended;                     /**< The number of acquisitions that had to wait. */
+        unsigned yields;                        /**< The number of times a bulk owner released the device for interactive work. */
+        double totalWait;                       /**< Total time spent waiting, in seconds. */
+        double maxWait;                         /**< The longest single wait, in seconds. */
+
+        double averageWait() const { return (contended > 0) ? (totalWait / contended) : 0.0; }
+    };
+
+
+    /** Class used to serialise access to a single device between threads, giving precedence to
+     *  interactive work.
+     *
+     *  The unit of scheduling is the public device operation (see ASDeviceLease), which may contain
+     *  several protocol dialogues. Acquisition is recursive, so a thread that already owns the device
+     *  (for example, a client holding a lease across several operations) never blocks on itself.
+     *  When the device is released, waiting interactive threads are always admitted before bulk threads.
+     *
+     *  The ASM protocol has no way to resume a file transfer part way through (reads and writes
+     *  always start at the beginning of the file), so a transfer cannot be preempted between blocks.
+     *  Instead, bulk operations that handle several files in one dialogue call yieldRequested()
+     *  between files and, if interactive work is waiting and the device is not held by an outer lease,
+     *  briefly release the device with suspend() and resume().
+     *
+     *  The priority used for a request is set per thread with setThreadPriority(). Threads that never
+     *  set a priority are treated as interactive, so single-threaded clients are not affected.
+     */
+    class ASDeviceScheduler
+    {
+    public:
+
+        ASDeviceScheduler();
+        ~ASDeviceScheduler();
+
+        static void setThreadPriority(ASDevicePriority priority);
+        static ASDevicePriority threadPriority();
+
+        void acquire();
+        void release();
+        bool yieldRequested(unsigned depth) const;
+        unsigned suspend();
+        void resume(unsigned depth);
+
+        ASDeviceSchedulerStatistics statistics() const;
+        void resetStatistics();
+
+    private:
+
+        pthread_mutex_t m_lock;                 /**< Protects the scheduler state. */
+        pthread_cond_t m_available;             /**< Signalled when the device is released. */
+        pthread_t m_owner;                      /**< The owning thread (valid only if m_depth is non-zero). */
+        unsigned m_depth;                       /**< The number of nested acquisitions by the owner. */
+        unsigned m_ownerPriority;               /**< The priority of the owner. */
+        unsigned m_interactiveWaiting;          /**< The number of interactive threads waiting. */
+        ASDeviceSchedulerStatistics m_statistics;   /**< Contention statistics. */
+
+        void waitForOwnership(ASDevicePriority priority);
+
+        ASDeviceScheduler(const ASDeviceScheduler&);                /**< Prevent the use of the copy constructor. */
+        ASDeviceScheduler& operator=(const ASDeviceScheduler&);     /**< Prevent the use of the assignment operator. */
+    };
+
+}   // namespace
+
+#endif      // COM_TSONIQ_ASDeviceScheduler_H
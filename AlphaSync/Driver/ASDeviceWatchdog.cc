@@ -0,0 +1,197 @@
+/** @file   ASDeviceWatchdog.cc
+ *  @brief  Watchdog for hung device transfers.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "ASDeviceWatchdog.h"
+#include "ASDevice.h"
+
+namespace ts
+{
+    static ASDeviceWatchdog* s_sharedWatchdog = 0;                  /**< The shared watchdog. */
+    static pthread_once_t s_sharedWatchdogOnce = PTHREAD_ONCE_INIT;
+
+
+    /** Return the current time, in seconds.
+     */
+    static double currentTime()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, 0);
+        return tv.tv_sec + (tv.tv_usec / 1000000.0);
+    }
+
+
+    /** Constructor.
+     */
+    ASDeviceWatchdog::ASDeviceWatchdog()
+        :
+        m_devices(),
+        m_armedCount(0)
+    {
+        pthread_mutex_init(&m_lock, 0);
+        pthread_cond_init(&m_armed, 0);
+    }
+
+
+    /** Destructor. The shared watchdog is never destroyed.
+     */
+    ASDeviceWatchdog::~ASDeviceWatchdog()
+    {
+        pthread_cond_destroy(&m_armed);
+        pthread_mutex_destroy(&m_lock);
+    }
+
+
+    /** Create the shared watchdog and start its thread.
+     */
+    void ASDeviceWatchdog::createSharedWatchdog()
+    {
+        ASDeviceWatchdog* watchdog = new ASDeviceWatchdog;
+
+        pthread_t thread;
+        if (0 != pthread_create(&thread, 0, threadEntry, watchdog))
+        {
+            fprintf(stderr, "%s: unable to start the watchdog thread\n", __FUNCTION__);
+        }
+        else
+        {
+            pthread_detach(thread);
+        }
+        s_sharedWatchdog = watchdog;
+    }
+
+
+    /** Return the shared watchdog, creating it if necessary.
+     */
+    ASDeviceWatchdog* ASDeviceWatchdog::sharedWatchdog()
+    {
+        pthread_once(&s_sharedWatchdogOnce, createSharedWatchdog);
+        return s_sharedWatchdog;
+    }
+
+
+    /** Register a device.
+     */
+    void ASDeviceWatchdog::addDevice(ASDevice* device)
+    {
+        pthread_mutex_lock(&m_lock);
+        device->m_watchdogDeadline = 0.0;
+        m_devices.appendItem(device);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Remove a device. On return, the watchdog is guaranteed not to be using the device.
+     */
+    void ASDeviceWatchdog::removeDevice(ASDevice* device)
+    {
+        pthread_mutex_lock(&m_lock);
+        if (0.0 != device->m_watchdogDeadline) m_armedCount --;
+        device->m_watchdogDeadline = 0.0;
+        m_devices.removeItem(device);
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Start (or restart) the time limit for a device.
+     *
+     *  @param  device      The device.
+     *  @param  limit       The time allowed, in ms.
+     */
+    void ASDeviceWatchdog::arm(ASDevice* device, unsigned limit)
+    {
+        double deadline = currentTime() + (limit / 1000.0);
+
+        pthread_mutex_lock(&m_lock);
+        if (0.0 == device->m_watchdogDeadline && 0 == m_armedCount++) pthread_cond_signal(&m_armed);
+        device->m_watchdogDeadline = deadline;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Stop the time limit for a device.
+     */
+    void ASDeviceWatchdog::disarm(ASDevice* device)
+    {
+        pthread_mutex_lock(&m_lock);
+        if (0.0 != device->m_watchdogDeadline) m_armedCount --;
+        device->m_watchdogDeadline = 0.0;
+        pthread_mutex_unlock(&m_lock);
+    }
+
+
+    /** Thread entry point.
+     */
+    void* ASDeviceWatchdog::threadEntry(void* context)
+    {
+        ((ASDeviceWatchdog*)context)->run();
+        return 0;
+    }
+
+
+    /** Watchdog thread. This sleeps until a device is armed, and then checks the armed devices about
+     *  every kASWatchdogInterval ms. The abort is issued with the lock held, so that a device cannot be removed
+     *  (and destroyed) while it is being aborted.
+     */
+    void ASDeviceWatchdog::run()
+    {
+        pthread_mutex_lock(&m_lock);
+        while (true)
+        {
+            while (0 == m_armedCount) pthread_cond_wait(&m_armed, &m_lock);
+
+            struct timeval now;
+            struct timespec wake;
+            gettimeofday(&now, 0);
+            unsigned long usec = (unsigned long)now.tv_usec + (kASWatchdogInterval * 1000);
+            wake.tv_sec = now.tv_sec + (time_t)(usec / 1000000);
+            wake.tv_nsec = (long)(usec % 1000000) * 1000;
+            pthread_cond_timedwait(&m_armed, &m_lock, &wake);
+
+            double time = currentTime();
+            for (unsigned i = 0; i < m_devices.count(); i++)
+            {
+                ASDevice* device = m_devices.itemAtIndex(i);
+                if (0.0 != device->m_watchdogDeadline && time > device->m_watchdogDeadline)
+                {
+                    fprintf(stderr, "%s: device %08x has hung - aborting the transfer\n", __FUNCTION__, device->identity());
+                    device->m_watchdogDeadline = 0.0;
+                    device->m_watchdogFired = true;
+                    m_armedCount --;
+                    device->abortTransfer();
+                }
+            }
+        }
+        pthread_mutex_unlock(&m_lock);
+    }
+
+}   // namespace
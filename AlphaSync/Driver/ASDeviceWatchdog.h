@@ -0,0 +1,90 @@
+/** @file   ASDeviceWatchdog.h
+ *  @brief  Watchdog for hung device transfers.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef COM_TSONIQ_ASDeviceWatchdog_H
+#define COM_TSONIQ_ASDeviceWatchdog_H   (1)
+
+#include <pthread.h>
+#include "AQContainer.h"
+
+#define kASWatchdogInterval         (250)       /**< How often armed devices are checked, in ms. */
+#define kASWatchdogDefaultLimit     (3000)      /**< Time allowed for a transfer in an exchange using a read-only request, in ms. */
+#define kASWatchdogSlowLimit        (15000)     /**< Time allowed for a transfer in an exchange using a request that modifies the device, in ms. */
+#define kASWatchdogDialogueLimit    (5000)      /**< Time allowed for a transfer in dialogue setup (hello, reset and applet switch), in ms. */
+
+namespace ts
+{
+    class ASDevice;
+
+
+    /** Watchdog for hung transfers. A device arms the watchdog with a time limit for each transport read
+     *  or write, and disarms it as soon as the transfer completes, so time spent by the host between
+     *  transfers (for example, in a data sink) is never counted. The limit depends on the request that
+     *  started the exchange (see ASDevice::watchdogLimit()), and flash operations have no limit. If a
+     *  transfer runs past its limit, the watchdog calls ASDevice::abortTransfer() from its own thread,
+     *  which makes the blocked transport read or write fail immediately instead of waiting for the (much
+     *  longer) transport timeout. The device then abandons the operation without retrying (see
+     *  ASDevice::retryOperation()).
+     *
+     *  A single watchdog thread serves every device. It is started when the first device is registered.
+     */
+    class ASDeviceWatchdog
+    {
+    public:
+
+        static ASDeviceWatchdog* sharedWatchdog();
+
+        void addDevice(ASDevice* device);
+        void removeDevice(ASDevice* device);
+        void arm(ASDevice* device, unsigned limit);
+        void disarm(ASDevice* device);
+
+    private:
+
+        pthread_mutex_t m_lock;                 /**< Protects the device list and the device watchdog state. */
+        pthread_cond_t m_armed;                 /**< Signalled when a device is armed. */
+        AQContainer<ASDevice> m_devices;        /**< Registered devices. */
+        unsigned m_armedCount;                  /**< The number of armed devices. */
+
+        ASDeviceWatchdog();
+        ~ASDeviceWatchdog();
+
+        void run();
+        static void* threadEntry(void* context);
+        static void createSharedWatchdog();
+
+        ASDeviceWatchdog(const ASDeviceWatchdog&);              /**< Prevent the use of the copy constructor. */
+        ASDeviceWatchdog& operator=(const ASDeviceWatchdog&);   /**< Prevent the use of the assignment operator. */
+    };
+
+}   // namespace
+
+#endif      // COM_TSONIQ_ASDeviceWatchdog_H
@@ -32,8 +32,15 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "ASFile.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 
 namespace ts
 {
@@ -66,6 +73,235 @@ namespace ts
     };
 
 
+    /** Reverse lookup for neoToUnicodeTable, as a two level table indexed by the high and then the low byte
+     *  of the unicode value. Pages with no Neo characters all share page zero. Each entry holds the Neo code
+     *  plus one, or zero if there is no translation. The table is built on first use.
+     */
+    #define kUnicodeToNeoMaxPages   (16)        /**< Pages available (neoToUnicodeTable currently needs eleven). */
+
+    static uint8_t unicodeToNeoIndex[256];                              /**< Page number, by high byte. */
+    static uint16_t unicodeToNeoPages[kUnicodeToNeoMaxPages][256];     /**< Neo code plus one, by low byte. */
+    static pthread_once_t unicodeToNeoOnce = PTHREAD_ONCE_INIT;
+
+
+    /** Build the reverse lookup table. The Neo table is scanned from the top down so that where a unicode
+     *  character appears more than once (0x00ac is at both 0x81 and 0xac) the lowest Neo code wins, as it
+     *  did with the original linear search.
+     */
+    static void buildUnicodeToNeoTable()
+    {
+        unsigned pages = 1;
+        for (int neo = 255; neo >= 0; neo--)
+        {
+            uint16_t uni = neoToUnicodeTable[neo];
+            unsigned high = (uni >> 8) & 0xff;
+            if (0 == unicodeToNeoIndex[high])
+            {
+                assert(pages < kUnicodeToNeoMaxPages);
+                unicodeToNeoIndex[high] = (uint8_t) pages ++;
+            }
+            unicodeToNeoPages[unicodeToNeoIndex[high]][uni & 0xff] = (uint16_t)(neo + 1);
+        }
+    }
+
+
+    /** Look up a unicode character in the reverse table (which must have been built).
+     *
+     *  @return         The Neo code, or -1 if there is no translation.
+     */
+    static inline int neoCodeForUnicode(uint16_t uni)
+    {
+        return (int) unicodeToNeoPages[unicodeToNeoIndex[uni >> 8]][uni & 0xff] - 1;
+    }
+
+
+    /** Unicode values for the upper halves of the eight bit host encodings (the lower halves are ASCII), indexed
+     *  by encoding less kASTextEncodingCP1252. Bytes undefined in CP1252 map to the matching C1 control code.
+     */
+    #define kHostEncodingCount      (kASTextEncodingCount - kASTextEncodingCP1252)
+
+    static const uint16_t hostToUnicodeTable[kHostEncodingCount][128] =
+    {
+        {   // CP1252
+            0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021, 0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008d, 0x017d, 0x008f,
+            0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014, 0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178,
+            0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7, 0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+            0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7, 0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+            0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+            0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+            0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+            0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff
+        },
+        {   // MacRoman
+            0x00c4, 0x00c5, 0x00c7, 0x00c9, 0x00d1, 0x00d6, 0x00dc, 0x00e1, 0x00e0, 0x00e2, 0x00e4, 0x00e3, 0x00e5, 0x00e7, 0x00e9, 0x00e8,
+            0x00ea, 0x00eb, 0x00ed, 0x00ec, 0x00ee, 0x00ef, 0x00f1, 0x00f3, 0x00f2, 0x00f4, 0x00f6, 0x00f5, 0x00fa, 0x00f9, 0x00fb, 0x00fc,
+            0x2020, 0x00b0, 0x00a2, 0x00a3, 0x00a7, 0x2022, 0x00b6, 0x00df, 0x00ae, 0x00a9, 0x2122, 0x00b4, 0x00a8, 0x2260, 0x00c6, 0x00d8,
+            0x221e, 0x00b1, 0x2264, 0x2265, 0x00a5, 0x00b5, 0x2202, 0x2211, 0x220f, 0x03c0, 0x222b, 0x00aa, 0x00ba, 0x03a9, 0x00e6, 0x00f8,
+            0x00bf, 0x00a1, 0x00ac, 0x221a, 0x0192, 0x2248, 0x2206, 0x00ab, 0x00bb, 0x2026, 0x00a0, 0x00c0, 0x00c3, 0x00d5, 0x0152, 0x0153,
+            0x2013, 0x2014, 0x201c, 0x201d, 0x2018, 0x2019, 0x00f7, 0x25ca, 0x00ff, 0x0178, 0x2044, 0x20ac, 0x2039, 0x203a, 0xfb01, 0xfb02,
+            0x2021, 0x00b7, 0x201a, 0x201e, 0x2030, 0x00c2, 0x00ca, 0x00c1, 0x00cb, 0x00c8, 0x00cd, 0x00ce, 0x00cf, 0x00cc, 0x00d3, 0x00d4,
+            0xf8ff, 0x00d2, 0x00da, 0x00db, 0x00d9, 0x0131, 0x02c6, 0x02dc, 0x00af, 0x02d8, 0x02d9, 0x02da, 0x00b8, 0x02dd, 0x02db, 0x02c7
+        }
+    };
+
+
+    /** Tables composing the host encodings with the Neo character set, so that eight bit text can be translated
+     *  in a single lookup per character. Built on first use (see ASFile::buildTextTables()).
+     */
+    static int16_t hostToNeoTable[kHostEncodingCount][256];     /**< Extended Neo code, by host byte. */
+    static uint8_t neoToHostTable[kHostEncodingCount][256];     /**< Host byte ('?' if none), by Neo code. */
+    static pthread_once_t textTablesOnce = PTHREAD_ONCE_INIT;
+
+
+    /* Bulk conversion of printable ASCII. Neo codes 0x20-0x7e are the same as unicode (the codes below and
+     * above are Neo font characters), so runs of these can be widened or narrowed without the tables. The
+     * following convert sixteen characters at a time while every character in the block is in that range,
+     * and return the number converted, stopping at the first block containing any other character.
+     * printableASCIILength() returns the exact length of a run, scanning sixteen characters at a time.
+     */
+
+#if defined(__SSE2__)
+
+    static unsigned widenPrintableASCII(uint16_t* uni, const uint8_t* neo, unsigned count)
+    {
+        const __m128i low = _mm_set1_epi8(0x1f);
+        const __m128i high = _mm_set1_epi8(0x7f);
+        const __m128i zero = _mm_setzero_si128();
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(neo + done));
+            __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));     // signed: 0x80-0xff fail
+            if (0xffff != _mm_movemask_epi8(ok)) break;
+            _mm_storeu_si128((__m128i*)(uni + done), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i*)(uni + done + 8), _mm_unpackhi_epi8(v, zero));
+            done += 16;
+        }
+        return done;
+    }
+
+
+    static unsigned narrowPrintableASCII(uint8_t* neo, const uint16_t* uni, unsigned count)
+    {
+        const __m128i low = _mm_set1_epi16(0x1f);
+        const __m128i high = _mm_set1_epi16(0x7f);
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(uni + done));
+            __m128i b = _mm_loadu_si128((const __m128i*)(uni + done + 8));
+            __m128i okA = _mm_and_si128(_mm_cmpgt_epi16(a, low), _mm_cmplt_epi16(a, high));  // signed: 0x8000-0xffff fail
+            __m128i okB = _mm_and_si128(_mm_cmpgt_epi16(b, low), _mm_cmplt_epi16(b, high));
+            if (0xffff != _mm_movemask_epi8(_mm_and_si128(okA, okB))) break;
+            _mm_storeu_si128((__m128i*)(neo + done), _mm_packus_epi16(a, b));
+            done += 16;
+        }
+        return done;
+    }
+
+
+    static unsigned printableASCIILength(const uint8_t* neo, unsigned count)
+    {
+        const __m128i low = _mm_set1_epi8(0x1f);
+        const __m128i high = _mm_set1_epi8(0x7f);
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(neo + done));
+            __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+            unsigned mask = (unsigned)_mm_movemask_epi8(ok);
+            if (0xffff != mask) return done + (unsigned)__builtin_ctz(~mask);
+            done += 16;
+        }
+        while (done < count && neo[done] >= 0x20 && neo[done] <= 0x7e) done ++;
+        return done;
+    }
+
+#elif defined(__aarch64__)
+
+    static unsigned widenPrintableASCII(uint16_t* uni, const uint8_t* neo, unsigned count)
+    {
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            uint8x16_t v = vld1q_u8(neo + done);
+            uint8x16_t ok = vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x20)), vcleq_u8(v, vdupq_n_u8(0x7e)));
+            if (0xff != vminvq_u8(ok)) break;
+            vst1q_u16(uni + done, vmovl_u8(vget_low_u8(v)));
+            vst1q_u16(uni + done + 8, vmovl_u8(vget_high_u8(v)));
+            done += 16;
+        }
+        return done;
+    }
+
+
+    static unsigned narrowPrintableASCII(uint8_t* neo, const uint16_t* uni, unsigned count)
+    {
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            uint16x8_t a = vld1q_u16(uni + done);
+            uint16x8_t b = vld1q_u16(uni + done + 8);
+            uint16x8_t okA = vandq_u16(vcgeq_u16(a, vdupq_n_u16(0x20)), vcleq_u16(a, vdupq_n_u16(0x7e)));
+            uint16x8_t okB = vandq_u16(vcgeq_u16(b, vdupq_n_u16(0x20)), vcleq_u16(b, vdupq_n_u16(0x7e)));
+            if (0xffff != vminvq_u16(vandq_u16(okA, okB))) break;
+            vst1q_u8(neo + done, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+            done += 16;
+        }
+        return done;
+    }
+
+
+    static unsigned printableASCIILength(const uint8_t* neo, unsigned count)
+    {
+        unsigned done = 0;
+        while (count - done >= 16)
+        {
+            uint8x16_t v = vld1q_u8(neo + done);
+            uint8x16_t ok = vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x20)), vcleq_u8(v, vdupq_n_u8(0x7e)));
+            if (0xff != vminvq_u8(ok)) break;
+            done += 16;
+        }
+        while (done < count && neo[done] >= 0x20 && neo[done] <= 0x7e) done ++;
+        return done;
+    }
+
+#else
+
+    static unsigned widenPrintableASCII(uint16_t* uni, const uint8_t* neo, unsigned count)
+    {
+        unsigned done = 0;
+        while (done < count && neo[done] >= 0x20 && neo[done] <= 0x7e)
+        {
+            uni[done] = neo[done];
+            done ++;
+        }
+        return done;
+    }
+
+
+    static unsigned narrowPrintableASCII(uint8_t* neo, const uint16_t* uni, unsigned count)
+    {
+        unsigned done = 0;
+        while (done < count && uni[done] >= 0x20 && uni[done] <= 0x7e)
+        {
+            neo[done] = (uint8_t) uni[done];
+            done ++;
+        }
+        return done;
+    }
+
+
+    static unsigned printableASCIILength(const uint8_t* neo, unsigned count)
+    {
+        unsigned done = 0;
+        while (done < count && neo[done] >= 0x20 && neo[done] <= 0x7e) done ++;
+        return done;
+    }
+
+#endif
+
+
 
 #pragma mark    --------  Public Methods  --------
 
@@ -77,7 +313,8 @@ namespace ts
         m_appletVersionMinor(0),
         m_haveAppletInfo(false),
         m_fileData(0),
-        m_fileSize(0)
+        m_fileSize(0),
+        m_encodedBuffer(0)
     {
         // Nothing.
     }
@@ -86,6 +323,7 @@ namespace ts
     ASFile::~ASFile()
     {
         setFileSize(0);
+        if (m_encodedBuffer) free(m_encodedBuffer);
     }
 
 
@@ -178,6 +416,61 @@ namespace ts
     }
 
 
+    bool ASFile::importEncodedText(const void* text, unsigned textSize, unsigned encoding)
+    {
+        if (kASTextEncodingUTF16 == encoding) return importText((const uint16_t*)text, textSize);
+        if (encoding >= kASTextEncodingCount) return false;
+
+        unsigned maxCount = maxCharacterCount(textSize, encoding);
+        uint16_t* unicode = (uint16_t*)malloc((maxCount + 1) * sizeof (uint16_t));
+        if (0 == unicode) return false;
+
+        TextReader reader;
+        initTextReader(&reader, text, textSize, encoding);
+        unsigned count = 0;
+        while (readUnicode(&reader, &unicode[count])) count ++;
+        assert(count <= maxCount);
+
+        bool result = importText(unicode, count * sizeof (uint16_t));
+        free(unicode);
+        return result;
+    }
+
+
+    bool ASFile::exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom) const
+    {
+        if (encoding >= kASTextEncodingCount) return false;
+
+        const uint16_t* unicode = 0;
+        unsigned unicodeSize = 0;
+        if (!exportText(&unicode, &unicodeSize, bom && kASTextEncodingUTF16 == encoding)) return false;
+        if (kASTextEncodingUTF16 == encoding)
+        {
+            *text = unicode;
+            *textSize = unicodeSize;
+            return true;
+        }
+
+        unsigned count = unicodeSize / sizeof (uint16_t);
+        unsigned size = maxEncodedSize(count, encoding, bom);
+        void* buffer = realloc(m_encodedBuffer, (size > 0) ? size : 1);
+        if (0 == buffer) return false;
+        m_encodedBuffer = (uint8_t*)buffer;
+
+        TextWriter writer;
+        initTextWriter(&writer, m_encodedBuffer, size, encoding);
+        if (bom) writeBOM(&writer);
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (0xfeff != unicode[i]) writeUnicode(&writer, unicode[i]);
+        }
+
+        *text = m_encodedBuffer;
+        *textSize = (unsigned)(writer.ptr - m_encodedBuffer);
+        return true;
+    }
+
+
 
 
 
@@ -187,27 +480,13 @@ namespace ts
 
     int ASFile::unicodeToNeo(uint16_t uni) const
     {
-        if (0x0009 == uni) return kNeoCodeTab;
-        else if (0x000a == uni) return kNeoCodeNewline;
-        else if (0x000d == uni) return kNeoCodeReturn;
-        else
-        {
-            for (unsigned i = 0; i < 256; i++)
-            {
-                if (neoToUnicodeTable[i] == uni) return (uint8_t) i;
-            }
-            return kNeoCodeUnknown;     // no match found
-        }
+        return neoCodeForCharacter(uni);
     }
 
 
     uint16_t ASFile::neoToUnicode(int neo) const
     {
-        if (neo >= 0 && neo <= 255) return neoToUnicodeTable[neo];
-        else if (neo == kNeoCodeTab) return 9;
-        else if (neo == kNeoCodeNewline) return 10;
-        else if (neo == kNeoCodeReturn) return 13;
-        else return 63;      // '?'
+        return characterForNeoCode(neo);
     }
 
 
@@ -239,6 +518,11 @@ namespace ts
         {
             while (neo != end)
             {
+                unsigned run = narrowPrintableASCII(neo, uni, (unsigned)(end - neo));
+                neo += run;
+                uni += run;
+                if (neo == end) break;
+
                 int code = unicodeToNeo(*uni ++);
                 if (code < 0 || code > 255)
                 {
@@ -283,13 +567,131 @@ namespace ts
 
         while (uni != end)
         {
-            *uni ++ = neoToUnicodeTable[*neo ++];
+            unsigned run = widenPrintableASCII(uni, neo, (unsigned)(end - uni));
+            uni += run;
+            neo += run;
+            if (uni != end) *uni ++ = neoToUnicodeTable[*neo ++];
         }
 
         return count;
     }
 
 
+    void ASFile::initTextReader(TextReader* reader, const void* text, unsigned textSize, unsigned encoding)
+    {
+        reader->ptr = (const uint8_t*)text;
+        reader->end = reader->ptr + (text ? textSize : 0);
+        reader->encoding = encoding;
+    }
+
+
+    void ASFile::initTextWriter(TextWriter* writer, void* buffer, unsigned bufferSize, unsigned encoding)
+    {
+        writer->ptr = (uint8_t*)buffer;
+        writer->end = writer->ptr + bufferSize;
+        writer->encoding = encoding;
+    }
+
+
+    unsigned ASFile::maxCharacterCount(unsigned textSize, unsigned encoding)
+    {
+        return (kASTextEncodingUTF16 == encoding) ? textSize / 2 : textSize;
+    }
+
+
+    unsigned ASFile::maxEncodedSize(unsigned characterCount, unsigned encoding, bool bom)
+    {
+        switch (encoding)
+        {
+            case kASTextEncodingUTF16:  return (characterCount + (bom ? 1 : 0)) * 2;
+            case kASTextEncodingUTF8:   return (characterCount + (bom ? 1 : 0)) * 3;
+            default:                    return characterCount;
+        }
+    }
+
+
+    int ASFile::readNeoCode(TextReader* reader)
+    {
+        if (reader->encoding >= kASTextEncodingCP1252)
+        {
+            if (reader->ptr >= reader->end) return kNeoCodeEnd;
+            pthread_once(&textTablesOnce, buildTextTables);
+            return hostToNeoTable[reader->encoding - kASTextEncodingCP1252][*reader->ptr ++];
+        }
+
+        uint16_t uni;
+        while (readUnicode(reader, &uni))
+        {
+            if (0xfeff != uni) return neoCodeForCharacter(uni);
+        }
+        return kNeoCodeEnd;
+    }
+
+
+    void ASFile::writeNeoCode(TextWriter* writer, int code)
+    {
+        if (writer->encoding >= kASTextEncodingCP1252)
+        {
+            assert(writer->ptr < writer->end);
+            pthread_once(&textTablesOnce, buildTextTables);
+            if (code >= 0 && code <= 255) *writer->ptr ++ = neoToHostTable[writer->encoding - kASTextEncodingCP1252][code];
+            else *writer->ptr ++ = (uint8_t) characterForNeoCode(code);   // tab, newline, return or '?'
+        }
+        else
+        {
+            writeUnicode(writer, characterForNeoCode(code));
+        }
+    }
+
+
+    unsigned ASFile::writePrintableNeo(TextWriter* writer, const uint8_t* neo, unsigned count)
+    {
+        if (kASTextEncodingUTF16 == writer->encoding)
+        {
+            unsigned space = (unsigned)(writer->end - writer->ptr) / 2;
+            if (count > space) count = space;
+
+            unsigned done = 0;
+            if (0 == ((uintptr_t)writer->ptr & 1))
+            {
+                uint16_t* uni = (uint16_t*)writer->ptr;
+                done = widenPrintableASCII(uni, neo, count);
+                while (done < count && neo[done] >= 0x20 && neo[done] <= 0x7e)
+                {
+                    uni[done] = neo[done];
+                    done ++;
+                }
+            }
+            else
+            {
+                for (; done < count && neo[done] >= 0x20 && neo[done] <= 0x7e; done++)
+                {
+                    uint16_t uni = neo[done];
+                    memcpy(writer->ptr + (done * 2), &uni, sizeof uni);
+                }
+            }
+            writer->ptr += done * 2;
+            return done;
+        }
+        else
+        {
+            unsigned space = (unsigned)(writer->end - writer->ptr);
+            if (count > space) count = space;
+
+            unsigned done = printableASCIILength(neo, count);
+            memcpy(writer->ptr, neo, done);     // printable ASCII is the same in UTF8 and the eight bit encodings
+            writer->ptr += done;
+            return done;
+        }
+    }
+
+
+    void ASFile::writeBOM(TextWriter* writer)
+    {
+        if (writer->encoding <= kASTextEncodingUTF8) writeUnicode(writer, 0xfeff);
+    }
+
+
     void* ASFile::setFileSize(unsigned size)
     {
         void* newRawData = (size > 0) ? realloc(m_fileData, size) : 0;
@@ -327,6 +729,9 @@ namespace ts
     }
 
 
+#pragma mark    --------  Private Methods  --------
+
+
     bool ASFile::confirmLoad()
     {
         return true;        // derived classed should override this method
@@ -342,8 +747,209 @@ namespace ts
     }
 
 
+    /** Translate a unicode character to Neo format (see unicodeToNeo()).
+     */
+    int ASFile::neoCodeForCharacter(uint16_t uni)
+    {
+        if (0x0009 == uni) return kNeoCodeTab;
+        else if (0x000a == uni) return kNeoCodeNewline;
+        else if (0x000d == uni) return kNeoCodeReturn;
+        else
+        {
+            pthread_once(&unicodeToNeoOnce, buildUnicodeToNeoTable);
+            int code = neoCodeForUnicode(uni);
+            return (code >= 0) ? code : kNeoCodeUnknown;
+        }
+    }
 
-#pragma mark    --------  Private Methods  --------
+
+    /** Translate a Neo character to unicode (see neoToUnicode()).
+     */
+    uint16_t ASFile::characterForNeoCode(int neo)
+    {
+        if (neo >= 0 && neo <= 255) return neoToUnicodeTable[neo];
+        else if (neo == kNeoCodeTab) return 9;
+        else if (neo == kNeoCodeNewline) return 10;
+        else if (neo == kNeoCodeReturn) return 13;
+        else return 63;      // '?'
+    }
+
+
+    /** Read a single unicode character from encoded text.
+     *
+     *  @param  reader      The reader.
+     *  @param  uni         Returns the character. Malformed UTF8, and UTF8 for characters outside the
+     *                      basic multilingual plane (which the Neo has no equivalent for), gives 0xfffd.
+     *  @return             Logical true if a character was read, false at the end of the text.
+     */
+    bool ASFile::readUnicode(TextReader* reader, uint16_t* uni)
+    {
+        const uint8_t* ptr = reader->ptr;
+        const uint8_t* end = reader->end;
+        if (ptr >= end) return false;
+
+        switch (reader->encoding)
+        {
+            case kASTextEncodingUTF16:
+            {
+                if ((end - ptr) < 2) return false;      // ignore a trailing odd byte
+                memcpy(uni, ptr, sizeof (uint16_t));    // native byte order, possibly unaligned
+                ptr += 2;
+                break;
+            }
+
+            case kASTextEncodingUTF8:
+            {
+                unsigned c = *ptr ++;
+                unsigned value = 0xfffd;
+                if (c < 0x80)
+                {
+                    value = c;
+                }
+                else if (c >= 0xc2 && c <= 0xdf)
+                {
+                    if (ptr < end && (ptr[0] & 0xc0) == 0x80)
+                    {
+                        value = ((c & 0x1f) << 6) | (ptr[0] & 0x3f);
+                        ptr += 1;
+                    }
+                }
+                else if (c >= 0xe0 && c <= 0xef)
+                {
+                    if ((end - ptr) >= 2 && (ptr[0] & 0xc0) == 0x80 && (ptr[1] & 0xc0) == 0x80)
+                    {
+                        value = ((c & 0x0f) << 12) | ((ptr[0] & 0x3f) << 6) | (ptr[1] & 0x3f);
+                        if (value < 0x800 || (value >= 0xd800 && value <= 0xdfff)) value = 0xfffd;  // overlong or surrogate
+                        ptr += 2;
+                    }
+                }
+                else if (c >= 0xf0 && c <= 0xf4)
+                {
+                    if ((end - ptr) >= 3 && (ptr[0] & 0xc0) == 0x80 && (ptr[1] & 0xc0) == 0x80 && (ptr[2] & 0xc0) == 0x80)
+                    {
+                        ptr += 3;
+                    }
+                }
+                *uni = (uint16_t) value;
+                break;
+            }
+
+            default:
+            {
+                unsigned c = *ptr ++;
+                *uni = (c < 0x80) ? (uint16_t)c : hostToUnicodeTable[reader->encoding - kASTextEncodingCP1252][c - 0x80];
+                break;
+            }
+        }
+
+        reader->ptr = ptr;
+        return true;
+    }
+
+
+    /** Append a single unicode character to encoded text. Characters with no equivalent in an eight bit
+     *  encoding are written as '?'. The buffer must have space.
+     */
+    void ASFile::writeUnicode(TextWriter* writer, uint16_t uni)
+    {
+        uint8_t* ptr = writer->ptr;
+
+        switch (writer->encoding)
+        {
+            case kASTextEncodingUTF16:
+            {
+                assert((writer->end - ptr) >= 2);
+                memcpy(ptr, &uni, sizeof (uint16_t));
+                ptr += 2;
+                break;
+            }
+
+            case kASTextEncodingUTF8:
+            {
+                assert((writer->end - ptr) >= 3);
+                if (uni < 0x80)
+                {
+                    *ptr ++ = (uint8_t) uni;
+                }
+                else if (uni < 0x800)
+                {
+                    *ptr ++ = (uint8_t) (0xc0 | (uni >> 6));
+                    *ptr ++ = (uint8_t) (0x80 | (uni & 0x3f));
+                }
+                else
+                {
+                    *ptr ++ = (uint8_t) (0xe0 | (uni >> 12));
+                    *ptr ++ = (uint8_t) (0x80 | ((uni >> 6) & 0x3f));
+                    *ptr ++ = (uint8_t) (0x80 | (uni & 0x3f));
+                }
+                break;
+            }
+
+            default:
+            {
+                assert(ptr < writer->end);
+                uint8_t host = '?';
+                if (uni < 0x80)
+                {
+                    host = (uint8_t) uni;
+                }
+                else
+                {
+                    const uint16_t* table = hostToUnicodeTable[writer->encoding - kASTextEncodingCP1252];
+                    for (unsigned i = 0; i < 128; i++)
+                    {
+                        if (table[i] == uni)
+                        {
+                            host = (uint8_t) (0x80 + i);
+                            break;
+                        }
+                    }
+                }
+                *ptr ++ = host;
+                break;
+            }
+        }
+
+        writer->ptr = ptr;
+    }
+
+
+    /** Build the composed host encoding tables. Where several Neo codes share a unicode value the lowest
+     *  is used, matching unicodeToNeo().
+     */
+    void ASFile::buildTextTables()
+    {
+        for (unsigned enc = 0; enc < kHostEncodingCount; enc++)
+        {
+            for (unsigned host = 0; host < 256; host++)
+            {
+                uint16_t uni = (host < 0x80) ? (uint16_t)host : hostToUnicodeTable[enc][host - 0x80];
+                hostToNeoTable[enc][host] = (int16_t) neoCodeForCharacter(uni);
+            }
+
+            for (unsigned neo = 0; neo < 256; neo++)
+            {
+                uint16_t uni = neoToUnicodeTable[neo];
+                uint8_t host = '?';
+                if (uni < 0x80)
+                {
+                    host = (uint8_t) uni;
+                }
+                else
+                {
+                    for (unsigned i = 0; i < 128; i++)
+                    {
+                        if (hostToUnicodeTable[enc][i] == uni)
+                        {
+                            host = (uint8_t) (0x80 + i);
+                            break;
+                        }
+                    }
+                }
+                neoToHostTable[enc][neo] = host;
+            }
+        }
+    }
 
 
 }   // namespace
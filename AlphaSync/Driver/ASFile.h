@@ -37,6 +37,15 @@
 
 namespace ts
 {
+    /* Text encodings for import and export (see ASFile::importEncodedText()).
+     */
+    #define kASTextEncodingUTF16        (0)     /**< UTF16 with native byte order (as used by importText() and exportText()). */
+    #define kASTextEncodingUTF8         (1)     /**< UTF8. */
+    #define kASTextEncodingCP1252       (2)     /**< Windows code page 1252. */
+    #define kASTextEncodingMacRoman     (3)     /**< Mac OS Roman. */
+    #define kASTextEncodingCount        (4)     /**< The number of supported encodings. */
+
+
     /** The generic file converter.
      */
     class ASFile
@@ -198,6 +207,51 @@ namespace ts
         virtual bool exportText(const uint16_t** text, unsigned* textSize, bool bom=false) const;
 
 
+        /** Import the data from text in any supported encoding. By default, this converts the text to UTF16
+         *  and calls importText(). A derived class that translates text a character at a time should override
+         *  this to translate directly from the encoded text (see readNeoCode()).
+         *
+         *  @param  text        The text.
+         *  @param  textSize    The size of the text, in bytes.
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         *  @return             Logical true if the request could be completed.
+         */
+        virtual bool importEncodedText(const void* text, unsigned textSize, unsigned encoding);
+
+
+        /** Export the data as text in any supported encoding. By default, this calls exportText() and converts
+         *  the result. A derived class that translates text a character at a time should override this to
+         *  translate directly to the encoded text (see writeNeoCode()).
+         *
+         *  @param  text        Returns the address of the translated text. The text buffer will remain valid until
+         *                      the destruction of the object or the next translation request.
+         *  @param  textSize    Returns the size of the translated text, in bytes.
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         *  @param  bom         Logical true to prepend a BOM to the output (ignored for eight bit encodings). Default false.
+         *  @return             Logical true if the request could be completed.
+         */
+        virtual bool exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom=false) const;
+
+
+        /** Import the data from UTF8 text (see importEncodedText()).
+         */
+        bool importUTF8(const char* text, unsigned textSize)
+        {
+            return importEncodedText(text, textSize, kASTextEncodingUTF8);
+        }
+
+
+        /** Export the data as UTF8 text (see exportEncodedText()).
+         */
+        bool exportUTF8(const char** text, unsigned* textSize, bool bom=false) const
+        {
+            const void* data = 0;
+            bool result = exportEncodedText(&data, textSize, kASTextEncodingUTF8, bom);
+            *text = (const char*)data;
+            return result;
+        }
+
+
         /** Return the minum number of bytes that are required to meaningfully interpret the file data, or
          *  zero if a partial load is not possible. This is used to implement 'preview' functionality,
          *  where only a small subset of the full file is read (because reading from the physical device is slow...).
@@ -218,8 +272,28 @@ namespace ts
         static const int kNeoCodeReturn     =   -13;    /**< Translated character code is a carriage return. */
         static const int kNeoCodeUnknown    =   -256;   /**< No known translation for the character. */
 
+        static const int kNeoCodeEnd        =   -512;   /**< Returned by readNeoCode() at the end of the text. */
+
         static const uint8_t kNeoUntranslatableCharacter = 0;   /**< Neo character code used for untranslatable characters. */
 
+        /** Position in encoded text being imported (see readNeoCode()).
+         */
+        struct TextReader
+        {
+            const uint8_t* ptr;                 /**< The next byte to read. */
+            const uint8_t* end;                 /**< The end of the text. */
+            unsigned encoding;                  /**< The text encoding. */
+        };
+
+        /** Position in encoded text being exported (see writeNeoCode()).
+         */
+        struct TextWriter
+        {
+            uint8_t* ptr;                       /**< The next byte to write. */
+            uint8_t* end;                       /**< The end of the buffer. */
+            unsigned encoding;                  /**< The text encoding. */
+        };
+
         /** Convert a unicode character to Neo format (CP1252).
          *
          *  @param  uni     The unicode.
@@ -259,6 +333,68 @@ namespace ts
         unsigned neoToUnicode(uint16_t* uni, const uint8_t* neo, unsigned count, bool bom=false) const;
 
 
+        /** Prepare to read encoded text.
+         *
+         *  @param  reader      The reader to initialise.
+         *  @param  text        The text.
+         *  @param  textSize    The size of the text, in bytes.
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         */
+        static void initTextReader(TextReader* reader, const void* text, unsigned textSize, unsigned encoding);
+
+
+        /** Prepare to write encoded text.
+         *
+         *  @param  writer      The writer to initialise.
+         *  @param  buffer      The output buffer (at least maxEncodedSize() bytes).
+         *  @param  bufferSize  The size of the buffer, in bytes.
+         *  @param  encoding    The text encoding (kASTextEncodingXXX).
+         */
+        static void initTextWriter(TextWriter* writer, void* buffer, unsigned bufferSize, unsigned encoding);
+
+
+        /** Return the largest number of characters that may be present in encoded text.
+         */
+        static unsigned maxCharacterCount(unsigned textSize, unsigned encoding);
+
+
+        /** Return the buffer size needed to hold a number of characters in an encoding, including an optional BOM.
+         */
+        static unsigned maxEncodedSize(unsigned characterCount, unsigned encoding, bool bom);
+
+
+        /** Read the next character from encoded text and convert it to Neo format. Byte order marks are skipped.
+         *
+         *  @param  reader      The reader.
+         *  @return             An extended Neo format character code, as for unicodeToNeo(), or kNeoCodeEnd.
+         */
+        static int readNeoCode(TextReader* reader);
+
+
+        /** Convert a Neo character to the writer's encoding and append it. The buffer must have space.
+         *
+         *  @param  writer      The writer.
+         *  @param  code        An extended Neo format character code, as for neoToUnicode().
+         */
+        static void writeNeoCode(TextWriter* writer, int code);
+
+
+        /** Translate a run of printable ASCII (Neo codes 0x20-0x7e, which need no translation) in bulk,
+         *  stopping at the first other character or when the buffer is full.
+         *
+         *  @param  writer      The writer.
+         *  @param  neo         The Neo format characters.
+         *  @param  count       The number of characters available.
+         *  @return             The number of characters written.
+         */
+        static unsigned writePrintableNeo(TextWriter* writer, const uint8_t* neo, unsigned count);
+
+
+        /** Append a BOM, if the writer's encoding has one.
+         */
+        static void writeBOM(TextWriter* writer);
+
+
         /** Change the size of the raw data buffer. The buffer is either
          *  truncated or padded with zero bytes as appropriate. If this
          *  routine fails, any pre-existing data will have been preserved.
@@ -313,6 +449,13 @@ namespace ts
 
         void* m_fileData;
         unsigned m_fileSize;
+        mutable uint8_t* m_encodedBuffer;   /**< Result storage for the default exportEncodedText(). */
+
+        static int neoCodeForCharacter(uint16_t uni);
+        static uint16_t characterForNeoCode(int neo);
+        static bool readUnicode(TextReader* reader, uint16_t* uni);
+        static void writeUnicode(TextWriter* writer, uint16_t uni);
+        static void buildTextTables();
 
         ASFile(const ASFile&);              /**< Prevent the use of the copy operator. */
         ASFile& operator=(const ASFile&);   /**< Prevent the use of the assignment operator. */
@@ -0,0 +1,141 @@
+/** @file   ASMessage.cc
+ *  @brief  Protocol message descriptor table.
+ *
+ *
+ *  Copyright (c) 2008-2013, tSoniq. http://tsoniq.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *  	*	Redistributions of source code must retain the above copyright notice, this list of
+ *  	    conditions and the following disclaimer.
+ *  	*	Redistributions in binary form must reproduce the above copyright notice, this list
+ *  	    of conditions and the following disclaimer in the documentation and/or other materials
+ *  	    provided with the distribution.
+ *  	*	Neither the name of tSoniq nor the names of its contributors may be used to endorse
+ *  	    or promote products derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ *  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "ASMessage.h"
+
+namespace ts
+{
+    /** Shorthand for a table entry. */
+    #define ASMESSAGE_DESCRIPTOR(code, response, layout, data, retry, name)     { code, response, layout, data, retry, name }
+
+
+    /** Requests, indexed by request code. Code 0x05 has not been seen in use.
+     */
+    static const ASMessageDescriptor s_requests[0x20] =
+    {
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_VERSION,             ASMESSAGE_RESPONSE_VERSION,             kASMessageLayoutNone,               kASMessageDataIn,           kASMessageRetrySafe,    "VERSION"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_01,                  kASMessageResponseUnknown,              kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_01"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_BLOCK_WRITE,         ASMESSAGE_RESPONSE_BLOCK_WRITE,         kASMessageLayoutLength32Checksum16, kASMessageDataOut,          kASMessageRetryRestart, "BLOCK_WRITE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_03,                  kASMessageResponseUnknown,              kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_03"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_LIST_APPLETS,        ASMESSAGE_RESPONSE_LIST_APPLETS,        kASMessageLayoutValue32Value16,     kASMessageDataIn,           kASMessageRetrySafe,    "LIST_APPLETS"),
+        ASMESSAGE_DESCRIPTOR(0x05,                                  kASMessageResponseUnknown,              kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  0),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_WRITE_APPLET,        ASMESSAGE_RESPONSE_WRITE_APPLET,        kASMessageLayoutValue32Value16,     kASMessageDataBlockWrite,   kASMessageRetryUnsafe,  "WRITE_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_07,                  ASMESSAGE_RESPONSE_48,                  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_07"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_RESTART,             ASMESSAGE_RESPONSE_RESTART,             kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESTART"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_SET_BAUDRATE,        ASMESSAGE_RESPONSE_SET_BAUDRATE,        kASMessageLayoutValue32Value16,     kASMessageDataNone,         kASMessageRetryUnsafe,  "SET_BAUDRATE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_0A,                  kASMessageResponseUnknown,              kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_0A"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_0B,                  ASMESSAGE_RESPONSE_47,                  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_0B"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_GET_SETTINGS,        ASMESSAGE_RESPONSE_GET_SETTINGS,        kASMessageLayoutValue32Applet16,    kASMessageDataIn,           kASMessageRetrySafe,    "GET_SETTINGS"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_SET_SETTINGS,        ASMESSAGE_RESPONSE_BLOCK_WRITE,         kASMessageLayoutLength32Checksum16, kASMessageDataOut,          kASMessageRetryUnsafe,  "SET_SETTINGS"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_SET_APPLET,          ASMESSAGE_RESPONSE_SET_APPLET,          kASMessageLayoutValue32Applet16,    kASMessageDataNone,         kASMessageRetryRestart, "SET_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_READ_APPLET,         ASMESSAGE_RESPONSE_READ_FILE,           kASMessageLayoutValue32Applet16,    kASMessageDataBlockRead,    kASMessageRetrySafe,    "READ_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_BLOCK_READ,          ASMESSAGE_RESPONSE_BLOCK_READ,          kASMessageLayoutNone,               kASMessageDataIn,           kASMessageRetrySafe,    "BLOCK_READ"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_ERASE_APPLETS,       ASMESSAGE_RESPONSE_4F,                  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "ERASE_APPLETS"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_READ_FILE,           ASMESSAGE_RESPONSE_READ_FILE,           kASMessageLayoutValue32Applet16,    kASMessageDataBlockRead,    kASMessageRetrySafe,    "READ_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_GET_FILE_ATTRIBUTES, ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES, kASMessageLayoutValue32Applet16,    kASMessageDataIn,           kASMessageRetrySafe,    "GET_FILE_ATTRIBUTES"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_WRITE_FILE,          ASMESSAGE_RESPONSE_WRITE_FILE,          kASMessageLayoutIndex8Length24Applet16, kASMessageDataBlockWrite, kASMessageRetryRestart, "WRITE_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_CONFIRM_WRITE_FILE,  ASMESSAGE_RESPONSE_CONFIRM_WRITE_FILE,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryRestart, "CONFIRM_WRITE_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_16,                  ASMESSAGE_RESPONSE_CCC,                 kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_16"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_17,                  ASMESSAGE_RESPONSE_DDD,                 kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_17"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_SMALL_ROM_UPDATER,   ASMESSAGE_RESPONSE_SMALL_ROM_UPDATER,   kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "SMALL_ROM_UPDATER"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_19,                  ASMESSAGE_RESPONSE_57,                  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "REQUEST_19"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_GET_AVAIL_SPACE,     ASMESSAGE_RESPONSE_GET_AVAIL_SPACE,     kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetrySafe,    "GET_AVAIL_SPACE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_GET_USED_SPACE,      ASMESSAGE_RESPONSE_GET_USED_SPACE,      kASMessageLayoutValue32Applet16,    kASMessageDataNone,         kASMessageRetrySafe,    "GET_USED_SPACE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_READ_RAW_FILE,       ASMESSAGE_RESPONSE_READ_FILE,           kASMessageLayoutValue32Applet16,    kASMessageDataBlockRead,    kASMessageRetrySafe,    "READ_RAW_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_SET_FILE_ATTRIBUTES, ASMESSAGE_RESPONSE_SET_FILE_ATTRIBUTES, kASMessageLayoutValue32Applet16,    kASMessageDataBlockWrite,   kASMessageRetryRestart, "SET_FILE_ATTRIBUTES"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_COMMIT,              ASMESSAGE_RESPONSE_COMMIT,              kASMessageLayoutValue32Applet16,    kASMessageDataNone,         kASMessageRetryUnsafe,  "COMMIT"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_REQUEST_WRITE_RAW_FILE,      ASMESSAGE_RESPONSE_WRITE_FILE,          kASMessageLayoutIndex8Length24Applet16, kASMessageDataBlockWrite, kASMessageRetryRestart, "WRITE_RAW_FILE")
+    };
+
+
+    /** Responses and errors, in code order.
+     */
+    static const ASMessageDescriptor s_responses[] =
+    {
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_VERSION,            0,  kASMessageLayoutLength32Checksum16, kASMessageDataIn,           kASMessageRetryUnsafe,  "VERSION"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_41,                 0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_41"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_BLOCK_WRITE,        0,  kASMessageLayoutNone,               kASMessageDataOut,          kASMessageRetryUnsafe,  "BLOCK_WRITE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE,   0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "BLOCK_WRITE_DONE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_LIST_APPLETS,       0,  kASMessageLayoutLength32Checksum16, kASMessageDataIn,           kASMessageRetryUnsafe,  "LIST_APPLETS"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_45,                 0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_45"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_WRITE_APPLET,       0,  kASMessageLayoutNone,               kASMessageDataBlockWrite,   kASMessageRetryUnsafe,  "WRITE_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_47,                 0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_47"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_48,                 0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_48"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_49,                 0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_49"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_SET_BAUDRATE,       0,  kASMessageLayoutValue32Value16,     kASMessageDataNone,         kASMessageRetryUnsafe,  "SET_BAUDRATE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_GET_SETTINGS,       0,  kASMessageLayoutLength32Checksum16, kASMessageDataIn,           kASMessageRetryUnsafe,  "GET_SETTINGS"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_SET_APPLET,         0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "SET_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_BLOCK_READ,         0,  kASMessageLayoutLength32Checksum16, kASMessageDataIn,           kASMessageRetryUnsafe,  "BLOCK_READ"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_BLOCK_READ_EMPTY,   0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "BLOCK_READ_EMPTY"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_4F,                 0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_4F"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_WRITE_FILE,         0,  kASMessageLayoutNone,               kASMessageDataBlockWrite,   kASMessageRetryUnsafe,  "WRITE_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_CONFIRM_WRITE_FILE, 0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "CONFIRM_WRITE_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_RESTART,            0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESTART"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_READ_FILE,          0,  kASMessageLayoutValue32Value16,     kASMessageDataBlockRead,    kASMessageRetryUnsafe,  "READ_FILE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_CCC,                0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_54"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_DDD,                0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_55"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_SMALL_ROM_UPDATER,  0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "SMALL_ROM_UPDATER"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_57,                 0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "RESPONSE_57"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_GET_AVAIL_SPACE,    0,  kASMessageLayoutValue32Value16,     kASMessageDataNone,         kASMessageRetryUnsafe,  "GET_AVAIL_SPACE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_GET_USED_SPACE,     0,  kASMessageLayoutValue32Value16,     kASMessageDataNone,         kASMessageRetryUnsafe,  "GET_USED_SPACE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_GET_FILE_ATTRIBUTES, 0, kASMessageLayoutLength32Checksum16, kASMessageDataIn,           kASMessageRetryUnsafe,  "GET_FILE_ATTRIBUTES"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_SET_FILE_ATTRIBUTES, 0, kASMessageLayoutNone,               kASMessageDataBlockWrite,   kASMessageRetryUnsafe,  "SET_FILE_ATTRIBUTES"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_RESPONSE_COMMIT,             0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "COMMIT"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_INVALID_BAUDRATE,      0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_INVALID_BAUDRATE"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_87,                    0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_87"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_INVALID_APPLET,        0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_INVALID_APPLET"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_PROTOCOL,              0,  kASMessageLayoutNone,               kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_PROTOCOL"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_PARAMETER,             0,  kASMessageLayoutValue32Value16,     kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_PARAMETER"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_OUTOFMEMORY,           0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_OUTOFMEMORY"),
+        ASMESSAGE_DESCRIPTOR(ASMESSAGE_ERROR_94,                    0,  kASMessageLayoutUnknown,            kASMessageDataNone,         kASMessageRetryUnsafe,  "ERROR_94")
+    };
+
+
+    /** Return the descriptor for a message code.
+     *
+     *  @param  code        The message code.
+     *  @return             The descriptor, or zero if the code is not known.
+     */
+    const ASMessageDescriptor* ASMessage::descriptor(unsigned code)
+    {
+        if (code < sizeof s_requests / sizeof s_requests[0])
+        {
+            return (0 != s_requests[code].name) ? &s_requests[code] : 0;
+        }
+        for (unsigned i = 0; i < sizeof s_responses / sizeof s_responses[0]; i++)
+        {
+            if (s_responses[i].code == code) return &s_responses[i];
+            if (s_responses[i].code > code) break;
+        }
+        return 0;
+    }
+
+}   // namespace
@@ -103,7 +103,7 @@
 #define ASMESSAGE_RESPONSE_BLOCK_WRITE          (0x42)      /**< (z48): reply to block write request. */
 #define ASMESSAGE_RESPONSE_BLOCK_WRITE_DONE     (0x43)      /**< (z43): reply to block write request. */
 #define ASMESSAGE_RESPONSE_LIST_APPLETS         (0x44)      /**< (len32, csum16): returns array of applet headers. */
-#define ASMESSAGE_RESPONSE_45                   (0x41)      /**< Unknown. */
+#define ASMESSAGE_RESPONSE_45                   (0x45)      /**< Unknown. */
 #define ASMESSAGE_RESPONSE_WRITE_APPLET         (0x46)      /**< (z48?): sent in response to ASMESSAGE_REQUEST_WRITE_APPLET */
 #define ASMESSAGE_RESPONSE_47                   (0x47)      /**< (z48?): unknown: sent in response to ASMESSAGE_REQUEST_0B - possibly an ok to proceed check? */
 #define ASMESSAGE_RESPONSE_48                   (0x48)      /**< (z48?): unknown: sent in response to ASMESSAGE_REQUEST_07 */
@@ -137,8 +137,57 @@
 #define ASMESSAGE_ERROR_94                      (0x94)      /**< Seen in response to sending command code 0x20 */
 
 
+/* Request retry classification (see ASMessage::retryClass()).
+ */
+#define kASMessageRetrySafe                     (0)         /**< Request only reads state and may be repeated freely. */
+#define kASMessageRetryRestart                  (1)         /**< Request modifies state, but repeating the whole operation gives the same result. */
+#define kASMessageRetryUnsafe                   (2)         /**< Request may have a different effect if repeated. */
+
+
+/* Argument layouts (see ASMessageDescriptor).
+ */
+#define kASMessageLayoutUnknown                 (0)         /**< Not known. */
+#define kASMessageLayoutNone                    (1)         /**< (z48): no arguments. */
+#define kASMessageLayoutLength32Checksum16      (2)         /**< (len32, csum16): describes a data phase. */
+#define kASMessageLayoutValue32Applet16         (3)         /**< (value32, applet16): an index, flags or selector, and an applet ID. */
+#define kASMessageLayoutValue32Value16          (4)         /**< (value32, value16): other pairs of values. */
+#define kASMessageLayoutIndex8Length24Applet16  (5)         /**< (index8, len24, applet16): file write requests. */
+
+
+/* Data phases following a message (see ASMessageDescriptor).
+ */
+#define kASMessageDataNone                      (0)         /**< No data follows. */
+#define kASMessageDataIn                        (1)         /**< A single block of data is read from the device. */
+#define kASMessageDataOut                       (2)         /**< A single block of data is written to the device. */
+#define kASMessageDataBlockRead                 (3)         /**< Data is read using BLOCK_READ requests. */
+#define kASMessageDataBlockWrite                (4)         /**< Data is written using BLOCK_WRITE requests. */
+
+#define kASMessageResponseUnknown               (0)         /**< Expected response value for requests with no known reply. */
+
+
+/** Build a constant message frame as an aggregate initialiser for a uint8_t[8] array. All arguments must be
+ *  constants, in which case the checksum is a constant expression and the frame is fully formed at compile time.
+ */
+#define ASMESSAGE_FRAME(code, b1, b2, b3, b4, b5, b6)                                                         \
+    { (uint8_t)(code), (uint8_t)(b1), (uint8_t)(b2), (uint8_t)(b3), (uint8_t)(b4), (uint8_t)(b5), (uint8_t)(b6), \
+      (uint8_t)(((code) + (b1) + (b2) + (b3) + (b4) + (b5) + (b6)) & 0xff) }
+
+
 namespace ts
 {
+    /** Static description of a message code. The table of descriptors (see ASMessage::descriptor()) is
+     *  constant data, so looking up a request is an array index.
+     */
+    struct ASMessageDescriptor
+    {
+        uint8_t code;                           /**< The message code. */
+        uint8_t response;                       /**< For requests, the response expected on success (or kASMessageResponseUnknown). */
+        uint8_t layout;                         /**< The argument layout (kASMessageLayoutXXX). */
+        uint8_t dataPhase;                      /**< The data phase that follows (kASMessageDataXXX). */
+        uint8_t retryClass;                     /**< For requests, the retry classification (kASMessageRetryXXX). */
+        const char* name;                       /**< Name, for diagnostics. */
+    };
+
 
     /** Generalised command packet handling.
      *
@@ -175,14 +224,94 @@ namespace ts
         }
 
 
+        /** Construct from a prebuilt frame (see ASMESSAGE_FRAME).
+         *
+         *  @param  frame       The frame, including its checksum.
+         */
+        explicit ASMessage(const uint8_t (&frame)[8])
+        {
+            for (unsigned i = 0; i < sizeof m_data; i++) m_data[i] = frame[i];
+        }
+
+
         /** Initialise the command block. All arguments are cleared except for the (specified) command code.
          *
          *  @param  code        The command code for the message.
          */
         void init(unsigned code)
         {
-            for (unsigned int i = 1; i < sizeof m_data / sizeof m_data[0]; i++) m_data[i] = 0;
-            setCommand(code);
+            m_data[0] = code & 0xff;
+            m_data[1] = 0;
+            m_data[2] = 0;
+            m_data[3] = 0;
+            m_data[4] = 0;
+            m_data[5] = 0;
+            m_data[6] = 0;
+            m_data[7] = code & 0xff;    // the checksum of a frame with no arguments is the command code
+        }
+
+
+        static const ASMessageDescriptor* descriptor(unsigned code);
+
+
+        /** Return the response expected for a request.
+         *
+         *  @param  code        The request code.
+         *  @return             The response code, or kASMessageResponseUnknown.
+         */
+        static unsigned expectedResponse(unsigned code)
+        {
+            const ASMessageDescriptor* desc = descriptor(code);
+            return (desc) ? desc->response : kASMessageResponseUnknown;
+        }
+
+
+        /** Return a message code name, for diagnostics.
+         *
+         *  @param  code        The message code.
+         *  @return             The name.
+         */
+        static const char* name(unsigned code)
+        {
+            const ASMessageDescriptor* desc = descriptor(code);
+            return (desc) ? desc->name : "unknown";
+        }
+
+
+        /** Test if this message is the expected successful response to a request.
+         *
+         *  @param  request     The request code.
+         *  @return             Logical true if the response matches the descriptor table.
+         */
+        bool isResponseTo(unsigned request) const
+        {
+            unsigned expected = expectedResponse(request);
+            return (kASMessageResponseUnknown != expected) && (command() == expected);
+        }
+
+
+        /** Test if a message code is an error report from the device.
+         *
+         *  @param  code        The message code.
+         *  @return             Logical true if the code is one of the ASMESSAGE_ERROR_xxx values.
+         */
+        static bool isErrorCode(unsigned code)
+        {
+            return (code >= 0x80);
+        }
+
+
+        /** Classify a request according to whether it can be repeated following a failure.
+         *
+         *  @param  code        The request code.
+         *  @return             kASMessageRetrySafe for requests that only read state, kASMessageRetryRestart for
+         *                      requests that modify state but give the same result if the whole operation is repeated,
+         *                      and kASMessageRetryUnsafe for requests where a repeat may have a different effect.
+         */
+        static unsigned retryClass(unsigned code)
+        {
+            const ASMessageDescriptor* desc = descriptor(code);
+            return (desc) ? desc->retryClass : kASMessageRetryUnsafe;
         }
 
 
@@ -217,7 +346,11 @@ namespace ts
         void setCommand(unsigned code)
         {
             m_data[0] = code & 0xff;
-            setChecksum();
+
+            // Recalculate fully, as the message may be a reused response with a bad checksum
+            unsigned sum = 0;
+            for (unsigned i = 0; i < 7; i++)  sum += m_data[i];
+            m_data[7] = sum & 0xff;
         }
 
 
@@ -245,7 +378,8 @@ namespace ts
 
 
 
-        /** Set an value in to the command block.
+        /** Set an value in to the command block. The checksum is updated incrementally, from the bytes
+         *  that change.
          *
          *  @param  value       The value to set.
          *  @param  offset      The byte offset in to the command block.
@@ -255,12 +389,14 @@ namespace ts
         {
             assert(width >= 1 && width <= 4);
             assert(offset >= 1 && offset + width <= 7);
+            unsigned sum = m_data[7];
             for (int i = width - 1; i >= 0; i--)
             {
+                sum = sum - m_data[offset+i] + (value & 0xff);      // update the checksum incrementally
                 m_data[offset+i] = value & 0xff;
                 value = value >> 8;
             }
-            setChecksum();
+            m_data[7] = sum & 0xff;
         }
 
 
@@ -308,16 +444,6 @@ namespace ts
 
         uint8_t m_data[8];
 
-
-        /** Set a valid checksum.
-         */
-        void setChecksum()
-        {
-            unsigned sum = 0;
-            for (unsigned i = 0; i < 7; i++)  sum += m_data[i];
-            m_data[7] = sum;
-        }
-
     };
 
 
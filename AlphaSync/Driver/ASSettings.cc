@@ -28,6 +28,7 @@
  *
  */
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include "ASEndian.h"
@@ -321,4 +322,123 @@ namespace ts
         }
     }
 
+
+
+#pragma mark -
+#pragma mark ASSettingsCollection : Public Methods
+
+    /** Constructor, building an empty collection.
+     */
+    ASSettingsCollection::ASSettingsCollection()
+        :
+        m_arena(0),
+        m_arenaSize(0),
+        m_arenaAllocation(0),
+        m_entries(0),
+        m_entryCount(0),
+        m_entryAllocation(0)
+    {
+        // Nothing
+    }
+
+
+    /** Destructor.
+     */
+    ASSettingsCollection::~ASSettingsCollection()
+    {
+        free(m_arena);
+        free(m_entries);
+    }
+
+
+    /** Remove all entries. The arena memory is retained for re-use.
+     */
+    void ASSettingsCollection::clear()
+    {
+        m_arenaSize = 0;
+        m_entryCount = 0;
+    }
+
+
+    /** Return a settings view for an entry.
+     *
+     *  @param  index   The entry index.
+     *  @return         A settings object referencing the entry data (empty if the index is out of range).
+     */
+    ASSettings ASSettingsCollection::settingsAtIndex(unsigned index)
+    {
+        if (index >= m_entryCount) return ASSettings(m_arena, 0, 0);
+        const Entry* entry = &m_entries[index];
+        return ASSettings(m_arena + entry->offset, entry->size, entry->size);
+    }
+
+
+    /** Find the entry for an applet.
+     *
+     *  @param  appletID    The applet ID.
+     *  @param  flags       The flags used to read the settings.
+     *  @return             The entry index, or -1 if there is no matching entry.
+     */
+    int ASSettingsCollection::indexForApplet(unsigned appletID, unsigned flags) const
+    {
+        for (unsigned i = 0; i < m_entryCount; i++)
+        {
+            if (m_entries[i].appletID == appletID && m_entries[i].flags == flags) return (int)i;
+        }
+        return -1;
+    }
+
+
+    /** Reserve space at the end of the arena for a new entry. The data must be written to the returned
+     *  pointer and then added with commit(). Any previously returned views may be invalidated.
+     *
+     *  @param  size    The number of bytes required. This may be zero (an applet with empty settings).
+     *  @return         A pointer to the reserved space, or zero if memory could not be allocated.
+     */
+    uint8_t* ASSettingsCollection::reserve(unsigned size)
+    {
+        if (!m_arena || m_arenaSize + size > m_arenaAllocation)
+        {
+            unsigned allocation = (m_arenaAllocation) ? m_arenaAllocation : 4096;
+            while (allocation < m_arenaSize + size) allocation *= 2;
+            uint8_t* arena = (uint8_t*)realloc(m_arena, allocation);
+            if (!arena) return 0;
+            m_arena = arena;
+            m_arenaAllocation = allocation;
+        }
+        return m_arena + m_arenaSize;
+    }
+
+
+    /** Add an entry for data that has been written to the space returned by reserve().
+     *
+     *  @param  appletID    The applet ID.
+     *  @param  flags       The flags used to read the settings.
+     *  @param  size        The number of bytes of data (no more than the reserved size).
+     *  @return             Logical true if the entry was added.
+     */
+    bool ASSettingsCollection::commit(unsigned appletID, unsigned flags, unsigned size)
+    {
+        assert(m_arenaSize + size <= m_arenaAllocation);
+
+        if (m_entryCount == m_entryAllocation)
+        {
+            unsigned allocation = (m_entryAllocation) ? (m_entryAllocation * 2) : 16;
+            Entry* entries = (Entry*)realloc(m_entries, allocation * sizeof (Entry));
+            if (!entries) return false;
+            m_entries = entries;
+            m_entryAllocation = allocation;
+        }
+
+        Entry* entry = &m_entries[m_entryCount++];
+        entry->appletID = appletID;
+        entry->flags = flags;
+        entry->offset = m_arenaSize;
+        entry->size = size;
+
+        m_arenaSize += (size + 1) & ~1u;        // keep each entry 16-bit aligned
+        if (m_arenaSize > m_arenaAllocation) m_arenaSize = m_arenaAllocation;
+        return true;
+    }
+
 }   // namespace
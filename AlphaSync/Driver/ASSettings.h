@@ -129,6 +129,53 @@ namespace ts
         ASSettings();   // Prevent the use of the default constructor.
     };
 
+
+
+    /** Class used to hold the settings for many applets in a single contiguous arena. Each entry is
+     *  identified by the applet ID and the flags used to read it, and is accessed via an ASSettings
+     *  view on to the arena. Views remain valid until the collection is modified or destroyed.
+     */
+    class ASSettingsCollection
+    {
+    public:
+
+        ASSettingsCollection();
+        ~ASSettingsCollection();
+
+        void clear();
+
+        unsigned count() const { return m_entryCount; }
+        unsigned appletIDAtIndex(unsigned index) const { return (index < m_entryCount) ? m_entries[index].appletID : 0; }
+        unsigned flagsAtIndex(unsigned index) const { return (index < m_entryCount) ? m_entries[index].flags : 0; }
+        ASSettings settingsAtIndex(unsigned index);
+        int indexForApplet(unsigned appletID, unsigned flags) const;
+
+        uint8_t* reserve(unsigned size);
+        bool commit(unsigned appletID, unsigned flags, unsigned size);
+
+    private:
+
+        /** Description of a single entry in the arena.
+         */
+        struct Entry
+        {
+            unsigned appletID;                  /**< The applet ID. */
+            unsigned flags;                     /**< The flags used to read the settings. */
+            unsigned offset;                    /**< The offset of the data in the arena. */
+            unsigned size;                      /**< The number of bytes of data. */
+        };
+
+        uint8_t* m_arena;                       /**< The settings data for all entries. */
+        unsigned m_arenaSize;                   /**< The number of bytes used in the arena. */
+        unsigned m_arenaAllocation;             /**< The number of bytes allocated for the arena. */
+        Entry* m_entries;                       /**< The entry table. */
+        unsigned m_entryCount;                  /**< The number of entries in use. */
+        unsigned m_entryAllocation;             /**< The number of entries allocated. */
+
+        ASSettingsCollection(const ASSettingsCollection&);              /**< Prevent the use of the copy constructor. */
+        ASSettingsCollection& operator=(const ASSettingsCollection&);   /**< Prevent the use of the assignment operator. */
+    };
+
 }   // namespace
 
 #endif  // COM_TSONIQ_ASSettings_h
@@ -210,13 +210,50 @@ namespace ts
 
     bool ASUserDictionaryFile::importText(const uint16_t* text, unsigned textSize)
     {
+        return importEncodedText(text, textSize, kASTextEncodingUTF16);
+    }
+
+
+    bool ASUserDictionaryFile::exportText(const uint16_t** text, unsigned* textSize, bool bom) const
+    {
+        const void* data = 0;
+        bool result = exportEncodedText(&data, textSize, kASTextEncodingUTF16, bom);
+        *text = (const uint16_t*)data;
+        return result;
+    }
+
+
+    bool ASUserDictionaryFile::importEncodedText(const void* text, unsigned textSize, unsigned encoding)
+    {
+        if (encoding >= kASTextEncodingCount) return false;
         if (!clearDictionary()) return false;
 
-        unsigned characterCount = textSize / 2;
+        unsigned characterCount = maxCharacterCount(textSize, encoding);
 
         uint8_t* neoText = (uint8_t*)malloc(characterCount * sizeof (uint8_t) + 1);   // +1 to allow additional zero terminator at end
         if (!neoText) return false;
-        unicodeToNeo(neoText, text, characterCount);
+
+        if (kASTextEncodingUTF16 == encoding)
+        {
+            characterCount = unicodeToNeo(neoText, (const uint16_t*)text, characterCount);
+        }
+        else
+        {
+            // Translate as for unicodeToNeo(), passing through tab, newline and return so that they separate words
+            TextReader reader;
+            initTextReader(&reader, text, textSize, encoding);
+            uint8_t* neo = neoText;
+            int code;
+            while (kNeoCodeEnd != (code = readNeoCode(&reader)))
+            {
+                if (code == kNeoCodeTab) code = 9;
+                else if (code == kNeoCodeNewline) code = 10;
+                else if (code == kNeoCodeReturn) code = 11;
+                else if (code < 0 || code > 255) code = kNeoUntranslatableCharacter;
+                *neo ++ = (uint8_t) code;
+            }
+            characterCount = (unsigned)(neo - neoText);
+        }
 
         uint8_t* ptr = neoText;
         uint8_t* end = ptr + characterCount;
@@ -239,40 +276,43 @@ namespace ts
     }
 
 
-    bool ASUserDictionaryFile::exportText(const uint16_t** text, unsigned* textSize, bool bom) const
+    bool ASUserDictionaryFile::exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom) const
     {
         *text = 0;
         *textSize = 0;
 
+        if (encoding >= kASTextEncodingCount) return false;
         if (!fileData()) return false;
         if (0 == wordCount()) return true;
 
         // the total number of characters is the number of actual text characters plus wordCount() - 1 for the inter-word spaces that will be added.
         unsigned charCount = m_offsets[kASUserDictionaryFileMaxWordLength+1] - m_offsets[kASUserDictionaryFileMinWordLength] + wordCount() - 1;
-        if (bom) charCount++;
+        unsigned maxSize = maxEncodedSize(charCount, encoding, bom);
 
         if (0 != m_exportBuffer) free(m_exportBuffer);
-        m_exportBuffer = malloc(charCount * sizeof (uint16_t));
+        m_exportBuffer = malloc(maxSize);
         if (0 == m_exportBuffer) return false;
 
         char word[kASUserDictionaryFileMaxWordLength+1];
-        uint16_t* ptr = (uint16_t*)m_exportBuffer;
+        TextWriter writer;
+        initTextWriter(&writer, m_exportBuffer, maxSize, encoding);
 
-        if (bom) *ptr ++ = 0xfeff;              // prepend optional BOM
+        if (bom) writeBOM(&writer);             // prepend optional BOM
 
         unsigned index = 0;
         while (getWordAtIndex(word, index++))
         {
-            if (index > 1) *ptr++ = 0x0020;     // prepend a separating space character
+            if (index > 1) writeNeoCode(&writer, 0x20);     // prepend a separating space character
             char* cptr = word;
-            while (0 != *cptr) *ptr++ = neoToUnicode(*cptr++);
-            assert(ptr <= ((uint16_t*)m_exportBuffer) + charCount);
+            while (0 != *cptr) writeNeoCode(&writer, (uint8_t)*cptr++);
+            assert(writer.ptr <= writer.end);
         }
 
-        assert(ptr == ((uint16_t*)m_exportBuffer) + charCount);  // we should have got the size exactly correct...
+        // UTF16 and eight bit sizes are exact; UTF8 may use less than the worst case
+        assert(kASTextEncodingUTF8 == encoding || writer.ptr == writer.end);
 
-        *text = (uint16_t*)m_exportBuffer;
-        *textSize = charCount * sizeof (uint16_t);
+        *text = m_exportBuffer;
+        *textSize = (unsigned)(writer.ptr - (uint8_t*)m_exportBuffer);
         return true;
     }
 
@@ -96,6 +96,8 @@ namespace ts
 
         virtual bool importText(const uint16_t* text, unsigned textSize);
         virtual bool exportText(const uint16_t** text, unsigned* textSize, bool bom=false) const;
+        virtual bool importEncodedText(const void* text, unsigned textSize, unsigned encoding);
+        virtual bool exportEncodedText(const void** text, unsigned* textSize, unsigned encoding, bool bom=false) const;
 
     protected:
 